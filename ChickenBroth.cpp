@@ -13,12 +13,74 @@
 #include <glm/gtx/transform.hpp>
 #include <glm/gtc/type_ptr.hpp>
 #include <vector>
+#include <array>
+#include <string>
+#include <cstddef>
+#include <cstring>
+#include <cmath>
+#include <cstdint>
+#include <cfloat>
+#include <algorithm>
+#include <chrono>
+#include <fstream>
+#include <sstream>
+#include <atomic>
+#include <mutex>
+#include <memory>
+#include <thread>
+#include <condition_variable>
+#include <functional>
+#include <deque>
+#include <filesystem>
 #include <glm/glm.hpp>
 #include <glm/gtc/matrix_transform.hpp>
 
 #define STB_IMAGE_IMPLEMENTATION
 #include "stb_image.h"
 
+// SIMD paths are chosen at compile time; MSVC does not define __SSE2__, so x64 builds are detected directly
+#if defined(__AVX2__)
+#include <immintrin.h>
+#define U_SIMD_AVX2 1
+#elif defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define U_SIMD_SSE2 1
+#endif
+
+// Headless rendering creates its context through EGL, which is only wired up on Linux
+#if defined(__linux__)
+#include <EGL/egl.h>
+#include <EGL/eglext.h>
+#define U_HEADLESS_EGL 1
+#endif
+
+// Asset packs are memory-mapped through the platform's own API
+#if defined(_WIN32)
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+// CPU profiler zones compile to nothing when U_PROFILE is 0; when it is 1 they cost one relaxed load
+// unless a trace is being recorded
+#ifndef U_PROFILE
+#define U_PROFILE 1
+#endif
+
+#if U_PROFILE
+#define U_PROFILE_CONCAT_INNER(a, b) a##b
+#define U_PROFILE_CONCAT(a, b) U_PROFILE_CONCAT_INNER(a, b)
+#define U_PROFILE_SCOPE(name) ProfileZone U_PROFILE_CONCAT(profileZone, __LINE__)(name)
+#else
+#define U_PROFILE_SCOPE(name) ((void)0)
+#endif
+#define U_PROFILE_FUNCTION() U_PROFILE_SCOPE(__FUNCTION__)
+
 #ifndef M_PI
 #define M_PI 3.14159265358979323846264338327950288
 #endif
@@ -34,69 +96,1312 @@ namespace {
     const int WINDOW_WIDTH = 800;
     const int WINDOW_HEIGHT = 600;
 
+    // Procedural meshes carry up to this many levels of detail, finest first
+    const int MAX_MESH_LODS = 4;
+
+    // Levels with more vertices than 16-bit indices can reach are split into meshlets of at most this many
+    const int MESHLET_MAX_VERTICES = 65536;
+
+    // A run of a level's triangles with its own base vertex and mesh-space bounds, drawn and culled on its own
+    struct GLMeshlet {
+        GLuint nIndices;
+        GLuint firstIndex; // offset into the pool's index buffer, in indices of the level's index type
+        GLint baseVertex;  // offset into the pool's vertex buffer, in vertices
+        glm::vec3 boundsMin;
+        glm::vec3 boundsMax;
+    };
+
+    // One level of detail of a mesh, sub-allocated from the geometry pool
+    struct GLMeshLod {
+        GLuint nIndices;  // over all meshlets
+        GLenum indexType; // GL_UNSIGNED_SHORT, or GL_UNSIGNED_INT when that takes less memory than splitting
+        int firstMeshlet; // into the geometry pool's meshlet list
+        int meshletCount;
+        float error;      // largest distance from the ideal surface, in mesh units
+    };
+
     struct GLMesh {
+        GLuint vao; // the geometry pool's VAO, shared by every mesh
+        int lodCount;
+        GLMeshLod lods[MAX_MESH_LODS];
+
+        // Mesh-space bounds, computed from the vertex positions when the mesh is created
+        glm::vec3 boundsMin;
+        glm::vec3 boundsMax;
+        glm::vec3 sphereCenter;
+        float sphereRadius;
+
+        // Maps the stored positions back to mesh space. Quantized formats store positions relative to the
+        // bounds, so this is folded into every model matrix the mesh is drawn with; it is the identity
+        // for float vertices.
+        glm::mat4 dequantize;
+
+        // When every vertex has the same color, materials fold color into their tint and skip the
+        // per-vertex color
+        glm::vec4 color;
+        bool vertexColors;
+    };
+
+    // One vertex buffer and one index buffer that every mesh is sub-allocated from, with a single VAO
+    // describing the shared vertex format. 16-bit and 32-bit indices share the index buffer, so it is
+    // measured in bytes.
+    struct GLGeometryPool {
         GLuint vao;
         GLuint vbos[2];
-        GLuint nIndices;
+        GLsizei vertexCapacity;
+        GLsizei vertexCount;
+        GLsizeiptr indexByteCapacity;
+        GLsizeiptr indexBytes;
+        vector<GLMeshlet> meshlets;
+    };
+
+    // Shader program with its uniform locations, reflected once when the program is linked
+    struct GLProgram {
+        GLuint id;
+        GLint modelLoc;   // per-object model matrix and tint, the only uniforms that change between draws
+        GLint tintLoc;
+        GLint textureLoc;
+    };
+
+    // Shader features a variant is compiled with. Each is injected as a 0 or 1 define, and the shaders
+    // branch on those constants, so a variant carries no code for the features it leaves out.
+    enum ShaderFeature {
+        SHADER_LIGHTING = 1,     // ambient and diffuse lighting from the normal
+        SHADER_TEXTURE = 2,      // sample uTexture
+        SHADER_VERTEX_COLOR = 4, // multiply by the per-vertex color
+        SHADER_INSTANCING = 8    // model matrix and tint from the instance attributes instead of uniforms
+    };
+    const int SHADER_FEATURE_COUNT = 4;
+    const int SHADER_VARIANT_COUNT = 1 << SHADER_FEATURE_COUNT;
+    const char* const SHADER_FEATURE_NAMES[] = { "LIGHTING", "TEXTURE", "VERTEX_COLOR", "INSTANCING" };
+    const unsigned SHADER_FULL = SHADER_LIGHTING | SHADER_TEXTURE | SHADER_VERTEX_COLOR;
+
+    // Per-frame camera and light data, laid out to match the std140 FrameData block in the shaders
+    struct GLFrameData {
+        glm::mat4 view;
+        glm::mat4 projection;
+        glm::vec4 lightDirection; // xyz = directional light direction
+        glm::vec4 lightColor;     // rgb = directional light color, a = ambient strength
+        glm::vec4 clusterDepth;   // x = near plane, y = CLUSTER_Z / log(far / near), zw = framebuffer size
+    };
+
+    // Point or spot light, laid out to match the std430 Light struct in the shaders. Point lights have
+    // cone cosines below -1, so every direction is inside their cone.
+    struct GLLight {
+        glm::vec4 positionRadius; // xyz = world position, w = radius of influence
+        glm::vec4 color;          // rgb = color, w = cosine of the spot cone's inner angle
+        glm::vec4 direction;      // xyz = spot direction, w = cosine of the spot cone's outer angle
+    };
+
+    // Per-instance data for instanced draws, read through vertex attributes with a divisor of 1
+    struct GLInstance {
+        glm::mat4 model;
+        glm::vec4 tint;
+    };
+
+    // Layout glMultiDrawElementsIndirect reads from the draw indirect buffer
+    struct GLDrawCommand {
+        GLuint count;
+        GLuint instanceCount;
+        GLuint firstIndex;
+        GLint baseVertex;
+        GLuint baseInstance; // first instance record, which is how each draw finds its own data
+    };
+
+    // World-space bounds of one command's instances, read by the occlusion culling compute shader
+    struct GLDrawBounds {
+        glm::vec4 boundsMin;
+        glm::vec4 boundsMax;
+    };
+
+    // Commands and their instance records, collected over a frame and uploaded together
+    struct GLDrawList {
+        vector<GLDrawCommand> commands;
+        vector<GLInstance> instances;
+        vector<GLDrawBounds> bounds; // one per command
+        vector<int> objects;         // scene object per command, or -1
+        GLintptr commandOffset;      // where the uploaded commands start in the indirect stream, in bytes
+    };
+
+    enum RenderPass { PASS_OPAQUE = 0, PASS_TRANSPARENT = 1 };
+
+    // One draw submitted by scene code; packets are sorted by key before they reach OpenGL
+    struct GLDrawPacket {
+        uint64_t key;
+        GLuint program;
+        GLuint texture;
+        const GLMesh* mesh;
+        int lod;
+        int meshlet; // meshlet of the level to draw, or -1 for all of them
+        GLInstance instance;
+        int object; // scene object the packet came from, or -1
+    };
+
+    // A run of sorted packets sharing the same state, submitted with one multi-draw call
+    struct GLDrawBatch {
+        GLuint program;
+        GLuint texture;
+        GLuint vao;
+        RenderPass pass;
+        GLenum indexType;
+        int firstCommand;
+        int commandCount;
+    };
+
+    // Sort entries are kept apart from the packets so the radix sort only moves 16 bytes per draw
+    struct GLSortEntry {
+        uint64_t key;
+        uint32_t index;
+    };
+
+    // Draw packets collected over a frame, sorted and submitted together
+    struct GLRenderQueue {
+        vector<GLDrawPacket> packets;
+        vector<GLSortEntry> sorted;
+        vector<GLSortEntry> scratch;
+        vector<GLDrawBatch> batches;
+        glm::mat4 view;
+        float farPlane;
+    };
+
+    // What a scene object's surface needs; UMaterialFeatures picks the cheapest shader variant for it
+    struct Material {
+        GLuint texture; // 0 for an untextured surface
+        glm::vec4 tint;
+        bool lit;
+    };
+
+    // A drawable placed in the scene; its world bounds live in the BVH leaf it owns
+    struct SceneObject {
+        const GLMesh* mesh;
+        const GLProgram* program;
+        GLuint texture;
+        glm::mat4 model;
+        glm::vec4 tint;
+        int bvhLeaf;
+        int lod;         // level of detail picked last frame, kept so the selection has hysteresis
+        bool stressGrid; // part of the stress grid, which other submission paths may draw instead
+
+        // Occlusion query fallback: one query per frame parity, read back a frame later
+        GLuint occlusionQueries[2];
+        bool occlusionQueryIssued[2];
+        bool occluded;
+    };
+
+    // Node of the dynamic bounding-volume hierarchy; leaves have no children and point at a scene object.
+    // Freed nodes are chained through parent.
+    struct BvhNode {
+        glm::vec3 boundsMin;
+        glm::vec3 boundsMax;
+        int parent;
+        int left;
+        int right;
+        int object;
+    };
+
+    struct SceneBvh {
+        vector<BvhNode> nodes;
+        int root = -1;
+        int freeList = -1;
+    };
+
+    // Frustum planes in structure-of-arrays form, padded to eight so one AVX2 register holds them all
+    struct GLFrustum {
+        alignas(32) float nx[8];
+        alignas(32) float ny[8];
+        alignas(32) float nz[8];
+        alignas(32) float d[8];
+    };
+
+    enum CullResult { CULL_OUTSIDE, CULL_INTERSECT, CULL_INSIDE };
+
+    // Culling counters for the current frame
+    struct GLCullStats {
+        int nodesTested;
+        int objectsTested;
+        int objectsCulled;
+        int objectsDrawn;
+        int objectsOccluded; // query fallback only; the Hi-Z pass culls on the GPU without reporting back
+        int meshletsCulled;  // meshlets of drawn objects left out because they are outside the frustum
+    };
+
+    // One subtree of the parallel scene traversal and everything it produced. Each task runs on a single
+    // thread, so its packets and counters need no locking; tasks are merged in order afterwards, which
+    // keeps the packet order the same from run to run.
+    struct CullTask {
+        int entry; // subtree root, encoded like the traversal stack entries
+        vector<int> stack;
+        vector<GLDrawPacket> packets;
+        GLCullStats stats;
+    };
+
+    // Worker threads that run the tasks of one parallel job at a time. The calling thread takes tasks
+    // too, as worker 0, and returns once every task has finished.
+    struct WorkerPool {
+        vector<thread> threads;
+        mutex lock;
+        condition_variable wake;
+        condition_variable done;
+        function<void(int, int)> job; // (task, worker)
+        int taskCount;
+        atomic<int> nextTask;
+        int busyWorkers;
+        unsigned generation;
+        bool quit;
+    };
+
+    // Positions of a generated mesh in structure-of-arrays form, so the generators fill them a SIMD
+    // register at a time; they are interleaved into the shared vertex layout when the mesh is created
+    struct ProceduralGeometry {
+        vector<float> x;
+        vector<float> y;
+        vector<float> z;
+        vector<GLuint> indices;
+    };
+
+    // Offscreen target the scene is rendered into before it is blitted to the window
+    struct GLFramebuffer {
+        GLuint fbo;
+        GLuint colorTexture;
+        GLuint depthTexture;
+        int width;
+        int height;
+    };
+
+    // OCCLUSION_HIZ tests commands against a depth pyramid on the GPU; OCCLUSION_QUERIES is the fallback
+    // that reads GL_ANY_SAMPLES_PASSED queries back with one frame of latency
+    enum OcclusionMode { OCCLUSION_OFF, OCCLUSION_HIZ, OCCLUSION_QUERIES };
+    const char* const OCCLUSION_MODE_NAMES[] = { "off", "hi-z", "queries" };
+
+    // Most frames the CPU may record ahead of the GPU; the default can be lowered with --frames-in-flight
+    const int MAX_FRAMES_IN_FLIGHT = 4;
+
+    // A buffer created with glBufferStorage and mapped persistently and coherently, split into one region
+    // per frame in flight. The CPU writes the current frame's region through the mapping while the GPU
+    // still reads the regions of earlier frames, so uploads need neither driver copies nor orphaning.
+    struct GLStreamBuffer {
+        GLuint buffer;
+        GLbyte* mapped;
+        GLsizeiptr regionSize;
+        int region;      // region allocations are currently made from
+        GLsizeiptr used; // bytes allocated from that region so far
+    };
+
+    // One fence per frame in flight, shared by every streaming buffer. A region is only written again
+    // once the fence of the frame that last used it has signaled.
+    struct GLStreamFences {
+        GLsync fences[MAX_FRAMES_IN_FLIGHT];
+        int region;
+        double frameWaitMs;  // time the CPU spent blocked on the fence this frame
+        double totalWaitMs;
+        int framesWaited;    // frames whose fence had not signaled yet
+        int frames;
+    };
+
+    // Life of an asynchronously loaded texture. Workers move a request from queued to decoded or failed;
+    // everything after that happens on the context thread.
+    enum TextureState { TEXTURE_QUEUED, TEXTURE_DECODED, TEXTURE_FAILED, TEXTURE_UPLOADING, TEXTURE_RESIDENT };
+
+    // One mip level of a decoded texture, uploaded a row at a time. A row is one line of texels, or one
+    // line of 4x4 blocks for block-compressed data.
+    struct TextureLevel {
+        const unsigned char* data;
+        int width;
+        int height;
+        GLsizeiptr rowBytes;
+        int rowHeight; // texel lines per row: 1, or 4 for blocks
+        int rows;
+    };
+
+    // A texture requested from the loader. Its GL name is handed out at once and shows a placeholder
+    // texel; the image's rows are uploaded into a staging texture over as many frames as the budget
+    // needs and copied into the real name in one go, so a half-uploaded image is never sampled.
+    // Everything from pixels to levels is written by the decoding worker before it publishes TEXTURE_DECODED.
+    struct TextureRequest {
+        string filename;
+        GLuint texture;
+        GLuint staging;
+        unsigned char* pixels;          // stb_image result, for PNG/JPEG sources
+        vector<unsigned char> fileData; // whole file, for baked .ktx2 sources
+        GLenum internalFormat;
+        GLenum format;                  // pixel format of uncompressed data; 0 when block-compressed
+        vector<TextureLevel> levels;    // a single level for uncompressed data, which gets mipmaps once resident
+        int level;                      // level being uploaded
+        int rowsUploaded;               // rows of that level uploaded so far
+        atomic<int> state;
+        int64_t requestTime; // UProfileNow() when requested, for the time-to-resident report
+    };
+
+    // Block-compressed formats the baker writes. BC1 stores RGB in 8 bytes per 4x4 block, BC3 adds a
+    // separate alpha block, BC5 stores two independent channels (normal maps) and BC7 stores RGBA with
+    // better quality than BC3 at the same 16 bytes.
+    enum BlockFormat { BLOCK_BC1, BLOCK_BC3, BLOCK_BC5, BLOCK_BC7 };
+    const char* const BLOCK_FORMAT_NAMES[] = { "bc1", "bc3", "bc5", "bc7" };
+    const int BLOCK_FORMAT_BYTES[] = { 8, 16, 16, 16 };
+    // VK_FORMAT_BC1_RGB_UNORM_BLOCK, VK_FORMAT_BC3_UNORM_BLOCK, VK_FORMAT_BC5_UNORM_BLOCK, VK_FORMAT_BC7_UNORM_BLOCK
+    const uint32_t BLOCK_FORMAT_VK[] = { 131, 137, 141, 145 };
+
+    // Asset pack: a header, a table of contents, then one section per entry, each aligned to
+    // PACK_ALIGNMENT. Sections hold exactly what GL is given, so loading maps the file and passes
+    // pointers into it straight to the upload calls.
+    const uint32_t PACK_MAGIC = 0x4B415055; // "UPAK"
+    const uint32_t PACK_VERSION = 3;
+    const uint64_t PACK_ALIGNMENT = 64;
+    const uint32_t PACK_MAX_TEXTURE_SIZE = 65536; // past any GL_MAX_TEXTURE_SIZE, and keeps level sizes in range
+
+    enum PackEntryType { PACK_MESH_LOD = 1, PACK_TEXTURE = 2 };
+
+    struct PackHeader {
+        uint32_t magic;
+        uint32_t version;
+        uint32_t entryCount;
+        uint32_t reserved;
+    };
+
+    // A mesh LOD section holds the level as the geometry pool stores it: meshletCount meshlets with
+    // offsets relative to the level, then vertexCount vertices in vertexFormat, then indexCount indices
+    // of indexType. The mesh's bounds, color and vertexColors are repeated in every level's entry. A
+    // texture section holds levelCount mip levels back to back, level 0 first; format is 0 for
+    // block-compressed data, and texelBytes is then the size of a 4x4 block.
+    struct PackEntry {
+        char name[32];
+        uint32_t type;
+        uint32_t level; // LOD of a mesh section
+        uint64_t offset;
+        uint64_t size;
+        uint32_t vertexCount;
+        uint32_t indexCount;
+        float lodError;
+        uint32_t width;
+        uint32_t height;
+        uint32_t levelCount;
+        uint32_t internalFormat;
+        uint32_t format;
+        uint32_t texelBytes;
+        uint32_t vertexFormat;
+        uint32_t indexType;
+        uint32_t meshletCount;
+        uint32_t vertexColors;
+        float boundsMin[3];
+        float boundsMax[3];
+        float sphereRadius;
+        float color[4];
+    };
+
+    // A mapped asset pack; entries and data point into the mapping, which stays open until shutdown
+    struct AssetPack {
+        const unsigned char* data;
+        size_t size;
+        const PackEntry* entries;
+        uint32_t entryCount;
+#if defined(_WIN32)
+        HANDLE file;
+        HANDLE mapping;
+#else
+        int file;
+#endif
+    };
+
+    // Asset pack being written. While capturing, every mesh level created is recorded under the
+    // current mesh name; textures are added whole. Section offsets are relative to data until written.
+    struct AssetPackWriter {
+        bool capturing;
+        string meshName;
+        vector<PackEntry> entries;
+        vector<unsigned char> data;
+    };
+
+    // Background texture loader: decode threads take requests from a queue, and each frame uploads at
+    // most uploadBudget bytes of decoded rows through the pixel stream, a persistently mapped pixel
+    // buffer ring fenced like the other streaming buffers.
+    struct TextureLoader {
+        vector<thread> threads;
+        mutex lock;
+        condition_variable wake;
+        deque<TextureRequest*> queue;
+        bool quit;
+        vector<unique_ptr<TextureRequest>> requests; // in request order, which is also upload order
+        GLStreamBuffer pixelStream;
+        GLsizeiptr uploadBudget;
+        GLsizeiptr bytesUploaded;
+        int texturesResident;
+    };
+
+    // Samples kept per timing for the rolling min/avg/p99
+    const int TIMING_WINDOW = 240;
+
+    // Rolling statistics of one named timing, in milliseconds
+    struct GLTimingStats {
+        const char* name;
+        int depth;             // nesting depth of the scope, for reports
+        vector<float> samples; // ring of the last TIMING_WINDOW samples
+        int next;
+    };
+
+    // GPU profiler: each scope writes a GL_TIMESTAMP query where it begins and ends. A frame's queries come
+    // from one of GPU_PROFILER_FRAMES pools and are read back frames later, and only once available, so
+    // the profiler never stalls the pipeline.
+    const int GPU_PROFILER_FRAMES = 3;
+    const int MAX_GPU_QUERIES = 128;
+
+    // A timed zone, in nanoseconds since the profiler epoch. Names must be string literals or otherwise
+    // outlive the profiler.
+    struct ProfileEvent {
+        const char* name;
+        int64_t start;
+        int64_t end;
+    };
+
+    struct GLGpuScopeRecord {
+        int stats; // index into GLGpuProfiler::scopes, or -1 if the pool ran out of queries
+        int beginQuery;
+        int endQuery;
+    };
+
+    struct GLGpuProfilerFrame {
+        GLuint queries[MAX_GPU_QUERIES];
+        int queryCount; // non-zero while the frame's results are pending
+        // The query issued last. End queries are allocated with their begin query but issued when the
+        // scope closes, so this is usually not the last one allocated.
+        int lastQuery;
+        vector<GLGpuScopeRecord> scopes;
+        bool traced;    // the frame falls in the trace's frame range
+    };
+
+    struct GLGpuProfiler {
+        GLGpuProfilerFrame frames[GPU_PROFILER_FRAMES];
+        int frame;
+        vector<int> stack;            // open scopes of the current frame, as indices into its records
+        vector<GLTimingStats> scopes; // one per scope name and depth, in first-use order
+        int droppedFrames;            // frames still pending when their pool came round again
+        GLint64 clockOffset;          // GL_TIMESTAMP minus the CPU profiler clock, in nanoseconds
+        vector<ProfileEvent> traceEvents;
+    };
+
+    // CPU profiler clock: nanoseconds since startup
+    const chrono::steady_clock::time_point gProfileEpoch = chrono::steady_clock::now();
+
+    inline int64_t UProfileNow() {
+        return chrono::duration_cast<chrono::nanoseconds>(chrono::steady_clock::now() - gProfileEpoch).count();
+    }
+
+#if U_PROFILE
+    const uint32_t PROFILE_RING_CAPACITY = 1 << 18;
+
+    // Zones recorded by one thread. Only the owning thread writes; it publishes each event by storing
+    // count with release ordering, so the exporter reads every event below count without a lock. A full
+    // ring drops new events rather than overwriting ones the exporter may be reading.
+    struct ProfileRing {
+        vector<ProfileEvent> events;
+        atomic<uint32_t> count;
+        atomic<uint32_t> dropped;
+        int threadIndex;
+    };
+
+    // Rings are only registered under the mutex, once per thread, and live until exit
+    mutex gProfileRingsMutex;
+    vector<unique_ptr<ProfileRing>> gProfileRings;
+    thread_local ProfileRing* tProfileRing = nullptr;
+    atomic<bool> gProfileRecording(false);
+
+    // Function to return the calling thread's ring, registering one on the thread's first call. The
+    // main thread registers first, so it is always thread 0 in the trace.
+    ProfileRing& UProfileThreadRing() {
+        if (!tProfileRing) {
+            lock_guard<mutex> lock(gProfileRingsMutex);
+            unique_ptr<ProfileRing> ring(new ProfileRing());
+            ring->events.resize(PROFILE_RING_CAPACITY);
+            ring->count = 0;
+            ring->dropped = 0;
+            ring->threadIndex = static_cast<int>(gProfileRings.size());
+            tProfileRing = ring.get();
+            gProfileRings.push_back(move(ring));
+        }
+        return *tProfileRing;
+    }
+
+    // Function to append a zone to the calling thread's ring
+    void UProfileRecord(const char* name, int64_t start, int64_t end) {
+        ProfileRing& ring = UProfileThreadRing();
+        uint32_t count = ring.count.load(memory_order_relaxed);
+        if (count >= PROFILE_RING_CAPACITY) {
+            ring.dropped.fetch_add(1, memory_order_relaxed);
+            return;
+        }
+        ProfileEvent& event = ring.events[count];
+        event.name = name;
+        event.start = start;
+        event.end = end;
+        ring.count.store(count + 1, memory_order_release);
+    }
+
+    // Times the enclosing scope while a trace is being recorded
+    struct ProfileZone {
+        const char* name;
+        int64_t start;
+
+        explicit ProfileZone(const char* zoneName)
+            : name(gProfileRecording.load(memory_order_relaxed) ? zoneName : nullptr), start(name ? UProfileNow() : 0) {}
+        ~ProfileZone() {
+            if (name)
+                UProfileRecord(name, start, UProfileNow());
+        }
+    };
+#endif
+
+    // Camera state at one point of a benchmark path; recorded sessions use the same format
+    struct CameraKey {
+        float time; // seconds from the start of the path
+        glm::vec3 position;
+        float yaw;
+        float pitch;
+        float zoom;
+        bool perspective;
+    };
+
+    // Benchmark frames excluded from the statistics while shaders, caches and drivers warm up
+    const int BENCHMARK_WARMUP_FRAMES = 10;
+    // A frame counts as a stutter when it takes more than this many times the median frame
+    const float BENCHMARK_STUTTER_FACTOR = 2.0f;
+
+    // Clustered lighting: the view frustum is split into CLUSTER_X by CLUSTER_Y tiles and CLUSTER_Z
+    // exponential depth slices. Every cluster holds its light count followed by up to
+    // CLUSTER_STRIDE - 1 light indices, which bounds what a fragment loops over however many lights
+    // the scene has.
+    const int CLUSTER_X = 16;
+    const int CLUSTER_Y = 9;
+    const int CLUSTER_Z = 24;
+    const int CLUSTER_COUNT = CLUSTER_X * CLUSTER_Y * CLUSTER_Z;
+    const int CLUSTER_STRIDE = 64;
+    const GLuint LIGHT_BINDING = 2;   // storage buffer bindings, clear of the occlusion cull pass's 0 and 1
+    const GLuint CLUSTER_BINDING = 3;
+    const float NEAR_PLANE = 0.1f;
+    const float FAR_PLANE = 100.0f;
+
+    // Light assignment state: the lights streamed in every frame, the cluster lists the compute pass
+    // writes, and its program
+    struct GLClusterGrid {
+        GLuint program;
+        GLint inverseProjectionLoc;
+        GLint lightCountLoc;
+        GLuint clusterBuffer;
+        GLStreamBuffer lightStream;
+    };
+
+    // Occlusion culling state: the Hi-Z pyramid of last frame's depth and the programs that build and test it
+    struct GLOcclusionCuller {
+        GLuint hiZTexture;
+        int width;
+        int height;
+        int levels;
+        GLuint copyProgram;
+        GLuint downsampleProgram;
+        GLuint cullProgram;
+        GLint viewProjectionLoc;
+        GLint commandCountLoc;
+        GLStreamBuffer boundsStream;
+        bool hiZValid;
+        glm::mat4 previousViewProjection;
+        vector<int> proxies; // objects drawn as bounding boxes this frame (query mode)
+    };
+
+    // Draw counters for the current frame, used to compare the submission paths
+    struct GLFrameStats {
+        int drawCalls;
+        int objects;
+        int stateChanges;
+        int triangles;
     };
 
-    GLFWwindow* gWindow = nullptr;
+    // Uniform buffer binding point shared by every program that declares the FrameData block
+    const GLuint FRAME_DATA_BINDING = 0;
+
+    // Sort key fields: GL names are folded to 10 bits, which only affects how well draws group, never
+    // correctness, since submission compares the real names before skipping a bind
+    const uint64_t SORT_STATE_MASK = 0x3FF;
+    const uint64_t SORT_DEPTH_MAX = 0xFFFFFF;
+
+    // Texture unit the Hi-Z pyramid and scene depth are bound to, clear of the material textures
+    const GLuint HIZ_TEXTURE_UNIT = 1;
+
+    // Vertex layout the generators emit: position (3 floats) followed by color (4 floats). Meshes are
+    // converted to the pool's vertex format when they are uploaded.
+    const GLuint FLOATS_PER_VERTEX = 7;
+
+    // Vertex formats of the geometry pool. Float vertices hold position (3 floats), color (4 floats),
+    // texture coordinate (2 floats) and normal (3 floats). The compact formats hold the position as four
+    // 16-bit values relative to the mesh bounds (normalized shorts or half floats), color as normalized
+    // bytes, the texture coordinate as half floats and the normal octahedrally encoded in two
+    // normalized shorts: 20 bytes instead of 48.
+    enum VertexFormat { VERTEX_FLOAT, VERTEX_SNORM16, VERTEX_HALF };
+    const char* const VERTEX_FORMAT_NAMES[] = { "float", "snorm16", "half" };
+    const GLsizei VERTEX_FORMAT_STRIDES[] = { 48, 20, 20 };
+
+    // The normal attribute sits past the instance attributes
+    const GLuint NORMAL_LOCATION = 8;
+
+    // Post-transform cache size the mesh optimizer targets and measures against. Tipsify's orders hold
+    // up on real caches of other sizes, so this only needs to be in the right range.
+    const int VERTEX_CACHE_SIZE = 16;
+
+    // Faces meeting at a vertex share its normal only if they are within 60 degrees of the first face
+    // there; sharper corners get a vertex per side so hard edges stay hard
+    const float CREASE_ANGLE_COS = 0.5f;
+
+    // Attribute locations 3-6 hold the instance model matrix columns, 7 holds the instance tint
+    const GLuint INSTANCE_MODEL_LOCATION = 3;
+    const GLuint INSTANCE_TINT_LOCATION = 7;
+
+    GLFWwindow* gWindow = nullptr; // stays null in headless mode
+    bool gHeadless = false;
+    unsigned gMaxFrames = 0;       // stop after this many frames; 0 runs until the window closes
+    vector<CameraKey> gCameraPath; // benchmark path replacing live input, if not empty
+    float gBenchmarkTimestep = 1.0f / 60.0f;
+    string gBenchmarkOutput = "benchmark.json";
+    vector<float> gBenchmarkFrameTimes;
+    ofstream gCameraRecording; // open while a live session is being recorded
+#if U_HEADLESS_EGL
+    EGLDisplay gEglDisplay = EGL_NO_DISPLAY;
+    EGLContext gEglContext = EGL_NO_CONTEXT;
+    EGLSurface gEglSurface = EGL_NO_SURFACE;
+#endif
     GLMesh gCubeMesh;
     GLMesh gCylinderMesh;
-    GLuint gProgramId;
+    // Shader variants indexed by feature mask, each submitted to the shader compiler the first time it is asked for
+    struct ShaderVariants {
+        GLProgram programs[SHADER_VARIANT_COUNT];
+        bool submitted[SHADER_VARIANT_COUNT];
+        string vertexFormatDefines;
+    };
+    ShaderVariants gShaderVariants;
+    GLStreamBuffer gFrameDataStream;
+    GLGeometryPool gGeometryPool;
+    bool gOptimizeMeshes = true;
+    vector<GLfloat> gOptimizeVertices;
+    vector<GLuint> gOptimizeIndices;
+    vector<GLfloat> gCreaseVertices;
+    vector<GLuint> gCreaseIndices;
+    VertexFormat gVertexFormat = VERTEX_SNORM16;
+    vector<unsigned char> gEncodedVertices;
+
+    // Meshlet splitting scratch: per source vertex, the meshlet that last used it and its index there
+    vector<int> gMeshletOwner;
+    vector<int> gMeshletLocalIndex;
+    vector<GLuint> gMeshletVertices; // source vertex of each meshlet vertex, meshlets back to back
+    vector<GLushort> gMeshletIndices; // meshlet-local indices, meshlets back to back
+    vector<unsigned char> gMeshletVertexData;
+
+    // Segments of the generated sphere; above 255 its full-detail level needs more than 16-bit indices
+    int gSphereSegments = 32;
+
+    // Sine and cosine are reduced around the nearest multiple of pi/2, which is split into three parts
+    // short enough that multiplying them by the quadrant is exact; the minimax polynomials cover
+    // [-pi/4, pi/4]
+    constexpr float SINCOS_TWO_OVER_PI = 0.636619772f;
+    constexpr float SINCOS_PI_OVER_2_A = 1.5703125f;
+    constexpr float SINCOS_PI_OVER_2_B = 4.837512969970703125e-4f;
+    constexpr float SINCOS_PI_OVER_2_C = 7.54978995489188216e-8f;
+    constexpr float SINCOS_SIN_0 = -1.6666654611e-1f;
+    constexpr float SINCOS_SIN_1 = 8.3321608736e-3f;
+    constexpr float SINCOS_SIN_2 = -1.9515295891e-4f;
+    constexpr float SINCOS_COS_0 = 4.166664568298827e-2f;
+    constexpr float SINCOS_COS_1 = -1.388731625493765e-3f;
+    constexpr float SINCOS_COS_2 = 2.443315711809948e-5f;
+
+    // Generated rows are handed to the worker pool in tasks of about this many vertices
+    const int GEOMETRY_TASK_VERTICES = 16384;
+
+    // Function to evaluate a sine, or a cosine as the sine a quarter turn on, at compile time with the
+    // same reduction and polynomials as USinCos
+    constexpr float UConstexprSinCos(float angle, bool cosine) {
+        float scaled = angle * SINCOS_TWO_OVER_PI;
+        int quadrant = static_cast<int>(scaled >= 0.0f ? scaled + 0.5f : scaled - 0.5f);
+        float q = static_cast<float>(quadrant);
+        float r = angle - q * SINCOS_PI_OVER_2_A;
+        r = r - q * SINCOS_PI_OVER_2_B;
+        r = r - q * SINCOS_PI_OVER_2_C;
+        float r2 = r * r;
+
+        float s = SINCOS_SIN_2 * r2 + SINCOS_SIN_1;
+        s = s * r2 + SINCOS_SIN_0;
+        s = (r * r2) * s + r;
+        float c = SINCOS_COS_2 * r2 + SINCOS_COS_1;
+        c = c * r2 + SINCOS_COS_0;
+        c = (r2 * r2) * c + (1.0f - 0.5f * r2);
+
+        if (cosine)
+            quadrant += 1;
+        float value = (quadrant & 1) ? c : s;
+        return (quadrant & 2) ? -value : value;
+    }
+
+    // Fixed-resolution primitives are computed by the compiler into read-only tables, in the layout the
+    // generators emit, and handed to UCreateMesh straight from the binary. Their dimensions are those of
+    // the scene's sphere and broth box cap.
+    constexpr float SPHERE_TABLE_RADIUS = 0.5f;
+    constexpr float CYLINDER_TABLE_RADIUS = 0.2f;
+    constexpr float CYLINDER_TABLE_HEIGHT = 0.7f;
+
+    template <int Segments>
+    constexpr array<GLfloat, (Segments + 1) * (Segments + 1) * FLOATS_PER_VERTEX> UMakeSphereVertices() {
+        array<GLfloat, (Segments + 1) * (Segments + 1) * FLOATS_PER_VERTEX> vertices{};
+        for (int i = 0; i <= Segments; ++i) {
+            float phi = static_cast<float>(i) / static_cast<float>(Segments) * static_cast<float>(M_PI);
+            float ringRadius = SPHERE_TABLE_RADIUS * UConstexprSinCos(phi, false);
+            float height = SPHERE_TABLE_RADIUS * UConstexprSinCos(phi, true);
+            for (int j = 0; j <= Segments; ++j) {
+                float theta = static_cast<float>(j) / static_cast<float>(Segments) * static_cast<float>(2.0 * M_PI);
+                int vertex = (i * (Segments + 1) + j) * FLOATS_PER_VERTEX;
+                vertices[vertex] = ringRadius * UConstexprSinCos(theta, true);
+                vertices[vertex + 1] = height;
+                vertices[vertex + 2] = ringRadius * UConstexprSinCos(theta, false);
+
+                // Orange color (r, g, b, a)
+                vertices[vertex + 3] = 1.0f;
+                vertices[vertex + 4] = 0.5f;
+                vertices[vertex + 5] = 0.0f;
+                vertices[vertex + 6] = 1.0f;
+            }
+        }
+        return vertices;
+    }
+
+    template <int Segments>
+    constexpr array<GLuint, Segments * Segments * 6> UMakeSphereIndices() {
+        array<GLuint, Segments * Segments * 6> indices{};
+        int index = 0;
+        for (int i = 0; i < Segments; ++i) {
+            for (int j = 0; j < Segments; ++j) {
+                GLuint vertexIndex = static_cast<GLuint>(i * (Segments + 1) + j);
+                indices[index++] = vertexIndex;
+                indices[index++] = vertexIndex + 1;
+                indices[index++] = vertexIndex + Segments + 1;
+                indices[index++] = vertexIndex + 1;
+                indices[index++] = vertexIndex + Segments + 2;
+                indices[index++] = vertexIndex + Segments + 1;
+            }
+        }
+        return indices;
+    }
+
+    template <int Segments>
+    constexpr array<GLfloat, (Segments + 1) * FLOATS_PER_VERTEX> UMakeCylinderVertices() {
+        array<GLfloat, (Segments + 1) * FLOATS_PER_VERTEX> vertices{};
+        for (int i = 0; i <= Segments; ++i) {
+            // Vertex 0 is the center, the rest lie on the rim
+            float angle = (i - 1) * (2.0f * static_cast<float>(M_PI) / Segments);
+            int vertex = i * FLOATS_PER_VERTEX;
+            vertices[vertex] = i == 0 ? 0.0f : CYLINDER_TABLE_RADIUS * UConstexprSinCos(angle, true);
+            vertices[vertex + 1] = i == 0 ? 0.0f : CYLINDER_TABLE_RADIUS * UConstexprSinCos(angle, false);
+            vertices[vertex + 2] = CYLINDER_TABLE_HEIGHT;
+
+            // White cap color (r, g, b, a)
+            vertices[vertex + 3] = 1.0f;
+            vertices[vertex + 4] = 1.0f;
+            vertices[vertex + 5] = 1.0f;
+            vertices[vertex + 6] = 1.0f;
+        }
+        return vertices;
+    }
+
+    template <int Segments>
+    constexpr array<GLuint, Segments * 3> UMakeCylinderIndices() {
+        array<GLuint, Segments * 3> indices{};
+        for (int i = 0; i < Segments; ++i) {
+            indices[3 * i] = 0;
+            indices[3 * i + 1] = static_cast<GLuint>(i + 1);
+            indices[3 * i + 2] = static_cast<GLuint>((i + 1) % Segments + 1);
+        }
+        return indices;
+    }
+
+    // A UV sphere of SPHERE_TABLE_RADIUS; a longitude step of 2*pi/Segments leaves the middle of each
+    // facet LOD_ERROR inside the true sphere
+    template <int Segments>
+    struct Sphere {
+        static constexpr int VERTEX_COUNT = (Segments + 1) * (Segments + 1);
+        static constexpr int INDEX_COUNT = Segments * Segments * 6;
+        static constexpr float LOD_ERROR = SPHERE_TABLE_RADIUS * (1.0f - UConstexprSinCos(static_cast<float>(M_PI) / Segments, true));
+        static constexpr array<GLfloat, VERTEX_COUNT * FLOATS_PER_VERTEX> vertices = UMakeSphereVertices<Segments>();
+        static constexpr array<GLuint, INDEX_COUNT> indices = UMakeSphereIndices<Segments>();
+    };
+
+    // A cylinder cap of CYLINDER_TABLE_RADIUS at CYLINDER_TABLE_HEIGHT, as a fan of Segments triangles;
+    // each rim chord cuts LOD_ERROR inside the true circle at its midpoint
+    template <int Segments>
+    struct Cylinder {
+        static constexpr int VERTEX_COUNT = Segments + 1;
+        static constexpr int INDEX_COUNT = Segments * 3;
+        static constexpr float LOD_ERROR = CYLINDER_TABLE_RADIUS * (1.0f - UConstexprSinCos(static_cast<float>(M_PI) / Segments, true));
+        static constexpr array<GLfloat, VERTEX_COUNT * FLOATS_PER_VERTEX> vertices = UMakeCylinderVertices<Segments>();
+        static constexpr array<GLuint, INDEX_COUNT> indices = UMakeCylinderIndices<Segments>();
+    };
+
+    ProceduralGeometry gProceduralGeometry;
+    vector<GLfloat> gProceduralVertices;
+    bool gBenchGeometry = false;
+
+    // Program binary cache: one file per linked program, named by the program's key, holding this
+    // header followed by the driver's binary
+    const uint32_t PROGRAM_CACHE_MAGIC = 0x42504355; // "UCPB"
+    const uint32_t PROGRAM_CACHE_VERSION = 1;
+    const uint64_t FNV_OFFSET_BASIS = 14695981039346656037ULL;
+    const uint64_t FNV_PRIME = 1099511628211ULL;
+
+    struct ProgramCacheHeader {
+        uint32_t magic;
+        uint32_t version;
+        uint64_t key;
+        uint32_t binaryFormat;
+        uint32_t binarySize;
+        int64_t compileNs; // what building the program from source took when the entry was written
+    };
+
+    // Programs are keyed by an FNV-1a hash of their stage sources, defines included, on top of a hash
+    // of the driver's vendor, renderer and version strings, so a driver update misses instead of
+    // loading a stale binary
+    struct ProgramCache {
+        string directory; // empty when caching is off
+        uint64_t driverHash;
+        int hits;
+        int misses;
+        int rejected; // binaries the driver refused; their entries are rebuilt
+        int64_t nsSaved;
+    };
+
+    enum ProgramBuildStatus { PROGRAM_BUILD_PENDING, PROGRAM_BUILD_READY, PROGRAM_BUILD_FAILED };
+
+    // A program on its way through the shader compiler: its shaders compile until linking is set, then
+    // the program links. ready is called with the linked program, on the GL thread.
+    struct ProgramBuild {
+        GLuint programId;
+        GLenum stages[4];
+        GLuint shaderIds[4];
+        int stageCount;
+        uint64_t key;      // program cache key, when caching
+        int64_t submitted; // UProfileNow() at submission
+        bool linking;
+        function<void(GLuint)> ready;
+    };
+
+    // Programs are all submitted up front and advanced by polling once per frame, so with
+    // KHR_parallel_shader_compile the driver compiles them on its own threads while the first frames
+    // render with whatever is ready. Without the extension polling finishes each build in turn.
+    struct ShaderCompiler {
+        vector<ProgramBuild> pending;
+        bool parallel; // completion can be polled without blocking
+        int submitted;
+        int finished;
+        int failed;
+        int64_t start;
+    };
+
+    ProgramCache gProgramCache;
+    string gProgramCachePath = "shader_cache";
+    ShaderCompiler gShaderCompiler;
+    int gShaderCompilerThreads = -1; // driver compile threads; -1 lets the driver choose
+    GLStreamBuffer gInstanceStream;
+    GLStreamBuffer gIndirectStream;
+    GLStreamFences gStreamFences;
+    int gFramesInFlight = 3;
+    GLGpuProfiler gGpuProfiler;
+    GLTimingStats gCpuFrameTiming = { "frame", 0, vector<float>(), 0 };
+    GLTimingStats gCpuRenderTiming = { "render", 1, vector<float>(), 0 };
+    string gProfilePath; // where to export the timings on exit, if set
+    string gTracePath;   // where to write the Chrome trace on exit, if set
+    unsigned gTraceFirstFrame = 0; // frame 0 is startup
+    unsigned gTraceLastFrame = 120;
+    GLint gUniformBufferAlignment = 256;
+    GLint gStorageBufferAlignment = 256;
+    GLDrawList gDrawList;
+    GLRenderQueue gRenderQueue;
+    vector<SceneObject> gSceneObjects;
+    SceneBvh gSceneBvh;
+    vector<int> gCullStack;
+    vector<int> gCullFrontier;
+    vector<CullTask> gCullTasks;
+    GLCullStats gCullStats;
+    WorkerPool gWorkerPool;
+    int gWorkerThreads = -1; // -1 picks one fewer than the hardware threads
+    TextureLoader gTextureLoader;
+    string gBakeInput;  // source image of --bake, if set
+    string gBakeOutput;
+    string gBakeFormat; // empty picks BC1 for opaque sources and BC3 for sources with alpha
+    AssetPack gAssetPack;
+    AssetPackWriter gPackWriter;
+    string gPackPath;      // asset pack to load meshes and textures from, if set
+    string gPackWritePath; // where to write the generated assets as a pack, if set
+    const int TEXTURE_DECODE_THREADS = 2;
+    GLsizeiptr gTextureUploadBudget = 4 * 1024 * 1024; // bytes of texture rows uploaded per frame
+    GLFramebuffer gSceneFramebuffer;
+    GLOcclusionCuller gOcclusion;
+    GLClusterGrid gClusterGrid;
+    vector<GLLight> gLights; // lights at their starting positions; they orbit the scene's vertical axis
+    OcclusionMode gOcclusionMode = OCCLUSION_HIZ;
+    GLMesh gBoundsProxyMesh;
+    unsigned gFrameIndex = 0;
+    int gWindowFramebufferWidth = WINDOW_WIDTH;
+    int gWindowFramebufferHeight = WINDOW_HEIGHT;
+    GLFrameStats gFrameStats;
+
+    // Stress scene: a grid of spheres and pyramids, drawn per object, instanced or through the
+    // multi-draw list (cycle with I)
+    enum StressMode { STRESS_PER_OBJECT, STRESS_INSTANCED, STRESS_MULTI_DRAW };
+    const char* const STRESS_MODE_NAMES[] = { "per-object", "instanced", "render queue" };
+    bool gStressScene = false;
+    StressMode gStressMode = STRESS_MULTI_DRAW;
+    vector<glm::mat4> gStressSphereTransforms;
+    vector<glm::mat4> gStressPyramidTransforms;
+    vector<glm::vec4> gStressTints;
     GLuint gTextureId;
     GLMesh gPlaneMesh;
     GLMesh gSphereMesh;
     GLMesh gPyramidMesh;
 
+    // The vertex shader reads the normal as NORMAL_TYPE and decodes it with DECODE_NORMAL, both defined
+    // by UVertexFormatDefines for the pool's vertex format. The position is read as a vec4 so every format
+    // can supply it; only xyz is used. LIGHTING, TEXTURE, VERTEX_COLOR and INSTANCING are 0 or 1, from
+    // UShaderFeatureDefines.
     const GLchar* vertexShaderSource = GLSL(440,
-        layout(location = 0) in vec3 position;
+        layout(location = 0) in vec4 position;
+    layout(location = 1) in vec4 color;
     layout(location = 2) in vec2 textureCoordinate;
+    layout(location = 3) in mat4 instanceModel; // occupies locations 3-6
+    layout(location = 7) in vec4 instanceTint;
+    layout(location = 8) in NORMAL_TYPE normal;
 
     out vec2 vertexTextureCoordinate;
+    out vec4 vertexTint;
+    out vec3 vertexNormal;
+    out vec3 vertexWorldPosition;
 
 
-    //Global variables for the transform matrices
+    // Per-object model matrix and tint, when not instancing
     uniform mat4 model;
-    uniform mat4 view;
-    uniform mat4 projection;
+    uniform vec4 tint;
+
+    // Camera and light data, written once per frame
+    layout(std140) uniform FrameData {
+        mat4 view;
+        mat4 projection;
+        vec4 lightDirection;
+        vec4 lightColor;
+        vec4 clusterDepth;
+    };
+
+    // Octahedral normal: the unit octahedron's upper half maps to the inner diamond of the square and
+    // the lower half is folded out over the corners
+    vec3 octahedralDecode(vec2 encoded)
+    {
+        vec3 n = vec3(encoded, 1.0 - abs(encoded.x) - abs(encoded.y));
+        float fold = max(-n.z, 0.0);
+        n.x += n.x >= 0.0 ? -fold : fold;
+        n.y += n.y >= 0.0 ? -fold : fold;
+        return n;
+    }
 
     void main()
     {
-        gl_Position = projection * view * model * vec4(position, 1.0f); // transforms vertices to clip coordinates
+        mat4 objectModel = INSTANCING == 1 ? instanceModel : model;
+        vec4 worldPosition = objectModel * vec4(position.xyz, 1.0f);
+        gl_Position = projection * view * worldPosition; // transforms vertices to clip coordinates
+        vertexWorldPosition = worldPosition.xyz;
         vertexTextureCoordinate = textureCoordinate;
+        vertexTint = INSTANCING == 1 ? instanceTint : tint;
+        if (VERTEX_COLOR == 1)
+            vertexTint *= color;
+        vertexNormal = LIGHTING == 1 ? mat3(objectModel) * DECODE_NORMAL(normal) : vec3(0.0);
     }
     );
 
 
-    /* Fragment Shader Source Code*/
+    /* Fragment Shader Source Code: lighting and texturing are compiled in or out with the variant's
+       features. Lit variants add the point and spot lights of the fragment's cluster; CLUSTER_* come
+       from UClusterDefines. */
     const GLchar* fragmentShaderSource = GLSL(440,
         in vec2 vertexTextureCoordinate;
+    in vec4 vertexTint;
+    in vec3 vertexNormal;
+    in vec3 vertexWorldPosition;
     out vec4 fragmentColor;
 
     uniform sampler2D uTexture;
-    uniform vec3 lightDirection; // Directional light direction
-    uniform vec3 lightColor;     // Directional light color
-    uniform float ambientStrength = 0.3; // Ambient light strength
+
+    // Camera and light data, written once per frame
+    layout(std140) uniform FrameData {
+        mat4 view;
+        mat4 projection;
+        vec4 lightDirection; // Directional light direction
+        vec4 lightColor;     // Directional light color, ambient strength in w
+        vec4 clusterDepth;   // near plane, slices per log depth, framebuffer size
+    };
+
+    struct Light {
+        vec4 positionRadius;
+        vec4 color;     // w = cosine of the inner cone angle
+        vec4 direction; // w = cosine of the outer cone angle
+    };
+
+    layout(std430, binding = 2) readonly buffer Lights {
+        Light lights[];
+    };
+
+    layout(std430, binding = 3) readonly buffer Clusters {
+        uint clusterData[]; // per cluster: light count, then light indices
+    };
+
+    void main()
+    {
+        vec3 result = vec3(1.0);
+        if (TEXTURE == 1)
+            result = texture(uTexture, vertexTextureCoordinate).rgb;
+
+        if (LIGHTING == 1) {
+            vec3 norm = normalize(vertexNormal);
+            vec3 lightDir = normalize(-lightDirection.xyz);
+
+            // Calculate the diffuse lighting intensity
+            float diff = max(dot(norm, lightDir), 0.0);
+            vec3 diffuse = diff * lightColor.rgb;
+
+            // Calculate the ambient lighting intensity
+            vec3 ambient = lightColor.a * lightColor.rgb;
+
+            // Point and spot lights: only those assigned to this fragment's cluster are visited
+            float viewDepth = -(view * vec4(vertexWorldPosition, 1.0)).z;
+            uvec2 tile = uvec2(clamp(gl_FragCoord.xy / clusterDepth.zw, 0.0, 0.999) * vec2(CLUSTER_X, CLUSTER_Y));
+            uint slice = uint(clamp(log(max(viewDepth, clusterDepth.x) / clusterDepth.x) * clusterDepth.y, 0.0, float(CLUSTER_Z - 1)));
+            uint base = ((slice * CLUSTER_Y + tile.y) * CLUSTER_X + tile.x) * CLUSTER_STRIDE;
+            uint count = clusterData[base];
+            for (uint i = 0u; i < count; ++i) {
+                Light light = lights[clusterData[base + 1u + i]];
+                vec3 toLight = light.positionRadius.xyz - vertexWorldPosition;
+                float distance = length(toLight);
+                vec3 direction = toLight / max(distance, 1e-4);
+                float falloff = clamp(1.0 - distance * distance / (light.positionRadius.w * light.positionRadius.w), 0.0, 1.0);
+                float cone = smoothstep(light.direction.w, light.color.w, dot(-direction, light.direction.xyz));
+                diffuse += light.color.rgb * max(dot(norm, direction), 0.0) * falloff * falloff * cone;
+            }
+
+            // Final color with lighting
+            result *= ambient + diffuse;
+        }
+
+        fragmentColor = vec4(result, 1.0) * vertexTint;
+    }
+    );
+
+    /* Light Cluster Compute Shader: one invocation per cluster finds the lights whose sphere of influence
+       reaches the cluster's view-space box. Lights are read in batches of 64 into shared memory, each
+       transformed to view space once per work group. */
+    const GLchar* clusterLightShaderSource = GLSL(440,
+        layout(local_size_x = 64) in;
+
+    struct Light {
+        vec4 positionRadius;
+        vec4 color;
+        vec4 direction;
+    };
+
+    layout(std430, binding = 2) readonly buffer Lights {
+        Light lights[];
+    };
+
+    layout(std430, binding = 3) writeonly buffer Clusters {
+        uint clusterData[];
+    };
+
+    layout(std140) uniform FrameData {
+        mat4 view;
+        mat4 projection;
+        vec4 lightDirection;
+        vec4 lightColor;
+        vec4 clusterDepth;
+    };
+
+    uniform mat4 inverseProjection;
+    uniform uint lightCount;
+
+    shared vec4 batchLights[64]; // view-space position and radius
+
+    // Point at view depth z on the line through a screen position, which works for perspective and
+    // orthographic projections alike
+    vec3 viewPoint(vec2 ndc, float z)
+    {
+        vec4 nearPoint = inverseProjection * vec4(ndc, -1.0, 1.0);
+        vec4 farPoint = inverseProjection * vec4(ndc, 1.0, 1.0);
+        vec3 a = nearPoint.xyz / nearPoint.w;
+        vec3 b = farPoint.xyz / farPoint.w;
+        return mix(a, b, (z - a.z) / (b.z - a.z));
+    }
+
+    void main()
+    {
+        uint index = gl_GlobalInvocationID.x;
+        bool active = index < uint(CLUSTER_COUNT);
+        uvec3 cluster = uvec3(index % CLUSTER_X, (index / CLUSTER_X) % CLUSTER_Y, index / (CLUSTER_X * CLUSTER_Y));
+
+        // Slice k starts at near * (far / near)^(k / CLUSTER_Z)
+        float zNear = -clusterDepth.x * exp(float(cluster.z) / clusterDepth.y);
+        float zFar = -clusterDepth.x * exp(float(cluster.z + 1u) / clusterDepth.y);
+        vec2 ndcMin = vec2(cluster.xy) / vec2(CLUSTER_X, CLUSTER_Y) * 2.0 - 1.0;
+        vec2 ndcMax = vec2(cluster.xy + 1u) / vec2(CLUSTER_X, CLUSTER_Y) * 2.0 - 1.0;
+        vec3 boundsMin = vec3(1e30);
+        vec3 boundsMax = vec3(-1e30);
+        for (int corner = 0; corner < 8; ++corner) {
+            vec2 ndc = mix(ndcMin, ndcMax, vec2(corner & 1, (corner >> 1) & 1));
+            vec3 point = viewPoint(ndc, (corner & 4) != 0 ? zFar : zNear);
+            boundsMin = min(boundsMin, point);
+            boundsMax = max(boundsMax, point);
+        }
+
+        uint base = index * uint(CLUSTER_STRIDE);
+        uint count = 0u;
+        for (uint first = 0u; first < lightCount; first += 64u) {
+            uint light = first + gl_LocalInvocationIndex;
+            if (light < lightCount) {
+                vec4 positionRadius = lights[light].positionRadius;
+                batchLights[gl_LocalInvocationIndex] = vec4((view * vec4(positionRadius.xyz, 1.0)).xyz, positionRadius.w);
+            }
+            barrier();
+
+            uint batchSize = min(lightCount - first, 64u);
+            for (uint i = 0u; active && i < batchSize && count < uint(CLUSTER_STRIDE - 1); ++i) {
+                vec4 sphere = batchLights[i];
+                vec3 offset = clamp(sphere.xyz, boundsMin, boundsMax) - sphere.xyz;
+                if (dot(offset, offset) <= sphere.w * sphere.w) {
+                    clusterData[base + 1u + count] = first + i;
+                    count++;
+                }
+            }
+            barrier();
+        }
+
+        if (active)
+            clusterData[base] = count;
+    }
+    );
+
+    /* Hi-Z Copy Compute Shader: level 0 of the pyramid is the scene depth */
+    const GLchar* hiZCopyShaderSource = GLSL(440,
+        layout(local_size_x = 8, local_size_y = 8) in;
+
+    uniform sampler2D depthTexture;
+    layout(r32f, binding = 0) uniform writeonly image2D hiZLevel;
+
+    void main()
+    {
+        ivec2 texel = ivec2(gl_GlobalInvocationID.xy);
+        ivec2 size = imageSize(hiZLevel);
+        if (texel.x >= size.x || texel.y >= size.y)
+            return;
+
+        imageStore(hiZLevel, texel, vec4(texelFetch(depthTexture, texel, 0).r));
+    }
+    );
+
+    /* Hi-Z Downsample Compute Shader: each texel keeps the farthest depth of the texels below it */
+    const GLchar* hiZDownsampleShaderSource = GLSL(440,
+        layout(local_size_x = 8, local_size_y = 8) in;
+
+    layout(r32f, binding = 0) uniform readonly image2D sourceLevel;
+    layout(r32f, binding = 1) uniform writeonly image2D targetLevel;
+
+    void main()
+    {
+        ivec2 texel = ivec2(gl_GlobalInvocationID.xy);
+        ivec2 size = imageSize(targetLevel);
+        if (texel.x >= size.x || texel.y >= size.y)
+            return;
+
+        // Odd-sized sources fold their last row and column into the last target texel so nothing is skipped
+        ivec2 sourceSize = imageSize(sourceLevel);
+        int lastX = ((sourceSize.x & 1) == 1 && texel.x == size.x - 1) ? 2 : 1;
+        int lastY = ((sourceSize.y & 1) == 1 && texel.y == size.y - 1) ? 2 : 1;
+
+        float farthest = 0.0;
+        for (int y = 0; y <= lastY; ++y) {
+            for (int x = 0; x <= lastX; ++x) {
+                ivec2 source = min(texel * 2 + ivec2(x, y), sourceSize - 1);
+                farthest = max(farthest, imageLoad(sourceLevel, source).r);
+            }
+        }
+        imageStore(targetLevel, texel, vec4(farthest));
+    }
+    );
+
+    /* Occlusion Cull Compute Shader: zeroes the instance count of commands hidden behind last frame's depth */
+    const GLchar* occlusionCullShaderSource = GLSL(440,
+        layout(local_size_x = 64) in;
+
+    struct DrawCommand {
+        uint count;
+        uint instanceCount;
+        uint firstIndex;
+        int baseVertex;
+        uint baseInstance;
+    };
+
+    layout(std430, binding = 0) buffer Commands {
+        DrawCommand commands[];
+    };
+
+    layout(std430, binding = 1) readonly buffer Bounds {
+        vec4 bounds[]; // world-space min and max per command
+    };
+
+    uniform mat4 previousViewProjection;
+    uniform uint commandCount;
+    uniform sampler2D hiZ;
 
     void main()
     {
-        vec3 norm = normalize(texture(uTexture, vertexTextureCoordinate).rgb * 2.0 - 1.0);
-        vec3 lightDir = normalize(-lightDirection);
+        uint index = gl_GlobalInvocationID.x;
+        if (index >= commandCount)
+            return;
+
+        vec3 boundsMin = bounds[index * 2u].xyz;
+        vec3 boundsMax = bounds[index * 2u + 1u].xyz;
+
+        // Project the box corners with last frame's camera, which is the camera the pyramid was built from
+        vec3 ndcMin = vec3(1.0);
+        vec3 ndcMax = vec3(-1.0);
+        for (int corner = 0; corner < 8; ++corner) {
+            vec3 position = mix(boundsMin, boundsMax, vec3(corner & 1, (corner >> 1) & 1, (corner >> 2) & 1));
+            vec4 clip = previousViewProjection * vec4(position, 1.0);
+            if (clip.w <= 0.0)
+                return; // the box reaches behind the camera, so keep it
+            vec3 ndc = clip.xyz / clip.w;
+            ndcMin = min(ndcMin, ndc);
+            ndcMax = max(ndcMax, ndc);
+        }
 
-        // Calculate the diffuse lighting intensity
-        float diff = max(dot(norm, lightDir), 0.0);
-        vec3 diffuse = diff * lightColor;
+        vec2 uvMin = clamp(ndcMin.xy * 0.5 + 0.5, 0.0, 1.0);
+        vec2 uvMax = clamp(ndcMax.xy * 0.5 + 0.5, 0.0, 1.0);
+        float nearestDepth = ndcMin.z * 0.5 + 0.5;
 
-        // Calculate the ambient lighting intensity
-        vec3 ambient = ambientStrength * lightColor;
+        // Pick the level where the rectangle spans at most two texels, then test its four corners
+        vec2 size = (uvMax - uvMin) * vec2(textureSize(hiZ, 0));
+        int level = clamp(int(ceil(log2(max(max(size.x, size.y), 1.0)))), 0, textureQueryLevels(hiZ) - 1);
+        ivec2 levelSize = textureSize(hiZ, level);
+        ivec2 texelMin = min(ivec2(uvMin * vec2(levelSize)), levelSize - 1);
+        ivec2 texelMax = min(ivec2(uvMax * vec2(levelSize)), levelSize - 1);
 
-        // Final color with lighting
-        vec3 result = (ambient + diffuse) * texture(uTexture, vertexTextureCoordinate).rgb;
+        float farthest = max(max(texelFetch(hiZ, texelMin, level).r, texelFetch(hiZ, ivec2(texelMax.x, texelMin.y), level).r),
+            max(texelFetch(hiZ, ivec2(texelMin.x, texelMax.y), level).r, texelFetch(hiZ, texelMax, level).r));
 
-        fragmentColor = vec4(result, 1.0);
+        if (nearestDepth > farthest)
+            commands[index].instanceCount = 0u;
     }
     );
+
+    // Level-of-detail selection: a level is used while its error projects to at most gLodErrorPixels on
+    // screen, and a coarser level only once its error is below LOD_HYSTERESIS times that, so objects
+    // sitting near a threshold do not flicker between levels
+    float gLodErrorPixels = 1.0f;
+    const float LOD_HYSTERESIS = 0.75f;
+    float gLodPixelScale = 1.0f;  // pixels per world unit, at unit distance for perspective projections
+    bool gLodPerspective = true;
 }
 
 // camera variables
@@ -121,22 +1426,120 @@ bool usePerspective = true;
 void UMousePositionCallback(GLFWwindow* window, double xpos, double ypos);
 void UMouseScrollCallback(GLFWwindow* window, double xoffset, double yoffset);
 bool UInitialize(int argc, char* argv[], GLFWwindow** window);
+bool UInitializeHeadless();
+void UDestroyHeadless();
 void UResizeWindow(GLFWwindow* window, int width, int height);
 void UProcessInput(GLFWwindow* window);
-void UCreateMesh(GLMesh& mesh, GLfloat* vertices, GLushort* indices, int vertexCount, int indexCount);
+void UUpdateCameraFront();
+bool ULoadCameraPath(const string& path, vector<CameraKey>& keys);
+void UOrbitCameraPath(vector<CameraKey>& keys);
+void UApplyCameraPath(const vector<CameraKey>& keys, float time);
+void URecordCameraKey(ofstream& file, float time);
+bool UWriteBenchmarkReport(const string& path, const vector<float>& frameTimes);
+void UCreateGeometryPool(GLGeometryPool& pool, GLsizei vertexCapacity, GLsizei indexCapacity);
+void UDestroyGeometryPool(GLGeometryPool& pool);
+void UCreateMesh(GLMesh& mesh, const GLfloat* vertices, const GLuint* indices, int vertexCount, int indexCount);
+void UAddMeshLod(GLMesh& mesh, const GLfloat* vertices, const GLuint* indices, int vertexCount, int indexCount, float error);
 void UDestroyMesh(GLMesh& mesh);
-bool UCreateShaderProgram(const char* vtxShaderSource, const char* fragShaderSource, GLuint& programId);
-void UDestroyShaderProgram(GLuint programId);
+void UDrawMesh(const GLMesh& mesh);
+void UCreateShaderProgram(const char* vtxShaderSource, const char* fragShaderSource, GLProgram& program);
+string UInjectDefines(const char* source, const string& defines);
+string UVertexFormatDefines(VertexFormat format);
+string UShaderFeatureDefines(unsigned features);
+const GLProgram& UShaderVariant(unsigned features);
+unsigned UMaterialFeatures(const Material& material, const GLMesh& mesh);
+void UDestroyShaderVariants(ShaderVariants& variants);
+void UDestroyShaderProgram(GLProgram& program);
+void UOpenProgramCache(ProgramCache& cache, const string& directory);
+void UCreateShaderCompiler(ShaderCompiler& compiler, int threads);
+void USubmitProgram(ShaderCompiler& compiler, ProgramCache& cache, const GLenum* stages, const char* const* sources, int stageCount, function<void(GLuint)> ready);
+bool UPollShaderCompiler(ShaderCompiler& compiler, ProgramCache& cache, bool wait);
+void UDestroyShaderCompiler(ShaderCompiler& compiler);
+void UReportProgramCache(const ProgramCache& cache);
+void UCreateStreamBuffer(GLStreamBuffer& stream, GLsizeiptr regionSize);
+void UDestroyStreamBuffer(GLStreamBuffer& stream);
+GLbyte* UStreamAllocate(GLStreamBuffer& stream, GLsizeiptr size, GLsizeiptr alignment, GLintptr& offset);
+void UBeginStreamFrame(GLStreamFences& fences);
+void UEndStreamFrame(GLStreamFences& fences);
+void UDestroyStreamFences(GLStreamFences& fences);
+void UCreateTextureLoader(TextureLoader& loader, int threadCount, GLsizeiptr uploadBudget);
+void UDestroyTextureLoader(TextureLoader& loader);
+GLuint URequestTexture(TextureLoader& loader, const char* filename);
+bool ULoadKtx2(const vector<unsigned char>& file, GLenum& internalFormat, int& width, int& height, vector<TextureLevel>& levels);
+bool UWriteKtx2(const string& path, BlockFormat format, int width, int height, const vector<vector<unsigned char> >& levels);
+bool UBakeTexture(const string& input, const string& output, const string& formatName);
+bool UOpenAssetPack(AssetPack& pack, const string& path);
+void UCloseAssetPack(AssetPack& pack);
+bool ULoadPackedMesh(const AssetPack& pack, const char* name, GLMesh& mesh);
+GLuint URequestPackedTexture(TextureLoader& loader, const AssetPack& pack, const char* name);
+void UBeginPackedMesh(AssetPackWriter& writer, const char* name);
+void UEndPackedMesh(AssetPackWriter& writer, const GLMesh& mesh);
+bool UPackTexture(AssetPackWriter& writer, const char* name, const string& filename);
+bool UWriteAssetPack(const AssetPackWriter& writer, const string& path);
+void UUpdateTextureLoader(TextureLoader& loader);
+void URecordTiming(GLTimingStats& timing, float milliseconds);
+void UCreateGpuProfiler(GLGpuProfiler& profiler);
+void UDestroyGpuProfiler(GLGpuProfiler& profiler);
+void UBeginGpuFrame(GLGpuProfiler& profiler);
+void UBeginGpuScope(GLGpuProfiler& profiler, const char* name);
+void UEndGpuScope(GLGpuProfiler& profiler);
+void UPrintProfile();
+void USetTraceFrame(unsigned frame);
+bool UExportTrace(const string& path);
+bool UExportProfile(const string& path);
+void UCreateFrameDataBuffer(GLStreamBuffer& stream);
+void UUpdateFrameDataBuffer(GLStreamBuffer& stream, const GLFrameData& frameData);
+void UDestroyFrameDataBuffer(GLStreamBuffer& stream);
+void UDrawMeshInstanced(const GLMesh& mesh, const glm::mat4* transforms, const glm::vec4* tints, int count);
+int UDrawListAdd(GLDrawList& list, const GLMesh& mesh, int lod, int meshlet, const glm::mat4* transforms, const glm::vec4* tints, int count, int object);
+void UClearDrawList(GLDrawList& list);
+void UUploadDrawList(GLDrawList& list);
+void UDrawListRange(const GLDrawList& list, int firstCommand, int commandCount, GLenum indexType);
+void UDrawListWithQueries(const GLDrawList& list, int firstCommand, int commandCount, GLenum indexType);
+void UBeginRenderQueue(GLRenderQueue& queue, const glm::mat4& view, float farPlane);
+void UMakeDrawPacket(const GLRenderQueue& queue, const GLMesh& mesh, int lod, const GLProgram& program, GLuint texture, const glm::mat4& model, const glm::vec4& tint, int object, GLDrawPacket& packet);
+void USortRenderQueue(GLRenderQueue& queue);
+void UFlushRenderQueue(GLRenderQueue& queue);
+int UBvhInsert(SceneBvh& bvh, int object, const glm::vec3& boundsMin, const glm::vec3& boundsMax);
+void UBvhRefit(SceneBvh& bvh, int leaf, const glm::vec3& boundsMin, const glm::vec3& boundsMax);
+int UAddSceneObject(const GLMesh& mesh, const Material& material, const glm::mat4& model, bool stressGrid);
+void USetSceneObjectTransform(int index, const glm::mat4& model);
+void UCreateScene();
+void UExtractFrustum(const glm::mat4& viewProjection, GLFrustum& frustum);
+CullResult UFrustumTestBounds(const GLFrustum& frustum, const glm::vec3& boundsMin, const glm::vec3& boundsMax);
+void UCullScene(const GLFrustum& frustum);
+void UCreateWorkerPool(WorkerPool& pool, int workerCount);
+void UDestroyWorkerPool(WorkerPool& pool);
+void URunParallel(WorkerPool& pool, int taskCount, const function<void(int, int)>& job);
+void UTransformBounds(const glm::mat4& model, const glm::vec3& localMin, const glm::vec3& localMax, glm::vec3& worldMin, glm::vec3& worldMax);
+void UBoundsProxyMesh(GLMesh& mesh);
+void UCreateFramebuffer(GLFramebuffer& framebuffer, int width, int height);
+void UDestroyFramebuffer(GLFramebuffer& framebuffer);
+void UCreateComputeProgram(const char* computeShaderSource, function<void(GLuint)> ready);
+void UCreateOcclusionCuller(GLOcclusionCuller& culler, const GLFramebuffer& framebuffer);
+void UDestroyOcclusionCuller(GLOcclusionCuller& culler);
+string UClusterDefines();
+void UCreateClusterGrid(GLClusterGrid& grid);
+void UDestroyClusterGrid(GLClusterGrid& grid);
+void UCreateLights(int count);
+void UAssignLights(GLClusterGrid& grid, const glm::mat4& projection, float time);
+void UBuildHiZ(GLOcclusionCuller& culler, const GLFramebuffer& framebuffer, const glm::mat4& viewProjection);
+void UOcclusionCullDrawList(GLOcclusionCuller& culler, const GLDrawList& list, int commandCount);
+void UResolveOcclusionQuery(SceneObject& object);
+void UCreateStressScene(int countPerMesh);
+void URenderStressScene();
 void URender();
 void UCubeMesh(GLMesh& mesh);
 void UCylinderMesh(GLMesh& mesh);
 void UPlaneMesh(GLMesh& mesh, float width, float length);
 void USphereMesh(GLMesh& mesh, float radius, int segments);
 void UPyramidMesh(GLMesh& mesh);
+void UBenchmarkGeometry();
 
 
 // Function to initialize the pyramid mesh - cheese piece
 void UPyramidMesh(GLMesh& mesh) {
+    U_PROFILE_FUNCTION();
     GLfloat pyramidVertices[] = {
         // Vertex Positions         // Colors (r, g, b, a)   // Position of vertice for visualization 
         0.0f,  0.5f,  0.0f,         1.0f, 1.0f, 0.0f, 1.0f,  // Top Vertex
@@ -156,24 +1559,205 @@ void UPyramidMesh(GLMesh& mesh) {
        -0.5f, -0.5f, -0.5f,         1.0f, 0.8f, 0.0f, 1.0f   // Bottom Left Back
     };
 
-    GLushort pyramidIndices[] = {
-        0,1,2,3,4,5,6,7,8,9,10,11
+    GLuint pyramidIndices[] = {
+        0,2,1,3,5,4,6,8,7,9,11,10
     };
 
     UCreateMesh(mesh, pyramidVertices, pyramidIndices, sizeof(pyramidVertices) / sizeof(pyramidVertices[0]) / 7, sizeof(pyramidIndices) / sizeof(pyramidIndices[0]));
 }
 
-// Function to initialize the sphere mesh - an orange
-void USphereMesh(GLMesh& mesh, float radius, int segments) {
-    // Calculate the number of vertices and indices required for the sphere
-    int numVertices = (segments + 1) * (segments + 1);
-    int numIndices = segments * segments * 6;
+// Function to evaluate sine and cosine of one angle with the same reduction and polynomials as the SIMD
+// paths of USinCos
+static void USinCosScalar(float angle, float& sine, float& cosine) {
+    int quadrant = static_cast<int>(nearbyint(angle * SINCOS_TWO_OVER_PI));
+    float q = static_cast<float>(quadrant);
+    float r = angle - q * SINCOS_PI_OVER_2_A;
+    r = r - q * SINCOS_PI_OVER_2_B;
+    r = r - q * SINCOS_PI_OVER_2_C;
+    float r2 = r * r;
+
+    float s = SINCOS_SIN_2 * r2 + SINCOS_SIN_1;
+    s = s * r2 + SINCOS_SIN_0;
+    s = (r * r2) * s + r;
+    float c = SINCOS_COS_2 * r2 + SINCOS_COS_1;
+    c = c * r2 + SINCOS_COS_0;
+    c = (r2 * r2) * c + (1.0f - 0.5f * r2);
+
+    if (quadrant & 1)
+        swap(s, c);
+    sine = (quadrant & 2) ? -s : s;
+    cosine = ((quadrant + 1) & 2) ? -c : c;
+}
+
+// Function to evaluate sine and cosine of count angles, a SIMD register at a time. Each angle is reduced
+// to [-pi/4, pi/4] around the nearest multiple of pi/2, subtracted in three parts so the reduction stays
+// exact; both minimax polynomials are evaluated and the quadrant picks which is the sine and its sign.
+// Accurate to a few ulp for angles up to a few thousand radians.
+static void USinCos(const float* angles, float* sines, float* cosines, int count) {
+    int i = 0;
+#if defined(U_SIMD_AVX2)
+    const __m256i one8 = _mm256_set1_epi32(1);
+    const __m256i two8 = _mm256_set1_epi32(2);
+    for (; i + 8 <= count; i += 8) {
+        __m256 angle = _mm256_loadu_ps(angles + i);
+        __m256i quadrant = _mm256_cvtps_epi32(_mm256_mul_ps(angle, _mm256_set1_ps(SINCOS_TWO_OVER_PI)));
+        __m256 q = _mm256_cvtepi32_ps(quadrant);
+        __m256 r = _mm256_sub_ps(angle, _mm256_mul_ps(q, _mm256_set1_ps(SINCOS_PI_OVER_2_A)));
+        r = _mm256_sub_ps(r, _mm256_mul_ps(q, _mm256_set1_ps(SINCOS_PI_OVER_2_B)));
+        r = _mm256_sub_ps(r, _mm256_mul_ps(q, _mm256_set1_ps(SINCOS_PI_OVER_2_C)));
+        __m256 r2 = _mm256_mul_ps(r, r);
+
+        __m256 s = _mm256_add_ps(_mm256_mul_ps(_mm256_set1_ps(SINCOS_SIN_2), r2), _mm256_set1_ps(SINCOS_SIN_1));
+        s = _mm256_add_ps(_mm256_mul_ps(s, r2), _mm256_set1_ps(SINCOS_SIN_0));
+        s = _mm256_add_ps(_mm256_mul_ps(_mm256_mul_ps(r, r2), s), r);
+        __m256 c = _mm256_add_ps(_mm256_mul_ps(_mm256_set1_ps(SINCOS_COS_2), r2), _mm256_set1_ps(SINCOS_COS_1));
+        c = _mm256_add_ps(_mm256_mul_ps(c, r2), _mm256_set1_ps(SINCOS_COS_0));
+        c = _mm256_add_ps(_mm256_mul_ps(_mm256_mul_ps(r2, r2), c), _mm256_sub_ps(_mm256_set1_ps(1.0f), _mm256_mul_ps(_mm256_set1_ps(0.5f), r2)));
+
+        __m256 swapped = _mm256_castsi256_ps(_mm256_cmpeq_epi32(_mm256_and_si256(quadrant, one8), one8));
+        __m256 sineSign = _mm256_castsi256_ps(_mm256_slli_epi32(_mm256_and_si256(quadrant, two8), 30));
+        __m256 cosineSign = _mm256_castsi256_ps(_mm256_slli_epi32(_mm256_and_si256(_mm256_add_epi32(quadrant, one8), two8), 30));
+        _mm256_storeu_ps(sines + i, _mm256_xor_ps(_mm256_blendv_ps(s, c, swapped), sineSign));
+        _mm256_storeu_ps(cosines + i, _mm256_xor_ps(_mm256_blendv_ps(c, s, swapped), cosineSign));
+    }
+#endif
+#if defined(U_SIMD_AVX2) || defined(U_SIMD_SSE2)
+    const __m128i one4 = _mm_set1_epi32(1);
+    const __m128i two4 = _mm_set1_epi32(2);
+    for (; i + 4 <= count; i += 4) {
+        __m128 angle = _mm_loadu_ps(angles + i);
+        __m128i quadrant = _mm_cvtps_epi32(_mm_mul_ps(angle, _mm_set1_ps(SINCOS_TWO_OVER_PI)));
+        __m128 q = _mm_cvtepi32_ps(quadrant);
+        __m128 r = _mm_sub_ps(angle, _mm_mul_ps(q, _mm_set1_ps(SINCOS_PI_OVER_2_A)));
+        r = _mm_sub_ps(r, _mm_mul_ps(q, _mm_set1_ps(SINCOS_PI_OVER_2_B)));
+        r = _mm_sub_ps(r, _mm_mul_ps(q, _mm_set1_ps(SINCOS_PI_OVER_2_C)));
+        __m128 r2 = _mm_mul_ps(r, r);
+
+        __m128 s = _mm_add_ps(_mm_mul_ps(_mm_set1_ps(SINCOS_SIN_2), r2), _mm_set1_ps(SINCOS_SIN_1));
+        s = _mm_add_ps(_mm_mul_ps(s, r2), _mm_set1_ps(SINCOS_SIN_0));
+        s = _mm_add_ps(_mm_mul_ps(_mm_mul_ps(r, r2), s), r);
+        __m128 c = _mm_add_ps(_mm_mul_ps(_mm_set1_ps(SINCOS_COS_2), r2), _mm_set1_ps(SINCOS_COS_1));
+        c = _mm_add_ps(_mm_mul_ps(c, r2), _mm_set1_ps(SINCOS_COS_0));
+        c = _mm_add_ps(_mm_mul_ps(_mm_mul_ps(r2, r2), c), _mm_sub_ps(_mm_set1_ps(1.0f), _mm_mul_ps(_mm_set1_ps(0.5f), r2)));
+
+        // SSE2 has no blend, so the swap selects through a mask
+        __m128 swapped = _mm_castsi128_ps(_mm_cmpeq_epi32(_mm_and_si128(quadrant, one4), one4));
+        __m128 sineSign = _mm_castsi128_ps(_mm_slli_epi32(_mm_and_si128(quadrant, two4), 30));
+        __m128 cosineSign = _mm_castsi128_ps(_mm_slli_epi32(_mm_and_si128(_mm_add_epi32(quadrant, one4), two4), 30));
+        _mm_storeu_ps(sines + i, _mm_xor_ps(_mm_or_ps(_mm_and_ps(swapped, c), _mm_andnot_ps(swapped, s)), sineSign));
+        _mm_storeu_ps(cosines + i, _mm_xor_ps(_mm_or_ps(_mm_and_ps(swapped, s), _mm_andnot_ps(swapped, c)), cosineSign));
+    }
+#endif
+    for (; i < count; ++i)
+        USinCosScalar(angles[i], sines[i], cosines[i]);
+}
+
+// Function to generate the positions and indices of a UV sphere with the given number of segments. The
+// sines and cosines of the row and column angles are computed once each, and the rows, which only
+// combine them, are filled in parallel on the worker pool.
+static void USphereGeometry(WorkerPool& pool, ProceduralGeometry& geometry, float radius, int segments) {
+    U_PROFILE_FUNCTION();
+    int columns = segments + 1;
+    vector<float> angles(columns), sinTheta(columns), cosTheta(columns), sinPhi(columns), cosPhi(columns);
+    for (int j = 0; j < columns; ++j)
+        angles[j] = static_cast<float>(j) / static_cast<float>(segments) * static_cast<float>(2.0 * M_PI);
+    USinCos(angles.data(), sinTheta.data(), cosTheta.data(), columns);
+    for (int i = 0; i < columns; ++i)
+        angles[i] = static_cast<float>(i) / static_cast<float>(segments) * static_cast<float>(M_PI);
+    USinCos(angles.data(), sinPhi.data(), cosPhi.data(), columns);
+
+    size_t vertexCount = static_cast<size_t>(columns) * columns;
+    geometry.x.resize(vertexCount);
+    geometry.y.resize(vertexCount);
+    geometry.z.resize(vertexCount);
+    geometry.indices.resize(static_cast<size_t>(segments) * segments * 6);
+
+    int rowsPerTask = max(GEOMETRY_TASK_VERTICES / columns, 1);
+    int taskCount = (columns + rowsPerTask - 1) / rowsPerTask;
+    URunParallel(pool, taskCount, [&](int task, int) {
+        int lastRow = min((task + 1) * rowsPerTask, columns);
+        for (int i = task * rowsPerTask; i < lastRow; ++i) {
+            float ringRadius = radius * sinPhi[i];
+            float height = radius * cosPhi[i];
+            float* x = geometry.x.data() + static_cast<size_t>(i) * columns;
+            float* y = geometry.y.data() + static_cast<size_t>(i) * columns;
+            float* z = geometry.z.data() + static_cast<size_t>(i) * columns;
+            for (int j = 0; j < columns; ++j) {
+                x[j] = ringRadius * cosTheta[j];
+                y[j] = height;
+                z[j] = ringRadius * sinTheta[j];
+            }
+
+            // The last row only closes the quads of the row before it
+            if (i == segments)
+                continue;
+            GLuint* indices = geometry.indices.data() + static_cast<size_t>(i) * segments * 6;
+            for (int j = 0; j < segments; ++j) {
+                GLuint vertexIndex = static_cast<GLuint>(i * columns + j);
+                indices[0] = vertexIndex;
+                indices[1] = vertexIndex + 1;
+                indices[2] = vertexIndex + columns;
+                indices[3] = vertexIndex + 1;
+                indices[4] = vertexIndex + columns + 1;
+                indices[5] = vertexIndex + columns;
+                indices += 6;
+            }
+        }
+    });
+}
+
+// Function to generate a cylinder cap as a fan of numSegments triangles around a center vertex
+static void UCylinderGeometry(ProceduralGeometry& geometry, float radius, float cylinderHeight, int numSegments) {
+    U_PROFILE_FUNCTION();
+    geometry.x.resize(numSegments + 1);
+    geometry.y.resize(numSegments + 1);
+    geometry.z.assign(numSegments + 1, cylinderHeight);
+    geometry.indices.resize(numSegments * 3);
+
+    // Vertex 0 is the center, the rest lie on the rim
+    vector<float> angles(numSegments);
+    for (int i = 0; i < numSegments; ++i)
+        angles[i] = i * (2.0f * static_cast<float>(M_PI) / numSegments);
+    geometry.x[0] = 0.0f;
+    geometry.y[0] = 0.0f;
+    USinCos(angles.data(), geometry.y.data() + 1, geometry.x.data() + 1, numSegments);
+    for (int i = 1; i <= numSegments; ++i) {
+        geometry.x[i] *= radius;
+        geometry.y[i] *= radius;
+    }
+
+    for (int i = 0; i < numSegments; ++i) {
+        geometry.indices[3 * i] = 0;
+        geometry.indices[3 * i + 1] = static_cast<GLuint>(i + 1);
+        geometry.indices[3 * i + 2] = static_cast<GLuint>((i + 1) % numSegments + 1);
+    }
+}
 
-    GLfloat* sphereVertices = new GLfloat[numVertices * 3];
-    GLushort* sphereIndices = new GLushort[numIndices];
+// Function to interleave generated positions into the shared vertex layout, every vertex with the same color
+static void UInterleaveGeometry(const ProceduralGeometry& geometry, const glm::vec4& color, vector<GLfloat>& vertices) {
+    U_PROFILE_FUNCTION();
+    size_t vertexCount = geometry.x.size();
+    vertices.resize(vertexCount * FLOATS_PER_VERTEX);
+    for (size_t v = 0; v < vertexCount; ++v) {
+        GLfloat* vertex = vertices.data() + v * FLOATS_PER_VERTEX;
+        vertex[0] = geometry.x[v];
+        vertex[1] = geometry.y[v];
+        vertex[2] = geometry.z[v];
+        vertex[3] = color.x;
+        vertex[4] = color.y;
+        vertex[5] = color.z;
+        vertex[6] = color.w;
+    }
+}
+
+// Function to generate the vertices and indices of a UV sphere one vertex at a time. Kept as the
+// reference the geometry benchmark measures USphereGeometry against.
+static void USphereMeshLevel(vector<GLfloat>& sphereVertices, vector<GLuint>& sphereIndices, float radius, int segments) {
+    U_PROFILE_FUNCTION();
+    sphereVertices.clear();
+    sphereIndices.clear();
 
     // Generate sphere vertices
-    int index = 0;
     for (int i = 0; i <= segments; ++i) {
         float phi = static_cast<float>(i) / static_cast<float>(segments) * static_cast<float>(M_PI);
         for (int j = 0; j <= segments; ++j) {
@@ -183,37 +1767,84 @@ void USphereMesh(GLMesh& mesh, float radius, int segments) {
             float y = radius * cos(phi);
             float z = radius * sin(phi) * sin(theta);
 
-            sphereVertices[index++] = x;
-            sphereVertices[index++] = y;
-            sphereVertices[index++] = z;
+            sphereVertices.push_back(x);
+            sphereVertices.push_back(y);
+            sphereVertices.push_back(z);
+
+            // Orange color (r, g, b, a)
+            sphereVertices.push_back(1.0f);
+            sphereVertices.push_back(0.5f);
+            sphereVertices.push_back(0.0f);
+            sphereVertices.push_back(1.0f);
         }
     }
 
     // Generate sphere indices
-    index = 0;
     for (int i = 0; i < segments; ++i) {
         for (int j = 0; j < segments; ++j) {
             int vertexIndex = i * (segments + 1) + j;
 
-            sphereIndices[index++] = static_cast<GLushort>(vertexIndex);
-            sphereIndices[index++] = static_cast<GLushort>(vertexIndex + 1);
-            sphereIndices[index++] = static_cast<GLushort>(vertexIndex + segments + 1);
+            sphereIndices.push_back(static_cast<GLuint>(vertexIndex));
+            sphereIndices.push_back(static_cast<GLuint>(vertexIndex + 1));
+            sphereIndices.push_back(static_cast<GLuint>(vertexIndex + segments + 1));
 
-            sphereIndices[index++] = static_cast<GLushort>(vertexIndex + 1);
-            sphereIndices[index++] = static_cast<GLushort>(vertexIndex + segments + 2);
-            sphereIndices[index++] = static_cast<GLushort>(vertexIndex + segments + 1);
+            sphereIndices.push_back(static_cast<GLuint>(vertexIndex + 1));
+            sphereIndices.push_back(static_cast<GLuint>(vertexIndex + segments + 2));
+            sphereIndices.push_back(static_cast<GLuint>(vertexIndex + segments + 1));
         }
     }
+}
+
+// Function to create a mesh from a compile-time table as its first level, or add the table as a coarser level
+template <typename Table>
+static void UAddTableLevel(GLMesh& mesh, int level) {
+    if (level == 0) {
+        UCreateMesh(mesh, Table::vertices.data(), Table::indices.data(), Table::VERTEX_COUNT, Table::INDEX_COUNT);
+        mesh.lods[0].error = Table::LOD_ERROR;
+    }
+    else
+        UAddMeshLod(mesh, Table::vertices.data(), Table::indices.data(), Table::VERTEX_COUNT, Table::INDEX_COUNT, Table::LOD_ERROR);
+}
 
-    UCreateMesh(mesh, sphereVertices, sphereIndices, numVertices, numIndices);
+// Function to initialize the sphere mesh - an orange. Each level of detail halves the segment count,
+// down to a minimum of four segments.
+void USphereMesh(GLMesh& mesh, float radius, int segments) {
+    U_PROFILE_FUNCTION();
+
+    // The scene's sphere and its levels are built into the binary
+    if (radius == SPHERE_TABLE_RADIUS && segments == 32) {
+        UAddTableLevel<Sphere<32>>(mesh, 0);
+        UAddTableLevel<Sphere<16>>(mesh, 1);
+        UAddTableLevel<Sphere<8>>(mesh, 2);
+        UAddTableLevel<Sphere<4>>(mesh, 3);
+        return;
+    }
 
-    // Clean up dynamic arrays
-    delete[] sphereVertices;
-    delete[] sphereIndices;
+    ProceduralGeometry& geometry = gProceduralGeometry;
+    vector<GLfloat>& sphereVertices = gProceduralVertices;
+    const vector<GLuint>& sphereIndices = geometry.indices;
+
+    for (int level = 0; level < MAX_MESH_LODS && (level == 0 || segments >= 4); ++level, segments /= 2) {
+        // Orange color (r, g, b, a)
+        USphereGeometry(gWorkerPool, geometry, radius, segments);
+        UInterleaveGeometry(geometry, glm::vec4(1.0f, 0.5f, 0.0f, 1.0f), sphereVertices);
+        int numVertices = static_cast<int>(sphereVertices.size()) / FLOATS_PER_VERTEX;
+        int numIndices = static_cast<int>(sphereIndices.size());
+
+        // A longitude step of 2*pi/segments leaves the middle of each facet this far inside the sphere
+        float error = radius * (1.0f - cos(static_cast<float>(M_PI) / segments));
+        if (level == 0) {
+            UCreateMesh(mesh, sphereVertices.data(), sphereIndices.data(), numVertices, numIndices);
+            mesh.lods[0].error = error;
+        }
+        else
+            UAddMeshLod(mesh, sphereVertices.data(), sphereIndices.data(), numVertices, numIndices, error);
+    }
 }
 
 // Function to initialize a 3D plane mesh - table surface
 void UPlaneMesh(GLMesh& mesh, float width, float length) {
+    U_PROFILE_FUNCTION();
     float halfWidth = width / 2.0f;
     float halfLength = length / 2.0f;
     float yOffset = -0.8f; // Adjust the yOffset to position the plane lower
@@ -226,7 +1857,7 @@ void UPlaneMesh(GLMesh& mesh, float width, float length) {
         -halfWidth, yOffset, -halfLength,    0.0f, 1.0f, 0.0f, 1.0f  // Bottom Left Back
     };
 
-    GLushort planeIndices[] = {
+    GLuint planeIndices[] = {
         0, 1, 2,
         0, 2, 3
     };
@@ -236,6 +1867,7 @@ void UPlaneMesh(GLMesh& mesh, float width, float length) {
 
 // Function to initialize the cube mesh - chicken broth box
 void UCubeMesh(GLMesh& mesh) {
+    U_PROFILE_FUNCTION();
     GLfloat cubeVertices[] = {
         // Vertex Positions         // Colors (r, g, b, a)
         0.3f,  0.5f,  0.6f,         1.0f, 1.0f, 0.0f, 1.0f, // Top Right Front
@@ -249,54 +1881,148 @@ void UCubeMesh(GLMesh& mesh) {
         -0.3f,  0.5f, -0.25f,         1.0f, 0.5f, 0.0f, 1.0f  // Top Left Back
     };
 
-    GLushort cubeIndices[] = {
-        0,1,4,1,4,5,4,5,7,5,6,7,1,2,5,2,5,6,0,3,4,3,4,7,2,3,6,3,6,7,0,1,3,1,2,3
+    GLuint cubeIndices[] = {
+        0,1,4,1,5,4,4,5,7,5,6,7,1,2,5,2,6,5,0,4,3,3,4,7,2,3,6,3,7,6,0,3,1,1,3,2
     };
 
 
     UCreateMesh(mesh, cubeVertices, cubeIndices, sizeof(cubeVertices) / sizeof(cubeVertices[0]) / 7, sizeof(cubeIndices) / sizeof(cubeIndices[0]));
 }
 
-// Function to initialize the cylinder mesh - the cap of the chicken broth box
-void UCylinderMesh(GLMesh& mesh) {
-    GLfloat cylinderVertices[360 * 3 + 3]; // Updated cylinder vertices
-    GLushort cylinderIndices[720 * 3];    // Updated cylinder indices
+// Function to initialize a unit box, scaled to an object's bounds when it stands in for a hidden object
+void UBoundsProxyMesh(GLMesh& mesh) {
+    U_PROFILE_FUNCTION();
+    GLfloat boxVertices[8 * FLOATS_PER_VERTEX];
+    for (int i = 0; i < 8; ++i) {
+        GLfloat* vertex = boxVertices + FLOATS_PER_VERTEX * i;
+        vertex[0] = (i & 1) ? 0.5f : -0.5f;
+        vertex[1] = (i & 2) ? 0.5f : -0.5f;
+        vertex[2] = (i & 4) ? 0.5f : -0.5f;
+        vertex[3] = vertex[4] = vertex[5] = vertex[6] = 1.0f;
+    }
+
+    GLuint boxIndices[] = {
+        0,1,3,0,3,2, 4,6,7,4,7,5, 0,4,5,0,5,1, 2,3,7,2,7,6, 0,2,6,0,6,4, 1,5,7,1,7,3
+    };
 
-    // Center vertex at the bottom
-    cylinderVertices[0] = 0.0f;
-    cylinderVertices[1] = 0.0f;
-    cylinderVertices[2] = 0.0f;
+    UCreateMesh(mesh, boxVertices, boxIndices, 8, sizeof(boxIndices) / sizeof(boxIndices[0]));
+}
+
+// Function to generate a cylinder cap one vertex at a time. Kept as the reference the geometry
+// benchmark measures UCylinderGeometry against.
+static void UCylinderMeshLevel(vector<GLfloat>& cylinderVertices, vector<GLuint>& cylinderIndices, float radius, float cylinderHeight, int numSegments) {
+    U_PROFILE_FUNCTION();
+    cylinderVertices.assign((numSegments + 1) * FLOATS_PER_VERTEX, 0.0f); // center vertex plus one per segment
+    cylinderIndices.assign(numSegments * 3, 0);                          // one triangle per segment
 
-    // Vertices for the top circle
-    float radius = 0.2f;
-    int numSegments = 360;
     float segmentAngle = 2.0f * M_PI / numSegments;
-    float cylinderHeight = 0.7f; // Set the height of the cylinder
 
-    for (int i = 0; i < numSegments; ++i) {
-        int baseIndex = 3 * (i + 1);
-        float x = radius * cos(i * segmentAngle);
-        float y = radius * sin(i * segmentAngle);
-        cylinderVertices[baseIndex] = x;
-        cylinderVertices[baseIndex + 1] = y;
-        cylinderVertices[baseIndex + 2] = cylinderHeight;
+    for (int i = 0; i <= numSegments; ++i) {
+        GLfloat* vertex = cylinderVertices.data() + FLOATS_PER_VERTEX * i;
+
+        // Vertex 0 is the center, the rest lie on the rim
+        if (i == 0) {
+            vertex[0] = 0.0f;
+            vertex[1] = 0.0f;
+        }
+        else {
+            vertex[0] = radius * cos((i - 1) * segmentAngle);
+            vertex[1] = radius * sin((i - 1) * segmentAngle);
+        }
+        vertex[2] = cylinderHeight;
+
+        // White cap color (r, g, b, a)
+        vertex[3] = 1.0f;
+        vertex[4] = 1.0f;
+        vertex[5] = 1.0f;
+        vertex[6] = 1.0f;
     }
 
-    // Define cylinder indices
+    // Define cylinder indices as a fan around the center vertex
     for (int i = 0; i < numSegments; ++i) {
-        int baseIndex = 3 * i;
         cylinderIndices[3 * i] = 0;
-        cylinderIndices[3 * i + 1] = baseIndex + 1;
-        cylinderIndices[3 * i + 2] = (baseIndex + 4) % (numSegments * 3);
+        cylinderIndices[3 * i + 1] = static_cast<GLuint>(i + 1);
+        cylinderIndices[3 * i + 2] = static_cast<GLuint>((i + 1) % numSegments + 1);
+    }
+}
+
+// Function to initialize the cylinder mesh - the cap of the chicken broth box, with a chain of
+// coarser levels of detail
+void UCylinderMesh(GLMesh& mesh) {
+    U_PROFILE_FUNCTION();
+    UAddTableLevel<Cylinder<360>>(mesh, 0);
+    UAddTableLevel<Cylinder<120>>(mesh, 1);
+    UAddTableLevel<Cylinder<40>>(mesh, 2);
+    UAddTableLevel<Cylinder<12>>(mesh, 3);
+}
+
+// Function to report the largest distance between generated positions and the interleaved reference ones
+static float UGeometryDifference(const ProceduralGeometry& geometry, const vector<GLfloat>& reference) {
+    float difference = 0.0f;
+    for (size_t v = 0; v < geometry.x.size(); ++v) {
+        const GLfloat* vertex = reference.data() + v * FLOATS_PER_VERTEX;
+        difference = max(difference, glm::length(glm::vec3(geometry.x[v], geometry.y[v], geometry.z[v]) - glm::vec3(vertex[0], vertex[1], vertex[2])));
+    }
+    return difference;
+}
+
+// Function to compare the generators against their scalar references, in millions of vertices generated
+// per second: the reference, the SIMD generator on one thread and, for the sphere, on the worker pool too.
+// Each generator is run until it has produced a few million vertices.
+void UBenchmarkGeometry() {
+    U_PROFILE_FUNCTION();
+    const int sphereSegments[] = { 64, 256, 1024 };
+    const double targetVertices = 4.0e6;
+    WorkerPool serial; // no threads, so its jobs run on this one
+    ProceduralGeometry geometry;
+    vector<GLfloat> referenceVertices;
+    vector<GLuint> referenceIndices;
+
+    for (int segments : sphereSegments) {
+        double vertices = static_cast<double>(segments + 1) * (segments + 1);
+        int repeats = max(static_cast<int>(targetVertices / vertices), 1);
+        double rates[3];
+        for (int variant = 0; variant < 3; ++variant) {
+            int64_t start = UProfileNow();
+            for (int r = 0; r < repeats; ++r) {
+                if (variant == 0)
+                    USphereMeshLevel(referenceVertices, referenceIndices, 0.5f, segments);
+                else
+                    USphereGeometry(variant == 1 ? serial : gWorkerPool, geometry, 0.5f, segments);
+            }
+            rates[variant] = vertices * repeats / ((UProfileNow() - start) / 1.0e9) / 1.0e6;
+        }
+        cout << "INFO: geometry bench: sphere " << segments << " segments (" << static_cast<int>(vertices) << " vertices): scalar "
+            << rates[0] << " Mvert/s, SIMD " << rates[1] << " Mvert/s, SIMD on " << gWorkerPool.threads.size() + 1 << " threads "
+            << rates[2] << " Mvert/s, max difference " << UGeometryDifference(geometry, referenceVertices) << endl;
     }
 
-    UCreateMesh(mesh, cylinderVertices, cylinderIndices, numSegments + 2, numSegments * 3);
+    const int cylinderSegments = 360;
+    int repeats = static_cast<int>(targetVertices / (cylinderSegments + 1));
+    double rates[2];
+    for (int variant = 0; variant < 2; ++variant) {
+        int64_t start = UProfileNow();
+        for (int r = 0; r < repeats; ++r) {
+            if (variant == 0)
+                UCylinderMeshLevel(referenceVertices, referenceIndices, 0.2f, 0.7f, cylinderSegments);
+            else
+                UCylinderGeometry(geometry, 0.2f, 0.7f, cylinderSegments);
+        }
+        rates[variant] = static_cast<double>(cylinderSegments + 1) * repeats / ((UProfileNow() - start) / 1.0e9) / 1.0e6;
+    }
+    cout << "INFO: geometry bench: cylinder " << cylinderSegments << " segments: scalar " << rates[0] << " Mvert/s, SIMD " << rates[1]
+        << " Mvert/s, max difference " << UGeometryDifference(geometry, referenceVertices) << endl;
 }
 
 // Function to create and load a texture
 bool UCreateTexture(const char* filename, GLuint& textureId) {
+    U_PROFILE_FUNCTION();
     int width, height, channels;
-    unsigned char* image = stbi_load(filename, &width, &height, &channels, 0);
+    unsigned char* image;
+    {
+        U_PROFILE_SCOPE("stbi_load");
+        image = stbi_load(filename, &width, &height, &channels, 0);
+    }
     if (image) {
         glGenTextures(1, &textureId);
         glBindTexture(GL_TEXTURE_2D, textureId);
@@ -331,376 +2057,4826 @@ bool UCreateTexture(const char* filename, GLuint& textureId) {
 
 // Function to destroy a texture
 void UDestroyTexture(GLuint textureId) {
+    U_PROFILE_FUNCTION();
     glDeleteTextures(1, &textureId);
 }
 
-// main function
-int main(int argc, char* argv[]) {
-    if (!UInitialize(argc, argv, &gWindow))
-        return EXIT_FAILURE;
-
-    // Create cube and cylinder meshes
-    UCubeMesh(gCubeMesh);
-    UCylinderMesh(gCylinderMesh);
-    UPlaneMesh(gPlaneMesh, 5.0f, 5.0f); // Create a 3D plane with width 5.0 and length 5.0
-    USphereMesh(gSphereMesh, 0.5f, 32);
-    UPyramidMesh(gPyramidMesh);
+// Function run by each texture decode thread: takes queued requests and decodes them with stb_image
+static void UTextureDecodeMain(TextureLoader* loader) {
+    for (;;) {
+        TextureRequest* request;
+        {
+            unique_lock<mutex> lock(loader->lock);
+            loader->wake.wait(lock, [loader] { return loader->quit || !loader->queue.empty(); });
+            if (loader->quit)
+                return;
+            request = loader->queue.front();
+            loader->queue.pop_front();
+        }
 
-    if (!UCreateShaderProgram(vertexShaderSource, fragmentShaderSource, gProgramId))
-        return EXIT_FAILURE;
+        bool decoded = false;
+        const string& filename = request->filename;
+        if (filename.size() > 5 && filename.compare(filename.size() - 5, 5, ".ktx2") == 0) {
+            // Baked textures are already in their GPU format, so "decoding" is reading the file
+            ifstream file(filename, ios::binary);
+            request->fileData.assign(istreambuf_iterator<char>(file), istreambuf_iterator<char>());
+            int width, height;
+            decoded = ULoadKtx2(request->fileData, request->internalFormat, width, height, request->levels);
+            request->format = 0;
+        }
+        else {
+            int width, height, channels;
+            {
+                U_PROFILE_SCOPE("stbi_load");
+                request->pixels = stbi_load(filename.c_str(), &width, &height, &channels, 0);
+            }
+            if (request->pixels && (channels == 3 || channels == 4)) {
+                TextureLevel level;
+                level.data = request->pixels;
+                level.width = width;
+                level.height = height;
+                level.rowBytes = static_cast<GLsizeiptr>(width) * channels;
+                level.rowHeight = 1;
+                level.rows = height;
+                request->levels.push_back(level);
+                request->internalFormat = channels == 3 ? GL_RGB8 : GL_RGBA8;
+                request->format = channels == 3 ? GL_RGB : GL_RGBA;
+                decoded = true;
+            }
+            else if (request->pixels) {
+                cout << "Not implemented to handle image with " << channels << " channels" << endl;
+                stbi_image_free(request->pixels);
+                request->pixels = nullptr;
+            }
+        }
+        request->state.store(decoded ? TEXTURE_DECODED : TEXTURE_FAILED, memory_order_release);
+    }
+}
 
-    // Load the texture 
-    const char* texFilename = "textures/broth.png";
+// Function to start the decode threads and the pixel stream, which is sized so one frame's budget fits
+// in a region
+void UCreateTextureLoader(TextureLoader& loader, int threadCount, GLsizeiptr uploadBudget) {
+    U_PROFILE_FUNCTION();
+    loader.quit = false;
+    loader.uploadBudget = uploadBudget;
+    loader.bytesUploaded = 0;
+    loader.texturesResident = 0;
+    UCreateStreamBuffer(loader.pixelStream, uploadBudget);
+    for (int i = 0; i < threadCount; ++i)
+        loader.threads.push_back(thread(UTextureDecodeMain, &loader));
+}
 
-    if (!UCreateTexture(texFilename, gTextureId))
+// Function to stop the decode threads and drop unfinished requests. The texture names stay with
+// whoever requested them.
+void UDestroyTextureLoader(TextureLoader& loader) {
+    U_PROFILE_FUNCTION();
     {
-        cout << "Failed to load texture " << texFilename << endl;
-        return EXIT_FAILURE;
+        lock_guard<mutex> lock(loader.lock);
+        loader.quit = true;
+        loader.queue.clear();
+    }
+    loader.wake.notify_all();
+    for (size_t i = 0; i < loader.threads.size(); ++i)
+        loader.threads[i].join();
+    loader.threads.clear();
+
+    for (size_t i = 0; i < loader.requests.size(); ++i) {
+        TextureRequest& request = *loader.requests[i];
+        if (request.pixels)
+            stbi_image_free(request.pixels);
+        if (request.staging)
+            glDeleteTextures(1, &request.staging);
     }
-    // tell opengl for each sampler to which texture unit it belongs to (only has to be done once)
-    glUseProgram(gProgramId);
-    // We set the texture as texture unit 0
-    glUniform1i(glGetUniformLocation(gProgramId, "uTexture"), 0);
+    loader.requests.clear();
+    UDestroyStreamBuffer(loader.pixelStream);
+}
 
-    glClearColor(0.0f, 0.0f, 0.0f, 1.0f);
+// Function to create a request whose texture name already holds the placeholder
+static unique_ptr<TextureRequest> UNewTextureRequest(const char* filename) {
+    const unsigned char placeholder[4] = { 128, 128, 128, 255 };
+
+    unique_ptr<TextureRequest> request(new TextureRequest());
+    request->filename = filename;
+    request->staging = 0;
+    request->pixels = nullptr;
+    request->internalFormat = 0;
+    request->format = 0;
+    request->level = 0;
+    request->rowsUploaded = 0;
+    request->state = TEXTURE_QUEUED;
+    request->requestTime = UProfileNow();
+
+    glGenTextures(1, &request->texture);
+    glBindTexture(GL_TEXTURE_2D, request->texture);
+
+    // Set the texture wrapping parameters
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT);
+    // Set texture filtering parameters
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+
+    glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA8, 1, 1, 0, GL_RGBA, GL_UNSIGNED_BYTE, placeholder);
+    glBindTexture(GL_TEXTURE_2D, 0);
+    return request;
+}
 
-    // Set the framebuffer size callback
-    glfwSetFramebufferSizeCallback(gWindow, UResizeWindow);
+// Function to request a texture without waiting for it. The returned name is usable right away and
+// samples as a single grey texel until the image is resident.
+GLuint URequestTexture(TextureLoader& loader, const char* filename) {
+    U_PROFILE_FUNCTION();
+    unique_ptr<TextureRequest> request = UNewTextureRequest(filename);
+    GLuint texture = request->texture;
+    {
+        lock_guard<mutex> lock(loader.lock);
+        loader.queue.push_back(request.get());
+        loader.requests.push_back(move(request));
+    }
+    loader.wake.notify_one();
+    return texture;
+}
 
-    // Set the cursor position callback
-    glfwSetCursorPosCallback(gWindow, UMousePositionCallback);
+// Function to make a fully uploaded texture resident: the staging image replaces the placeholder with
+// a GPU-side copy. Uncompressed images get their mipmaps generated; baked ones bring their own.
+static void UFinishTexture(TextureLoader& loader, TextureRequest& request) {
+    U_PROFILE_FUNCTION();
+    const TextureLevel& base = request.levels[0];
 
-    // Set the scroll callback
-    glfwSetScrollCallback(gWindow, UMouseScrollCallback);
+    glBindTexture(GL_TEXTURE_2D, request.texture);
+    if (request.format) {
+        glTexImage2D(GL_TEXTURE_2D, 0, request.internalFormat, base.width, base.height, 0, request.format, GL_UNSIGNED_BYTE, nullptr);
+        glCopyImageSubData(request.staging, GL_TEXTURE_2D, 0, 0, 0, 0, request.texture, GL_TEXTURE_2D, 0, 0, 0, 0, base.width, base.height, 1);
+        glGenerateMipmap(GL_TEXTURE_2D);
+    }
+    else {
+        GLsizei levelCount = static_cast<GLsizei>(request.levels.size());
+        glTexStorage2D(GL_TEXTURE_2D, levelCount, request.internalFormat, base.width, base.height);
+        for (GLsizei i = 0; i < levelCount; ++i) {
+            const TextureLevel& level = request.levels[i];
+            glCopyImageSubData(request.staging, GL_TEXTURE_2D, i, 0, 0, 0, request.texture, GL_TEXTURE_2D, i, 0, 0, 0, level.width, level.height, 1);
+        }
+    }
+    glBindTexture(GL_TEXTURE_2D, 0);
+
+    glDeleteTextures(1, &request.staging);
+    request.staging = 0;
+    if (request.pixels)
+        stbi_image_free(request.pixels);
+    request.pixels = nullptr;
+    vector<unsigned char>().swap(request.fileData);
+    request.state.store(TEXTURE_RESIDENT, memory_order_relaxed);
+    loader.texturesResident++;
+
+    cout << "INFO: texture " << request.filename << " (" << base.width << "x" << base.height << ", " << request.levels.size()
+        << (request.levels.size() == 1 ? " level" : " levels") << ") resident after " << (UProfileNow() - request.requestTime) / 1.0e6 << " ms" << endl;
+}
 
-    // Set cursor mode to normal
-    glfwSetInputMode(gWindow, GLFW_CURSOR, GLFW_CURSOR_NORMAL);
+// Function to upload this frame's share of decoded texture rows, oldest request first. Rows are copied
+// into the current pixel stream region and read from there by glTexSubImage2D, so the copy to the
+// texture happens on the GPU timeline and the region is reused only after the frame's fence. At least
+// one row goes up per frame even if it alone exceeds the budget.
+void UUpdateTextureLoader(TextureLoader& loader) {
+    U_PROFILE_FUNCTION();
+    GLsizeiptr budget = loader.uploadBudget;
+    bool bound = false;
+
+    for (size_t i = 0; i < loader.requests.size() && budget > 0; ++i) {
+        TextureRequest& request = *loader.requests[i];
+        int state = request.state.load(memory_order_acquire);
+        if (state == TEXTURE_FAILED) {
+            cout << "ERROR::TEXTURE::LOAD_FAILED " << request.filename << endl;
+            loader.requests.erase(loader.requests.begin() + i--);
+            continue;
+        }
+        if (state == TEXTURE_RESIDENT) {
+            loader.requests.erase(loader.requests.begin() + i--);
+            continue;
+        }
+        if (state == TEXTURE_QUEUED)
+            continue;
+
+        const TextureLevel& base = request.levels[0];
+        if (state == TEXTURE_DECODED) {
+            glGenTextures(1, &request.staging);
+            glBindTexture(GL_TEXTURE_2D, request.staging);
+            if (request.format)
+                glTexImage2D(GL_TEXTURE_2D, 0, request.internalFormat, base.width, base.height, 0, request.format, GL_UNSIGNED_BYTE, nullptr);
+            else
+                glTexStorage2D(GL_TEXTURE_2D, static_cast<GLsizei>(request.levels.size()), request.internalFormat, base.width, base.height);
+            request.state.store(TEXTURE_UPLOADING, memory_order_relaxed);
+        }
+        else
+            glBindTexture(GL_TEXTURE_2D, request.staging);
 
-    // Enable capturing mouse cursor movement
-    glfwSetInputMode(gWindow, GLFW_CURSOR, GLFW_CURSOR_DISABLED);
+        if (!bound) {
+            glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+            bound = true;
+        }
 
-    while (!glfwWindowShouldClose(gWindow)) {
-        glfwPollEvents();
-        UProcessInput(gWindow);
-        URender();
+        while (budget > 0 && request.level < static_cast<int>(request.levels.size())) {
+            const TextureLevel& level = request.levels[request.level];
+            int rows = static_cast<int>(max<GLsizeiptr>(budget / level.rowBytes, 1));
+            rows = min(rows, level.rows - request.rowsUploaded);
+            GLsizeiptr size = rows * level.rowBytes;
+            int y = request.rowsUploaded * level.rowHeight;
+            int height = min(rows * level.rowHeight, level.height - y);
+
+            GLintptr offset;
+            GLbyte* destination = UStreamAllocate(loader.pixelStream, size, 4, offset);
+            // Growing the stream replaces the buffer, so bind whichever one the rows were written to
+            glBindBuffer(GL_PIXEL_UNPACK_BUFFER, loader.pixelStream.buffer);
+            memcpy(destination, level.data + request.rowsUploaded * level.rowBytes, size);
+            if (request.format)
+                glTexSubImage2D(GL_TEXTURE_2D, request.level, 0, y, level.width, height, request.format, GL_UNSIGNED_BYTE,
+                    reinterpret_cast<const void*>(offset));
+            else
+                glCompressedTexSubImage2D(GL_TEXTURE_2D, request.level, 0, y, level.width, height, request.internalFormat,
+                    static_cast<GLsizei>(size), reinterpret_cast<const void*>(offset));
+
+            request.rowsUploaded += rows;
+            budget -= size;
+            loader.bytesUploaded += size;
+            if (request.rowsUploaded == level.rows) {
+                request.level++;
+                request.rowsUploaded = 0;
+            }
+        }
 
+        if (request.level == static_cast<int>(request.levels.size()))
+            UFinishTexture(loader, request);
     }
 
-    UDestroyMesh(gCubeMesh);
-    UDestroyMesh(gCylinderMesh);
-    UDestroyShaderProgram(gProgramId);
-    // Release texture
-    UDestroyTexture(gTextureId);
+    if (bound) {
+        glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+        glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+        glBindTexture(GL_TEXTURE_2D, 0);
+    }
+}
 
-    exit(EXIT_SUCCESS);
+// Function to read a little-endian 32-bit value from a byte array
+static uint32_t UReadUint32(const unsigned char* bytes) {
+    return bytes[0] | (bytes[1] << 8) | (bytes[2] << 16) | (static_cast<uint32_t>(bytes[3]) << 24);
 }
 
-void UMousePositionCallback(GLFWwindow* window, double xpos, double ypos) {
-    static float lastX = WINDOW_WIDTH / 2.0f;
-    static float lastY = WINDOW_HEIGHT / 2.0f;
-    static bool firstMouse = true;
+// Function to read a little-endian 64-bit value from a byte array
+static uint64_t UReadUint64(const unsigned char* bytes) {
+    return UReadUint32(bytes) | (static_cast<uint64_t>(UReadUint32(bytes + 4)) << 32);
+}
 
-    if (firstMouse) {
-        lastX = xpos;
-        lastY = ypos;
-        firstMouse = false;
+// Function to parse a KTX2 file written by the baker: a 2D texture in one of the block formats, no
+// supercompression. The levels point into the file's bytes.
+bool ULoadKtx2(const vector<unsigned char>& file, GLenum& internalFormat, int& width, int& height, vector<TextureLevel>& levels) {
+    U_PROFILE_FUNCTION();
+    static const unsigned char identifier[12] = { 0xAB, 'K', 'T', 'X', ' ', '2', '0', 0xBB, '\r', '\n', 0x1A, '\n' };
+    if (file.size() < 80 || memcmp(file.data(), identifier, sizeof(identifier)) != 0) {
+        cout << "ERROR::KTX2::NOT_A_KTX2_FILE" << endl;
+        return false;
     }
 
-    float xoffset = (xpos - lastX) * mouseSensitivity;
-    float yoffset = (lastY - ypos) * mouseSensitivity;
-
-    lastX = xpos;
-    lastY = ypos;
-
-    yaw += xoffset;
-    pitch += yoffset;
-
-    // constrain pitch to avoid camera flipping
-    if (pitch > 89.0f)
-        pitch = 89.0f;
-    if (pitch < -89.0f)
-        pitch = -89.0f;
+    const unsigned char* header = file.data() + 12;
+    uint32_t vkFormat = UReadUint32(header);
+    width = static_cast<int>(UReadUint32(header + 8));
+    height = static_cast<int>(UReadUint32(header + 12));
+    uint32_t depth = UReadUint32(header + 16);
+    uint32_t layers = UReadUint32(header + 20);
+    uint32_t faces = UReadUint32(header + 24);
+    uint32_t levelCount = UReadUint32(header + 28);
+    uint32_t supercompression = UReadUint32(header + 32);
+
+    // A full mip chain has floor(log2(max(width, height))) + 1 levels; more would shift a size to nothing
+    uint32_t maxLevels = 1;
+    while (width > 0 && height > 0 && (max(width, height) >> maxLevels) > 0)
+        maxLevels++;
+    if (depth != 0 || layers > 1 || faces != 1 || supercompression != 0 || levelCount == 0 || levelCount > maxLevels ||
+        width <= 0 || height <= 0 || file.size() < 80 + static_cast<uint64_t>(levelCount) * 24) {
+        cout << "ERROR::KTX2::UNSUPPORTED_LAYOUT" << endl;
+        return false;
+    }
 
-    glm::vec3 front;
-    front.x = cos(glm::radians(yaw)) * cos(glm::radians(pitch));
-    front.y = sin(glm::radians(pitch));
-    front.z = sin(glm::radians(yaw)) * cos(glm::radians(pitch));
-    cameraFront = glm::normalize(front);
+    int blockBytes;
+    switch (vkFormat) {
+    case 131: internalFormat = GL_COMPRESSED_RGB_S3TC_DXT1_EXT; blockBytes = 8; break;
+    case 133: internalFormat = GL_COMPRESSED_RGBA_S3TC_DXT1_EXT; blockBytes = 8; break;
+    case 137: internalFormat = GL_COMPRESSED_RGBA_S3TC_DXT5_EXT; blockBytes = 16; break;
+    case 141: internalFormat = GL_COMPRESSED_RG_RGTC2; blockBytes = 16; break;
+    case 145: internalFormat = GL_COMPRESSED_RGBA_BPTC_UNORM; blockBytes = 16; break;
+    default:
+        cout << "ERROR::KTX2::UNSUPPORTED_FORMAT " << vkFormat << endl;
+        return false;
+    }
+    if (blockBytes == 8 || vkFormat == 137) {
+        if (!GLEW_EXT_texture_compression_s3tc) {
+            cout << "ERROR::KTX2::S3TC_NOT_SUPPORTED" << endl;
+            return false;
+        }
+    }
 
-    // Update the view matrix
-    view = glm::lookAt(cameraPosition, cameraPosition + cameraFront, cameraUp);
+    levels.clear();
+    for (uint32_t i = 0; i < levelCount; ++i) {
+        const unsigned char* entry = file.data() + 80 + i * 24;
+        uint64_t offset = UReadUint64(entry);
+        uint64_t length = UReadUint64(entry + 8);
+
+        TextureLevel level;
+        level.width = max(width >> i, 1);
+        level.height = max(height >> i, 1);
+        level.rowBytes = static_cast<GLsizeiptr>((level.width + 3) / 4) * blockBytes;
+        level.rowHeight = 4;
+        level.rows = (level.height + 3) / 4;
+        if (offset > file.size() || length > file.size() - offset || length != static_cast<uint64_t>(level.rowBytes) * level.rows) {
+            cout << "ERROR::KTX2::BAD_LEVEL " << i << endl;
+            return false;
+        }
+        level.data = file.data() + offset;
+        levels.push_back(level);
+    }
+    return true;
 }
 
-void UMouseScrollCallback(GLFWwindow* window, double xoffset, double yoffset) {
-    zoom -= (float)yoffset;
-
-    if (zoom < 1.0f)
-        zoom = 1.0f;
-    if (zoom > 45.0f)
-        zoom = 45.0f;
+// Function to write a KTX2 file holding a 2D texture's mip chain, level 0 first in levels. KTX2 stores
+// the level data smallest first, each level aligned to the block size; the data format descriptor
+// tells other tools which block format the data uses.
+bool UWriteKtx2(const string& path, BlockFormat format, int width, int height, const vector<vector<unsigned char> >& levels) {
+    U_PROFILE_FUNCTION();
+    // Basic data format descriptor: KHR_DF_MODEL_BC1A/BC3/BC5/BC7, BT.709 primaries, linear transfer,
+    // 4x4 blocks, then one sample per independently coded half of the block
+    const uint32_t models[] = { 128, 130, 132, 134 };
+    vector<uint32_t> samples; // (bit offset, bit length, channel) per sample
+    switch (format) {
+    case BLOCK_BC1: samples = { 0, 64, 0 }; break;
+    case BLOCK_BC3: samples = { 0, 64, 15, 64, 64, 0 }; break; // alpha block first, then color
+    case BLOCK_BC5: samples = { 0, 64, 0, 64, 64, 1 }; break;  // red, green
+    case BLOCK_BC7: samples = { 0, 128, 0 }; break;
+    }
+    uint32_t sampleCount = static_cast<uint32_t>(samples.size() / 3);
+    uint32_t blockSize = 24 + 16 * sampleCount;
+
+    vector<uint32_t> dfd;
+    dfd.push_back(4 + blockSize);
+    dfd.push_back(0);                    // Khronos vendor, basic descriptor type
+    dfd.push_back(2 | (blockSize << 16)); // version 1.3
+    dfd.push_back(models[format] | (1 << 8) | (1 << 16));
+    dfd.push_back(3 | (3 << 8));         // block dimensions minus one
+    dfd.push_back(BLOCK_FORMAT_BYTES[format]);
+    dfd.push_back(0);
+    for (uint32_t i = 0; i < sampleCount; ++i) {
+        dfd.push_back(samples[i * 3] | ((samples[i * 3 + 1] - 1) << 16) | (samples[i * 3 + 2] << 24));
+        dfd.push_back(0);
+        dfd.push_back(0);
+        dfd.push_back(0xFFFFFFFFu);
+    }
 
-    // Update the projection matrix
-    projection = glm::perspective(glm::radians(zoom), (float)WINDOW_WIDTH / (float)WINDOW_HEIGHT, 0.1f, 100.0f);
-}
+    uint32_t levelCount = static_cast<uint32_t>(levels.size());
+    uint32_t dfdOffset = 80 + levelCount * 24;
+    uint32_t dfdLength = static_cast<uint32_t>(dfd.size() * sizeof(uint32_t));
+    uint64_t alignment = BLOCK_FORMAT_BYTES[format];
 
-bool UInitialize(int argc, char* argv[], GLFWwindow** window) {
-    if (!glfwInit()) {
-        cout << "Failed to initialize GLFW" << endl;
-        return false;
+    vector<uint64_t> offsets(levelCount);
+    uint64_t end = dfdOffset + dfdLength;
+    for (uint32_t i = levelCount; i-- > 0;) {
+        offsets[i] = (end + alignment - 1) / alignment * alignment;
+        end = offsets[i] + levels[i].size();
     }
 
-    glfwWindowHint(GLFW_CONTEXT_VERSION_MAJOR, 4);
-    glfwWindowHint(GLFW_CONTEXT_VERSION_MINOR, 4);
-    glfwWindowHint(GLFW_OPENGL_PROFILE, GLFW_OPENGL_CORE_PROFILE);
+    vector<unsigned char> bytes(static_cast<size_t>(end), 0);
+    const unsigned char identifier[12] = { 0xAB, 'K', 'T', 'X', ' ', '2', '0', 0xBB, '\r', '\n', 0x1A, '\n' };
+    memcpy(bytes.data(), identifier, sizeof(identifier));
+    const uint32_t header[9] = { BLOCK_FORMAT_VK[format], 1, static_cast<uint32_t>(width), static_cast<uint32_t>(height), 0, 0, 1, levelCount, 0 };
+    memcpy(bytes.data() + 12, header, sizeof(header));
+    const uint32_t index[4] = { dfdOffset, dfdLength, 0, 0 }; // no key/value data
+    memcpy(bytes.data() + 48, index, sizeof(index));          // the supercompression data range stays zero
+    for (uint32_t i = 0; i < levelCount; ++i) {
+        const uint64_t entry[3] = { offsets[i], levels[i].size(), levels[i].size() };
+        memcpy(bytes.data() + 80 + i * 24, entry, sizeof(entry));
+        memcpy(bytes.data() + offsets[i], levels[i].data(), levels[i].size());
+    }
+    memcpy(bytes.data() + dfdOffset, dfd.data(), dfdLength);
 
-    *window = glfwCreateWindow(WINDOW_WIDTH, WINDOW_HEIGHT, WINDOW_TITLE, nullptr, nullptr);
-    if (*window == nullptr) {
-        cout << "Failed to create GLFW window" << endl;
-        glfwTerminate();
+    ofstream file(path, ios::binary);
+    if (!file) {
+        cout << "ERROR::KTX2::CANNOT_WRITE " << path << endl;
         return false;
     }
+    file.write(reinterpret_cast<const char*>(bytes.data()), bytes.size());
+    return static_cast<bool>(file);
+}
+
+// Function to find, for each of the 16 texels of a block, the nearest palette entry. channels holds the
+// block in SoA form (16 values per channel), palette holds channelCount values per entry.
+static void UNearestPaletteIndices(const float* channels, int channelCount, const float* palette, int paletteSize, int indices[16]) {
+#if defined(U_SIMD_AVX2) || defined(U_SIMD_SSE2)
+    for (int i = 0; i < 16; i += 4) {
+        __m128 best = _mm_set1_ps(FLT_MAX);
+        __m128i bestIndex = _mm_setzero_si128();
+        for (int entry = 0; entry < paletteSize; ++entry) {
+            __m128 distance = _mm_setzero_ps();
+            for (int c = 0; c < channelCount; ++c) {
+                __m128 delta = _mm_sub_ps(_mm_loadu_ps(channels + c * 16 + i), _mm_set1_ps(palette[entry * channelCount + c]));
+                distance = _mm_add_ps(distance, _mm_mul_ps(delta, delta));
+            }
+            __m128i closer = _mm_castps_si128(_mm_cmplt_ps(distance, best));
+            best = _mm_min_ps(best, distance);
+            bestIndex = _mm_or_si128(_mm_and_si128(closer, _mm_set1_epi32(entry)), _mm_andnot_si128(closer, bestIndex));
+        }
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(indices + i), bestIndex);
+    }
+#else
+    for (int i = 0; i < 16; ++i) {
+        float best = FLT_MAX;
+        for (int entry = 0; entry < paletteSize; ++entry) {
+            float distance = 0.0f;
+            for (int c = 0; c < channelCount; ++c) {
+                float delta = channels[c * 16 + i] - palette[entry * channelCount + c];
+                distance += delta * delta;
+            }
+            if (distance < best) {
+                best = distance;
+                indices[i] = entry;
+            }
+        }
+    }
+#endif
+}
 
-    glfwMakeContextCurrent(*window);
-    glfwSetFramebufferSizeCallback(*window, UResizeWindow);
+// Function to pick two endpoints spanning a block's colors: the corners of the bounding box, inset by
+// 1/16 of its size, taking the diagonal that follows how the channels vary together
+static void UBlockEndpoints(const unsigned char block[64], int channelCount, int low[4], int high[4]) {
+#if defined(U_SIMD_AVX2) || defined(U_SIMD_SSE2)
+    __m128i minimum = _mm_loadu_si128(reinterpret_cast<const __m128i*>(block));
+    __m128i maximum = minimum;
+    for (int i = 16; i < 64; i += 16) {
+        __m128i texels = _mm_loadu_si128(reinterpret_cast<const __m128i*>(block + i));
+        minimum = _mm_min_epu8(minimum, texels);
+        maximum = _mm_max_epu8(maximum, texels);
+    }
+    minimum = _mm_min_epu8(minimum, _mm_shuffle_epi32(minimum, _MM_SHUFFLE(1, 0, 3, 2)));
+    minimum = _mm_min_epu8(minimum, _mm_shuffle_epi32(minimum, _MM_SHUFFLE(2, 3, 0, 1)));
+    maximum = _mm_max_epu8(maximum, _mm_shuffle_epi32(maximum, _MM_SHUFFLE(1, 0, 3, 2)));
+    maximum = _mm_max_epu8(maximum, _mm_shuffle_epi32(maximum, _MM_SHUFFLE(2, 3, 0, 1)));
+    uint32_t minimumTexel = static_cast<uint32_t>(_mm_cvtsi128_si32(minimum));
+    uint32_t maximumTexel = static_cast<uint32_t>(_mm_cvtsi128_si32(maximum));
+    for (int c = 0; c < 4; ++c) {
+        low[c] = (minimumTexel >> (c * 8)) & 0xFF;
+        high[c] = (maximumTexel >> (c * 8)) & 0xFF;
+    }
+#else
+    for (int c = 0; c < 4; ++c) {
+        low[c] = 255;
+        high[c] = 0;
+    }
+    for (int i = 0; i < 16; ++i) {
+        for (int c = 0; c < 4; ++c) {
+            low[c] = min(low[c], static_cast<int>(block[i * 4 + c]));
+            high[c] = max(high[c], static_cast<int>(block[i * 4 + c]));
+        }
+    }
+#endif
 
-    glfwSetCursorPosCallback(*window, UMousePositionCallback);
-    glfwSetScrollCallback(*window, UMouseScrollCallback);
+    // Channels that fall while the widest one rises swap their ends
+    int widest = 0;
+    for (int c = 1; c < channelCount; ++c) {
+        if (high[c] - low[c] > high[widest] - low[widest])
+            widest = c;
+    }
+    float mean[4] = { 0.0f, 0.0f, 0.0f, 0.0f };
+    for (int i = 0; i < 16; ++i) {
+        for (int c = 0; c < channelCount; ++c)
+            mean[c] += block[i * 4 + c] / 16.0f;
+    }
+    for (int c = 0; c < channelCount; ++c) {
+        float covariance = 0.0f;
+        for (int i = 0; i < 16; ++i)
+            covariance += (block[i * 4 + c] - mean[c]) * (block[i * 4 + widest] - mean[widest]);
+
+        int inset = (high[c] - low[c]) / 16;
+        low[c] += inset;
+        high[c] -= inset;
+        if (covariance < 0.0f)
+            swap(low[c], high[c]);
+    }
+}
 
-    // set cursor mode to normal
-    // glfwSetInputMode(*window, GLFW_CURSOR, GLFW_CURSOR_NORMAL);
+// Function to convert a block to SoA floats for UNearestPaletteIndices
+static void UBlockChannels(const unsigned char block[64], int firstChannel, int channelCount, float* channels) {
+    for (int c = 0; c < channelCount; ++c) {
+        for (int i = 0; i < 16; ++i)
+            channels[c * 16 + i] = block[i * 4 + firstChannel + c];
+    }
+}
 
-    // enable capturing mouse cursor movement
-    glfwSetInputMode(*window, GLFW_CURSOR, GLFW_CURSOR_DISABLED);
+// Function to encode the RGB of a block as BC1: two RGB565 endpoints with c0 > c1, so the block uses
+// the four-color mode, and a 2-bit index per texel
+static void UEncodeBC1Block(const unsigned char block[64], unsigned char* output) {
+    int low[4], high[4];
+    UBlockEndpoints(block, 3, low, high);
+
+    uint16_t c0 = static_cast<uint16_t>(((high[0] * 31 + 127) / 255) << 11 | ((high[1] * 63 + 127) / 255) << 5 | ((high[2] * 31 + 127) / 255));
+    uint16_t c1 = static_cast<uint16_t>(((low[0] * 31 + 127) / 255) << 11 | ((low[1] * 63 + 127) / 255) << 5 | ((low[2] * 31 + 127) / 255));
+    if (c0 < c1)
+        swap(c0, c1);
+
+    uint32_t bits = 0;
+    if (c0 != c1) {
+        float palette[4 * 3];
+        const uint16_t endpoints[2] = { c0, c1 };
+        for (int e = 0; e < 2; ++e) {
+            int r = endpoints[e] >> 11, g = (endpoints[e] >> 5) & 63, b = endpoints[e] & 31;
+            palette[e * 3 + 0] = static_cast<float>((r << 3) | (r >> 2));
+            palette[e * 3 + 1] = static_cast<float>((g << 2) | (g >> 4));
+            palette[e * 3 + 2] = static_cast<float>((b << 3) | (b >> 2));
+        }
+        for (int c = 0; c < 3; ++c) {
+            palette[2 * 3 + c] = (2.0f * palette[c] + palette[3 + c]) / 3.0f;
+            palette[3 * 3 + c] = (palette[c] + 2.0f * palette[3 + c]) / 3.0f;
+        }
 
-    // register the scroll callback
-    glfwSetScrollCallback(*window, UMouseScrollCallback);
+        float channels[3 * 16];
+        int indices[16];
+        UBlockChannels(block, 0, 3, channels);
+        UNearestPaletteIndices(channels, 3, palette, 4, indices);
+        for (int i = 0; i < 16; ++i)
+            bits |= static_cast<uint32_t>(indices[i]) << (i * 2);
+    }
 
-    glewExperimental = GL_TRUE;
-    GLenum GlewInitResult = glewInit();
+    output[0] = c0 & 0xFF;
+    output[1] = c0 >> 8;
+    output[2] = c1 & 0xFF;
+    output[3] = c1 >> 8;
+    memcpy(output + 4, &bits, 4);
+}
 
-    if (GLEW_OK != GlewInitResult) {
-        cerr << glewGetErrorString(GlewInitResult) << endl;
-        return false;
+// Function to encode one channel of a block as BC4, the alpha half of BC3 and each half of BC5: two
+// 8-bit endpoints with a0 > a1, so the block uses the eight-value mode, and a 3-bit index per texel
+static void UEncodeBC4Block(const unsigned char block[64], int channel, unsigned char* output) {
+    int a0 = 0, a1 = 255;
+    for (int i = 0; i < 16; ++i) {
+        a0 = max(a0, static_cast<int>(block[i * 4 + channel]));
+        a1 = min(a1, static_cast<int>(block[i * 4 + channel]));
     }
 
-    cout << "INFO: OpenGL Version: " << glGetString(GL_VERSION) << endl;
+    uint64_t bits = 0;
+    if (a0 != a1) {
+        float palette[8] = { static_cast<float>(a0), static_cast<float>(a1) };
+        for (int k = 2; k < 8; ++k)
+            palette[k] = ((8 - k) * a0 + (k - 1) * a1) / 7.0f;
+
+        float channels[16];
+        int indices[16];
+        UBlockChannels(block, channel, 1, channels);
+        UNearestPaletteIndices(channels, 1, palette, 8, indices);
+        for (int i = 0; i < 16; ++i)
+            bits |= static_cast<uint64_t>(indices[i]) << (i * 3);
+    }
 
-    return true;
+    output[0] = static_cast<unsigned char>(a0);
+    output[1] = static_cast<unsigned char>(a1);
+    for (int i = 0; i < 6; ++i)
+        output[2 + i] = static_cast<unsigned char>(bits >> (i * 8));
 }
 
-void UResizeWindow(GLFWwindow* window, int width, int height) {
-    glViewport(0, 0, width, height);
+// Function to write a field least significant bit first into a BC7 block, advancing position
+static void UPutBlockBits(unsigned char* output, int& position, uint32_t value, int bits) {
+    for (int i = 0; i < bits; ++i, ++position) {
+        if (value & (1u << i))
+            output[position >> 3] |= static_cast<unsigned char>(1 << (position & 7));
+    }
 }
 
-// function for keys
-void UProcessInput(GLFWwindow* window) {
-
-    // Esc button
-    if (glfwGetKey(window, GLFW_KEY_ESCAPE) == GLFW_PRESS)
-        glfwSetWindowShouldClose(window, true);
-
-    // WASD keys to control the forward, backward, left, and right motion
-    if (glfwGetKey(window, GLFW_KEY_W) == GLFW_PRESS)
-        cameraPosition += cameraSpeed * cameraFront; // forward
-    if (glfwGetKey(window, GLFW_KEY_S) == GLFW_PRESS)
-        cameraPosition -= cameraSpeed * cameraFront; // backward
-    if (glfwGetKey(window, GLFW_KEY_A) == GLFW_PRESS)
-        cameraPosition -= glm::normalize(glm::cross(cameraFront, cameraUp)) * cameraSpeed; // left
-    if (glfwGetKey(window, GLFW_KEY_D) == GLFW_PRESS)
-        cameraPosition += glm::normalize(glm::cross(cameraFront, cameraUp)) * cameraSpeed; // right
+// Function to encode a block as BC7 mode 6: one subset, RGBA endpoints of 7 bits plus a shared low bit
+// per endpoint, and a 4-bit index per texel. The other modes' partitions are not searched; mode 6
+// alone already beats BC3 on smooth content.
+static void UEncodeBC7Block(const unsigned char block[64], unsigned char* output) {
+    static const int weights[16] = { 0, 4, 9, 13, 17, 21, 26, 30, 34, 38, 43, 47, 51, 55, 60, 64 };
+    int endpoints[2][4];
+    UBlockEndpoints(block, 4, endpoints[0], endpoints[1]);
+
+    // Each endpoint keeps 7 bits per channel; its p-bit becomes the low bit of all four, so pick the one
+    // that lands closer
+    int quantized[2][4];
+    int pbits[2];
+    for (int e = 0; e < 2; ++e) {
+        int bestError = INT32_MAX;
+        for (int p = 0; p < 2; ++p) {
+            int error = 0;
+            int candidate[4];
+            for (int c = 0; c < 4; ++c) {
+                candidate[c] = glm::clamp((endpoints[e][c] - p + 1) >> 1, 0, 127);
+                int value = (candidate[c] << 1) | p;
+                error += (value - endpoints[e][c]) * (value - endpoints[e][c]);
+            }
+            if (error < bestError) {
+                bestError = error;
+                pbits[e] = p;
+                memcpy(quantized[e], candidate, sizeof(candidate));
+            }
+        }
+    }
 
-    if (glfwGetKey(window, GLFW_KEY_W) == GLFW_PRESS)
-        cout << "W key pressed" << endl;
-    if (glfwGetKey(window, GLFW_KEY_S) == GLFW_PRESS)
-        cout << "S key pressed" << endl;
+    float palette[16 * 4];
+    for (int k = 0; k < 16; ++k) {
+        for (int c = 0; c < 4; ++c) {
+            int e0 = (quantized[0][c] << 1) | pbits[0];
+            int e1 = (quantized[1][c] << 1) | pbits[1];
+            palette[k * 4 + c] = static_cast<float>(((64 - weights[k]) * e0 + weights[k] * e1 + 32) >> 6);
+        }
+    }
 
-    // QE keys for upward and downward movement
-    if (glfwGetKey(window, GLFW_KEY_Q) == GLFW_PRESS)
-        cameraPosition += cameraSpeed * cameraUp; // upward
-    if (glfwGetKey(window, GLFW_KEY_E) == GLFW_PRESS)
-        cameraPosition -= cameraSpeed * cameraUp; // downward
+    float channels[4 * 16];
+    int indices[16];
+    UBlockChannels(block, 0, 4, channels);
+    UNearestPaletteIndices(channels, 4, palette, 16, indices);
+
+    // The first texel's index is stored without its top bit, so it must be below 8
+    if (indices[0] >= 8) {
+        for (int c = 0; c < 4; ++c)
+            swap(quantized[0][c], quantized[1][c]);
+        swap(pbits[0], pbits[1]);
+        for (int i = 0; i < 16; ++i)
+            indices[i] = 15 - indices[i];
+    }
 
-    // Toggle between perspective and orthographic views with the "P" key
-    if (glfwGetKey(window, GLFW_KEY_P) == GLFW_PRESS) {
-        usePerspective = !usePerspective;
+    memset(output, 0, 16);
+    int position = 0;
+    UPutBlockBits(output, position, 1 << 6, 7); // mode 6
+    for (int c = 0; c < 4; ++c) {
+        UPutBlockBits(output, position, quantized[0][c], 7);
+        UPutBlockBits(output, position, quantized[1][c], 7);
     }
+    UPutBlockBits(output, position, pbits[0], 1);
+    UPutBlockBits(output, position, pbits[1], 1);
+    UPutBlockBits(output, position, indices[0], 3);
+    for (int i = 1; i < 16; ++i)
+        UPutBlockBits(output, position, indices[i], 4);
 }
 
-void UCreateMesh(GLMesh& mesh, GLfloat* vertices, GLushort* indices, int vertexCount, int indexCount) {
-    const GLuint floatsPerVertex = 3;
-    const GLuint floatsPerColor = 4;
+// Function to halve an RGBA8 image with a 2x2 box filter; odd edges reuse their last row or column
+static void UDownsampleImage(const vector<unsigned char>& source, int width, int height, vector<unsigned char>& destination) {
+    int halfWidth = max(width / 2, 1);
+    int halfHeight = max(height / 2, 1);
+    destination.resize(static_cast<size_t>(halfWidth) * halfHeight * 4);
+    for (int y = 0; y < halfHeight; ++y) {
+        int y0 = min(y * 2, height - 1), y1 = min(y * 2 + 1, height - 1);
+        for (int x = 0; x < halfWidth; ++x) {
+            int x0 = min(x * 2, width - 1), x1 = min(x * 2 + 1, width - 1);
+            for (int c = 0; c < 4; ++c) {
+                int sum = source[(y0 * width + x0) * 4 + c] + source[(y0 * width + x1) * 4 + c] +
+                    source[(y1 * width + x0) * 4 + c] + source[(y1 * width + x1) * 4 + c];
+                destination[(y * halfWidth + x) * 4 + c] = static_cast<unsigned char>((sum + 2) / 4);
+            }
+        }
+    }
+}
 
-    glGenVertexArrays(1, &mesh.vao);
-    glBindVertexArray(mesh.vao);
+// Function to bake a PNG/JPEG into a block-compressed KTX2 file with a full mip chain. Each level's
+// block rows are encoded in parallel on the worker pool.
+bool UBakeTexture(const string& input, const string& output, const string& formatName) {
+    U_PROFILE_FUNCTION();
+    chrono::steady_clock::time_point start = chrono::steady_clock::now();
 
-    glGenBuffers(2, mesh.vbos);
-    glBindBuffer(GL_ARRAY_BUFFER, mesh.vbos[0]);
-    glBufferData(GL_ARRAY_BUFFER, vertexCount * (floatsPerVertex + floatsPerColor) * sizeof(GLfloat), vertices, GL_STATIC_DRAW);
+    int width, height, channels;
+    unsigned char* pixels = stbi_load(input.c_str(), &width, &height, &channels, 4);
+    if (!pixels) {
+        cout << "ERROR::BAKE::CANNOT_LOAD " << input << endl;
+        return false;
+    }
+    vector<unsigned char> image(pixels, pixels + static_cast<size_t>(width) * height * 4);
+    stbi_image_free(pixels);
+
+    BlockFormat format = channels == 4 ? BLOCK_BC3 : BLOCK_BC1;
+    if (!formatName.empty()) {
+        int match = -1;
+        for (int i = 0; i < 4; ++i) {
+            if (formatName == BLOCK_FORMAT_NAMES[i])
+                match = i;
+        }
+        if (match < 0) {
+            cout << "ERROR::BAKE::UNKNOWN_FORMAT " << formatName << " (bc1, bc3, bc5 or bc7)" << endl;
+            return false;
+        }
+        format = static_cast<BlockFormat>(match);
+    }
+    const int blockBytes = BLOCK_FORMAT_BYTES[format];
+
+    vector<vector<unsigned char> > levels;
+    int levelWidth = width, levelHeight = height;
+    for (;;) {
+        int blocksX = (levelWidth + 3) / 4;
+        int blocksY = (levelHeight + 3) / 4;
+        levels.push_back(vector<unsigned char>(static_cast<size_t>(blocksX) * blocksY * blockBytes));
+        unsigned char* blocks = levels.back().data();
+
+        URunParallel(gWorkerPool, blocksY, [&](int by, int) {
+            U_PROFILE_SCOPE("encode block row");
+            unsigned char block[64];
+            for (int bx = 0; bx < blocksX; ++bx) {
+                // Blocks hanging over the edge repeat the last row and column
+                for (int i = 0; i < 16; ++i) {
+                    int x = min(bx * 4 + (i & 3), levelWidth - 1);
+                    int y = min(by * 4 + (i >> 2), levelHeight - 1);
+                    memcpy(block + i * 4, &image[(static_cast<size_t>(y) * levelWidth + x) * 4], 4);
+                }
+
+                unsigned char* destination = blocks + (static_cast<size_t>(by) * blocksX + bx) * blockBytes;
+                switch (format) {
+                case BLOCK_BC1:
+                    UEncodeBC1Block(block, destination);
+                    break;
+                case BLOCK_BC3:
+                    UEncodeBC4Block(block, 3, destination);
+                    UEncodeBC1Block(block, destination + 8);
+                    break;
+                case BLOCK_BC5:
+                    UEncodeBC4Block(block, 0, destination);
+                    UEncodeBC4Block(block, 1, destination + 8);
+                    break;
+                case BLOCK_BC7:
+                    UEncodeBC7Block(block, destination);
+                    break;
+                }
+            }
+        });
+
+        if (levelWidth == 1 && levelHeight == 1)
+            break;
+        vector<unsigned char> half;
+        UDownsampleImage(image, levelWidth, levelHeight, half);
+        image.swap(half);
+        levelWidth = max(levelWidth / 2, 1);
+        levelHeight = max(levelHeight / 2, 1);
+    }
 
-    mesh.nIndices = indexCount;
-    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, mesh.vbos[1]);
-    glBufferData(GL_ELEMENT_ARRAY_BUFFER, indexCount * sizeof(GLushort), indices, GL_STATIC_DRAW);
+    if (!UWriteKtx2(output, format, width, height, levels))
+        return false;
 
-    GLint stride = sizeof(GLfloat) * (floatsPerVertex + floatsPerColor);
-    glVertexAttribPointer(0, floatsPerVertex, GL_FLOAT, GL_FALSE, stride, 0);
-    glEnableVertexAttribArray(0);
+    size_t bakedBytes = 0;
+    for (size_t i = 0; i < levels.size(); ++i)
+        bakedBytes += levels[i].size();
+    cout << "INFO: baked " << input << " (" << width << "x" << height << ", " << levels.size() << " levels) to " << output
+        << " as " << BLOCK_FORMAT_NAMES[format] << ": " << bakedBytes / 1024 << " KiB, "
+        << chrono::duration<double, milli>(chrono::steady_clock::now() - start).count() << " ms on "
+        << gWorkerPool.threads.size() + 1 << " threads" << endl;
+    return true;
+}
 
-    // Update this part for texture coordinates
-    glVertexAttribPointer(1, 2, GL_FLOAT, GL_FALSE, stride, (char*)(sizeof(GLfloat) * floatsPerVertex));
-    glEnableVertexAttribArray(1);
+// Function to lay out a packed texture's mip levels in the mapping. Fails unless the dimensions and
+// level count make a possible mip chain, the format is one the loader uploads with its matching
+// texel or block size, and the levels fit inside the entry's section.
+static bool UPackedTextureLevels(const AssetPack& pack, const PackEntry& entry, vector<TextureLevel>& levels) {
+    levels.clear();
+    if (entry.width == 0 || entry.height == 0 || entry.width > PACK_MAX_TEXTURE_SIZE || entry.height > PACK_MAX_TEXTURE_SIZE)
+        return false;
+    int width = static_cast<int>(entry.width);
+    int height = static_cast<int>(entry.height);
+    uint32_t maxLevels = 1;
+    while ((max(width, height) >> maxLevels) > 0)
+        maxLevels++;
+    if (entry.levelCount == 0 || entry.levelCount > maxLevels)
+        return false;
 
-    glVertexAttribPointer(2, floatsPerColor, GL_FLOAT, GL_FALSE, stride, (char*)(sizeof(GLfloat) * (floatsPerVertex + 2))); // Offset by 2 floats
-    glEnableVertexAttribArray(2);
-}
+    bool known;
+    switch (entry.format) {
+    case 0:
+        known = ((entry.internalFormat == GL_COMPRESSED_RGB_S3TC_DXT1_EXT || entry.internalFormat == GL_COMPRESSED_RGBA_S3TC_DXT1_EXT) && entry.texelBytes == 8) ||
+            ((entry.internalFormat == GL_COMPRESSED_RGBA_S3TC_DXT5_EXT || entry.internalFormat == GL_COMPRESSED_RG_RGTC2 ||
+                entry.internalFormat == GL_COMPRESSED_RGBA_BPTC_UNORM) && entry.texelBytes == 16);
+        break;
+    case GL_RGB: known = entry.internalFormat == GL_RGB8 && entry.texelBytes == 3; break;
+    case GL_RGBA: known = entry.internalFormat == GL_RGBA8 && entry.texelBytes == 4; break;
+    default: known = false; break;
+    }
+    if (!known)
+        return false;
 
-void UDestroyMesh(GLMesh& mesh) {
-    glDeleteVertexArrays(1, &mesh.vao);
-    glDeleteBuffers(2, mesh.vbos);
+    uint64_t used = 0;
+    for (uint32_t i = 0; i < entry.levelCount; ++i) {
+        TextureLevel level;
+        level.width = max(width >> i, 1);
+        level.height = max(height >> i, 1);
+        level.rowHeight = entry.format ? 1 : 4;
+        level.rowBytes = static_cast<GLsizeiptr>(entry.format ? level.width : (level.width + 3) / 4) * entry.texelBytes;
+        level.rows = (level.height + level.rowHeight - 1) / level.rowHeight;
+        // Compared by division so a huge level cannot wrap the running total
+        if (static_cast<uint64_t>(level.rowBytes) > (entry.size - used) / level.rows)
+            return false;
+        level.data = pack.data + entry.offset + used;
+        used += static_cast<uint64_t>(level.rowBytes) * level.rows;
+        levels.push_back(level);
+    }
+    return true;
 }
 
-bool UCreateShaderProgram(const char* vtxShaderSource, const char* fragShaderSource, GLuint& programId) {
-    int success = 0;
-    char infoLog[512];
+static GLsizeiptr UIndexSize(GLenum indexType);
+static glm::mat4 UDequantizeMatrix(const GLMesh& mesh);
+static void UUploadMeshLod(GLMeshLod& lod, const void* vertices, GLsizei vertexCount, const void* indices, GLsizei indexCount, GLenum indexType,
+    const GLMeshlet* meshlets, int meshletCount);
 
-    programId = glCreateProgram();
-    GLuint vertexShaderId = glCreateShader(GL_VERTEX_SHADER);
-    GLuint fragmentShaderId = glCreateShader(GL_FRAGMENT_SHADER);
+// Function to check a packed mesh level: its format is known, its meshlets, vertices and indices fit
+// its section, and every meshlet's triangles lie in the level's indices and address only the level's
+// vertices from the meshlet's base vertex
+static bool UCheckPackedMeshLod(const AssetPack& pack, const PackEntry& entry) {
+    if (entry.vertexFormat > VERTEX_HALF || (entry.indexType != GL_UNSIGNED_SHORT && entry.indexType != GL_UNSIGNED_INT) || entry.meshletCount == 0)
+        return false;
+    uint64_t meshletBytes = static_cast<uint64_t>(entry.meshletCount) * sizeof(GLMeshlet);
+    uint64_t vertexBytes = static_cast<uint64_t>(entry.vertexCount) * VERTEX_FORMAT_STRIDES[entry.vertexFormat];
+    uint64_t indexBytes = static_cast<uint64_t>(entry.indexCount) * UIndexSize(entry.indexType);
+    if (meshletBytes + vertexBytes + indexBytes > entry.size)
+        return false;
 
-    glShaderSource(vertexShaderId, 1, &vtxShaderSource, NULL);
-    glShaderSource(fragmentShaderId, 1, &fragShaderSource, NULL);
+    const GLMeshlet* meshlets = reinterpret_cast<const GLMeshlet*>(pack.data + entry.offset);
+    const unsigned char* indices = pack.data + entry.offset + meshletBytes + vertexBytes;
+    for (uint32_t m = 0; m < entry.meshletCount; ++m) {
+        const GLMeshlet& meshlet = meshlets[m];
+        if (meshlet.nIndices % 3 != 0 || static_cast<uint64_t>(meshlet.firstIndex) + meshlet.nIndices > entry.indexCount ||
+            meshlet.baseVertex < 0 || static_cast<uint32_t>(meshlet.baseVertex) > entry.vertexCount)
+            return false;
+        uint32_t reachable = entry.vertexCount - meshlet.baseVertex;
+        for (GLuint i = meshlet.firstIndex; i < meshlet.firstIndex + meshlet.nIndices; ++i) {
+            GLuint index;
+            if (entry.indexType == GL_UNSIGNED_INT)
+                memcpy(&index, indices + i * sizeof(GLuint), sizeof(GLuint));
+            else {
+                GLushort shortIndex;
+                memcpy(&shortIndex, indices + i * sizeof(GLushort), sizeof(GLushort));
+                index = shortIndex;
+            }
+            if (index >= reachable)
+                return false;
+        }
+    }
+    return true;
+}
 
-    glCompileShader(vertexShaderId);
-    glGetShaderiv(vertexShaderId, GL_COMPILE_STATUS, &success);
-    if (!success) {
-        glGetShaderInfoLog(vertexShaderId, 512, NULL, infoLog);
-        cout << "ERROR::SHADER::VERTEX::COMPILATION_FAILED\n" << infoLog << endl;
+// Function to map an asset pack and check its table of contents: every section lies inside the file,
+// texture levels fit their sections and mesh indices stay below their vertex counts, so nothing
+// uploaded from it reads past the mapping or past the vertices
+bool UOpenAssetPack(AssetPack& pack, const string& path) {
+    U_PROFILE_FUNCTION();
+    pack.data = nullptr;
+    pack.size = 0;
+    pack.entries = nullptr;
+    pack.entryCount = 0;
+#if defined(_WIN32)
+    pack.mapping = nullptr;
+    pack.file = CreateFileA(path.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+    LARGE_INTEGER size;
+    if (pack.file == INVALID_HANDLE_VALUE || !GetFileSizeEx(pack.file, &size)) {
+        cout << "ERROR::PACK::CANNOT_OPEN " << path << endl;
+        UCloseAssetPack(pack);
         return false;
     }
-
-    glCompileShader(fragmentShaderId);
-    glGetShaderiv(fragmentShaderId, GL_COMPILE_STATUS, &success);
-    if (!success) {
-        glGetShaderInfoLog(fragmentShaderId, sizeof(infoLog), NULL, infoLog);
-        cout << "ERROR::SHADER::FRAGMENT::COMPILATION_FAILED\n" << infoLog << endl;
+    pack.size = static_cast<size_t>(size.QuadPart);
+    pack.mapping = CreateFileMappingA(pack.file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+    if (pack.mapping)
+        pack.data = static_cast<const unsigned char*>(MapViewOfFile(pack.mapping, FILE_MAP_READ, 0, 0, 0));
+#else
+    pack.file = open(path.c_str(), O_RDONLY);
+    struct stat status;
+    if (pack.file < 0 || fstat(pack.file, &status) != 0) {
+        cout << "ERROR::PACK::CANNOT_OPEN " << path << endl;
+        UCloseAssetPack(pack);
+        return false;
+    }
+    pack.size = static_cast<size_t>(status.st_size);
+    void* mapped = mmap(nullptr, pack.size, PROT_READ, MAP_PRIVATE, pack.file, 0);
+    if (mapped != MAP_FAILED)
+        pack.data = static_cast<const unsigned char*>(mapped);
+#endif
+    if (!pack.data) {
+        cout << "ERROR::PACK::CANNOT_MAP " << path << endl;
+        UCloseAssetPack(pack);
         return false;
     }
 
-    glAttachShader(programId, vertexShaderId);
-    glAttachShader(programId, fragmentShaderId);
-
-    glLinkProgram(programId);
-    glGetProgramiv(programId, GL_LINK_STATUS, &success);
-    if (!success) {
-        glGetProgramInfoLog(programId, sizeof(infoLog), NULL, infoLog);
-        cout << "ERROR::SHADER::PROGRAM::LINKING_FAILED\n" << infoLog << endl;
+    PackHeader header;
+    if (pack.size >= sizeof(header))
+        memcpy(&header, pack.data, sizeof(header));
+    if (pack.size < sizeof(header) || header.magic != PACK_MAGIC || header.version != PACK_VERSION ||
+        (pack.size - sizeof(header)) / sizeof(PackEntry) < header.entryCount) {
+        cout << "ERROR::PACK::BAD_HEADER " << path << endl;
+        UCloseAssetPack(pack);
         return false;
     }
+    pack.entries = reinterpret_cast<const PackEntry*>(pack.data + sizeof(header));
+    pack.entryCount = header.entryCount;
+
+    vector<TextureLevel> levels;
+    for (uint32_t i = 0; i < pack.entryCount; ++i) {
+        const PackEntry& entry = pack.entries[i];
+        bool fits = entry.offset <= pack.size && entry.size <= pack.size - entry.offset && entry.offset % PACK_ALIGNMENT == 0;
+        if (fits && entry.type == PACK_MESH_LOD)
+            fits = UCheckPackedMeshLod(pack, entry);
+        if (fits && entry.type == PACK_TEXTURE)
+            fits = UPackedTextureLevels(pack, entry, levels);
+        if (!fits || entry.name[sizeof(entry.name) - 1] != '\0') {
+            cout << "ERROR::PACK::BAD_ENTRY " << i << endl;
+            UCloseAssetPack(pack);
+            return false;
+        }
+    }
 
-    glUseProgram(programId);
+    cout << "INFO: mapped asset pack " << path << " (" << pack.entryCount << " entries, " << pack.size / 1024 << " KiB)" << endl;
     return true;
 }
 
-void UDestroyShaderProgram(GLuint programId) {
-    glDeleteProgram(programId);
+void UCloseAssetPack(AssetPack& pack) {
+    U_PROFILE_FUNCTION();
+#if defined(_WIN32)
+    if (pack.data)
+        UnmapViewOfFile(pack.data);
+    if (pack.mapping)
+        CloseHandle(pack.mapping);
+    if (pack.file != INVALID_HANDLE_VALUE && pack.file)
+        CloseHandle(pack.file);
+    pack.file = nullptr;
+    pack.mapping = nullptr;
+#else
+    if (pack.data)
+        munmap(const_cast<unsigned char*>(pack.data), pack.size);
+    if (pack.file >= 0)
+        close(pack.file);
+    pack.file = -1;
+#endif
+    pack.data = nullptr;
+    pack.size = 0;
+    pack.entries = nullptr;
+    pack.entryCount = 0;
 }
 
-void URender() {
-    glEnable(GL_DEPTH_TEST);
-    glClearColor(0.0f, 0.0f, 0.0f, 1.0f);
-    glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+// Function to find an entry by name, type and, for mesh sections, level of detail
+static const PackEntry* UFindPackEntry(const AssetPack& pack, const char* name, PackEntryType type, uint32_t level) {
+    for (uint32_t i = 0; i < pack.entryCount; ++i) {
+        const PackEntry& entry = pack.entries[i];
+        if (entry.type == static_cast<uint32_t>(type) && entry.level == level && strcmp(entry.name, name) == 0)
+            return &entry;
+    }
+    return nullptr;
+}
 
-    glm::mat4 projection;
-    if (usePerspective) {
-        // Perspective projection
-        projection = glm::perspective(glm::radians(zoom), (float)WINDOW_WIDTH / (float)WINDOW_HEIGHT, 0.1f, 100.0f);
+// Function to create a mesh and its levels of detail from a pack. The levels were stored as the
+// geometry pool holds them, so their vertices and indices go straight from the mapping to the upload;
+// only the meshlet table is copied, into the pool's list. The pack must have been written with the
+// vertex format in use.
+bool ULoadPackedMesh(const AssetPack& pack, const char* name, GLMesh& mesh) {
+    U_PROFILE_FUNCTION();
+    const PackEntry* first = UFindPackEntry(pack, name, PACK_MESH_LOD, 0);
+    if (!first) {
+        cout << "ERROR::PACK::MISSING_MESH " << name << endl;
+        return false;
     }
-    else {
-        // Orthographic projection
-        float orthoSize = 3.0f;  // Adjust the size as needed
-        projection = glm::ortho(-orthoSize, orthoSize, -orthoSize, orthoSize, 0.1f, 100.0f);
+    if (first->vertexFormat != static_cast<uint32_t>(gVertexFormat)) {
+        cout << "ERROR::PACK::VERTEX_FORMAT " << name << " is stored as " << VERTEX_FORMAT_NAMES[first->vertexFormat] << endl;
+        return false;
     }
 
-    //glm::mat4 projection = glm::perspective(glm::radians(zoom), (float)WINDOW_WIDTH / (float)WINDOW_HEIGHT, 0.1f, 100.0f);
-    glm::mat4 view = glm::lookAt(cameraPosition, cameraPosition + cameraFront, cameraUp); // Updated view matrix
-    glm::mat4 model = glm::mat4(1.0f);
+    mesh.vao = gGeometryPool.vao;
+    mesh.lodCount = 0;
+    mesh.boundsMin = glm::vec3(first->boundsMin[0], first->boundsMin[1], first->boundsMin[2]);
+    mesh.boundsMax = glm::vec3(first->boundsMax[0], first->boundsMax[1], first->boundsMax[2]);
+    mesh.sphereCenter = (mesh.boundsMin + mesh.boundsMax) * 0.5f;
+    mesh.sphereRadius = first->sphereRadius;
+    mesh.color = glm::vec4(first->color[0], first->color[1], first->color[2], first->color[3]);
+    mesh.vertexColors = first->vertexColors != 0;
+    mesh.dequantize = UDequantizeMatrix(mesh);
+
+    for (uint32_t level = 0; level < MAX_MESH_LODS; ++level) {
+        const PackEntry* entry = UFindPackEntry(pack, name, PACK_MESH_LOD, level);
+        if (!entry || entry->vertexFormat != first->vertexFormat)
+            break;
+
+        const unsigned char* section = pack.data + entry->offset;
+        const unsigned char* vertices = section + entry->meshletCount * sizeof(GLMeshlet);
+        const unsigned char* indices = vertices + static_cast<size_t>(entry->vertexCount) * VERTEX_FORMAT_STRIDES[entry->vertexFormat];
+        GLMeshLod& lod = mesh.lods[mesh.lodCount++];
+        UUploadMeshLod(lod, vertices, entry->vertexCount, indices, entry->indexCount, entry->indexType,
+            reinterpret_cast<const GLMeshlet*>(section), entry->meshletCount);
+        lod.error = entry->lodError;
+    }
+    return true;
+}
 
-    glm::mat4 modelViewProjection = projection * view * model;
+// Function to request a texture from a pack. Its levels are already in their upload format and were
+// checked when the pack was opened, so the request skips decoding and its rows are copied from the
+// mapping into the pixel stream as the budget allows. A missing texture keeps the placeholder.
+GLuint URequestPackedTexture(TextureLoader& loader, const AssetPack& pack, const char* name) {
+    U_PROFILE_FUNCTION();
+    unique_ptr<TextureRequest> request = UNewTextureRequest(name);
+    GLuint texture = request->texture;
+
+    const PackEntry* entry = UFindPackEntry(pack, name, PACK_TEXTURE, 0);
+    if (!entry || !UPackedTextureLevels(pack, *entry, request->levels)) {
+        cout << "ERROR::PACK::MISSING_TEXTURE " << name << endl;
+        request->levels.clear();
+        request->state = TEXTURE_FAILED;
+    }
+    else {
+        request->internalFormat = entry->internalFormat;
+        request->format = entry->format;
+        request->state = TEXTURE_DECODED;
+    }
+    lock_guard<mutex> lock(loader.lock);
+    loader.requests.push_back(move(request));
+    return texture;
+}
 
-    // Set light source properties
-    glm::vec3 lightDirection(-0.5f, -0.5f, -0.5f); // light direction
-    glm::vec3 lightColor(1.0f, 1.0f, 0.0f);       // yellow light color
-    float ambientStrength = 0.3f;                // Adjust ambient strength 
+// Function to append a section to a pack being written and return its entry
+static PackEntry& UAddPackSection(AssetPackWriter& writer, const char* name, PackEntryType type, uint64_t size) {
+    PackEntry entry;
+    memset(&entry, 0, sizeof(entry));
+    memcpy(entry.name, name, min(strlen(name), sizeof(entry.name) - 1));
+    entry.type = type;
+    entry.offset = (writer.data.size() + PACK_ALIGNMENT - 1) / PACK_ALIGNMENT * PACK_ALIGNMENT;
+    entry.size = size;
+    writer.data.resize(static_cast<size_t>(entry.offset + size), 0);
+    writer.entries.push_back(entry);
+    return writer.entries.back();
+}
 
-    // Set the light source properties as uniforms
-    glUniform3fv(glGetUniformLocation(gProgramId, "lightDirection"), 1, glm::value_ptr(lightDirection));
-    glUniform3fv(glGetUniformLocation(gProgramId, "lightColor"), 1, glm::value_ptr(lightColor));
-    glUniform1f(glGetUniformLocation(gProgramId, "ambientStrength"), ambientStrength);
+// Function to record one level of the mesh being captured, called with exactly what the level uploads
+// to the geometry pool: encoded vertices, final indices and meshlets relative to the level
+static void UCapturePackedMeshLod(AssetPackWriter& writer, const void* vertices, GLsizei vertexCount, const void* indices, GLsizei indexCount,
+    GLenum indexType, const GLMeshlet* meshlets, int meshletCount) {
+    uint32_t level = 0;
+    for (size_t i = 0; i < writer.entries.size(); ++i) {
+        if (writer.entries[i].type == PACK_MESH_LOD && writer.meshName == writer.entries[i].name)
+            level++;
+    }
 
-    // Draw the cube
-    glm::mat4 modelCube = glm::mat4(1.0f);
-    glUseProgram(gProgramId);
-    GLint modelLoc = glGetUniformLocation(gProgramId, "model");
-    GLint viewLoc = glGetUniformLocation(gProgramId, "view");
-    GLint projLoc = glGetUniformLocation(gProgramId, "projection");
+    size_t meshletBytes = static_cast<size_t>(meshletCount) * sizeof(GLMeshlet);
+    size_t vertexBytes = static_cast<size_t>(vertexCount) * VERTEX_FORMAT_STRIDES[gVertexFormat];
+    size_t indexBytes = static_cast<size_t>(indexCount) * UIndexSize(indexType);
+    PackEntry& entry = UAddPackSection(writer, writer.meshName.c_str(), PACK_MESH_LOD, meshletBytes + vertexBytes + indexBytes);
+    entry.level = level;
+    entry.vertexCount = vertexCount;
+    entry.indexCount = indexCount;
+    entry.vertexFormat = gVertexFormat;
+    entry.indexType = indexType;
+    entry.meshletCount = meshletCount;
+    unsigned char* section = &writer.data[static_cast<size_t>(entry.offset)];
+    memcpy(section, meshlets, meshletBytes);
+    memcpy(section + meshletBytes, vertices, vertexBytes);
+    memcpy(section + meshletBytes + vertexBytes, indices, indexBytes);
+}
 
-    glUniformMatrix4fv(modelLoc, 1, GL_FALSE, glm::value_ptr(modelCube));
-    glUniformMatrix4fv(viewLoc, 1, GL_FALSE, glm::value_ptr(view));
-    glUniformMatrix4fv(projLoc, 1, GL_FALSE, glm::value_ptr(projection));
+// Function to name the mesh whose levels are captured next
+void UBeginPackedMesh(AssetPackWriter& writer, const char* name) {
+    writer.meshName = name;
+}
 
-    glBindVertexArray(gCubeMesh.vao);
+// Function to finish capturing a mesh: generators set each level's error after creating it and later
+// levels can add vertex colors, so the errors and the mesh's own fields are copied from the finished mesh
+void UEndPackedMesh(AssetPackWriter& writer, const GLMesh& mesh) {
+    for (size_t i = 0; i < writer.entries.size(); ++i) {
+        PackEntry& entry = writer.entries[i];
+        if (entry.type != PACK_MESH_LOD || writer.meshName != entry.name || static_cast<int>(entry.level) >= mesh.lodCount)
+            continue;
+        entry.lodError = mesh.lods[entry.level].error;
+        entry.vertexColors = mesh.vertexColors;
+        for (int c = 0; c < 3; ++c) {
+            entry.boundsMin[c] = mesh.boundsMin[c];
+            entry.boundsMax[c] = mesh.boundsMax[c];
+        }
+        entry.sphereRadius = mesh.sphereRadius;
+        for (int c = 0; c < 4; ++c)
+            entry.color[c] = mesh.color[c];
+    }
+    writer.meshName.clear();
+}
+
+// Function to add a texture to a pack: baked .ktx2 files keep their blocks and mip chain, PNG/JPEG
+// images are stored decoded as a single level
+bool UPackTexture(AssetPackWriter& writer, const char* name, const string& filename) {
+    U_PROFILE_FUNCTION();
+    vector<TextureLevel> levels;
+    vector<unsigned char> file;
+    unsigned char* pixels = nullptr;
+    GLenum internalFormat, format = 0;
+    int width, height, texelBytes;
+
+    if (filename.size() > 5 && filename.compare(filename.size() - 5, 5, ".ktx2") == 0) {
+        ifstream stream(filename, ios::binary);
+        file.assign(istreambuf_iterator<char>(stream), istreambuf_iterator<char>());
+        if (!ULoadKtx2(file, internalFormat, width, height, levels))
+            return false;
+        texelBytes = static_cast<int>(levels[0].rowBytes / ((width + 3) / 4));
+    }
+    else {
+        int channels;
+        pixels = stbi_load(filename.c_str(), &width, &height, &channels, 0);
+        if (!pixels || (channels != 3 && channels != 4)) {
+            cout << "ERROR::PACK::CANNOT_LOAD " << filename << endl;
+            stbi_image_free(pixels);
+            return false;
+        }
+        internalFormat = channels == 3 ? GL_RGB8 : GL_RGBA8;
+        format = channels == 3 ? GL_RGB : GL_RGBA;
+        texelBytes = channels;
+        TextureLevel level = { pixels, width, height, static_cast<GLsizeiptr>(width) * channels, 1, height };
+        levels.push_back(level);
+    }
+
+    size_t size = 0;
+    for (size_t i = 0; i < levels.size(); ++i)
+        size += static_cast<size_t>(levels[i].rowBytes) * levels[i].rows;
+    PackEntry& entry = UAddPackSection(writer, name, PACK_TEXTURE, size);
+    entry.width = width;
+    entry.height = height;
+    entry.levelCount = static_cast<uint32_t>(levels.size());
+    entry.internalFormat = internalFormat;
+    entry.format = format;
+    entry.texelBytes = texelBytes;
+
+    size_t offset = static_cast<size_t>(entry.offset);
+    for (size_t i = 0; i < levels.size(); ++i) {
+        size_t levelBytes = static_cast<size_t>(levels[i].rowBytes) * levels[i].rows;
+        memcpy(&writer.data[offset], levels[i].data, levelBytes);
+        offset += levelBytes;
+    }
+    if (pixels)
+        stbi_image_free(pixels);
+    return true;
+}
+
+// Function to write a pack: the header and table of contents, then the sections, moved past them
+bool UWriteAssetPack(const AssetPackWriter& writer, const string& path) {
+    U_PROFILE_FUNCTION();
+    PackHeader header = { PACK_MAGIC, PACK_VERSION, static_cast<uint32_t>(writer.entries.size()), 0 };
+    uint64_t tableBytes = sizeof(header) + writer.entries.size() * sizeof(PackEntry);
+    uint64_t dataStart = (tableBytes + PACK_ALIGNMENT - 1) / PACK_ALIGNMENT * PACK_ALIGNMENT;
+
+    vector<PackEntry> entries = writer.entries;
+    for (size_t i = 0; i < entries.size(); ++i)
+        entries[i].offset += dataStart;
+
+    ofstream file(path, ios::binary);
+    if (!file) {
+        cout << "ERROR::PACK::CANNOT_WRITE " << path << endl;
+        return false;
+    }
+    const char padding[PACK_ALIGNMENT] = {};
+    file.write(reinterpret_cast<const char*>(&header), sizeof(header));
+    file.write(reinterpret_cast<const char*>(entries.data()), entries.size() * sizeof(PackEntry));
+    file.write(padding, static_cast<streamsize>(dataStart - tableBytes));
+    file.write(reinterpret_cast<const char*>(writer.data.data()), writer.data.size());
+    if (!file) {
+        cout << "ERROR::PACK::CANNOT_WRITE " << path << endl;
+        return false;
+    }
+
+    cout << "INFO: wrote asset pack " << path << " (" << entries.size() << " entries, " << (dataStart + writer.data.size()) / 1024 << " KiB)" << endl;
+    return true;
+}
+
+// main function
+int main(int argc, char* argv[]) {
+    // "--trace <file.json>" records CPU and GPU zones as a Chrome trace, "--trace-frames <first>:<last>"
+    // picks the frames to record (default 0:120, where frame 0 is startup). These are read before
+    // anything else so startup can be traced.
+    // "--headless" renders without a window through EGL (Mesa llvmpipe works), "--frames <count>" stops
+    // after <count> frames; headless runs default to 300 and benchmarks to the length of their path.
+    // "--texture-budget <KiB>" caps the texture data uploaded per frame (default 4096).
+    // "--threads <count>" sets how many worker threads help cull the scene, build draw packets and bake.
+    // "--bake <image> <out.ktx2>" compresses an image with its mip chain and exits, "--bake-format
+    // bc1|bc3|bc5|bc7" picks the block format (default BC1, or BC3 for images with alpha).
+    // "--pack <file>" maps meshes and textures from an asset pack instead of generating and decoding
+    // them; "--write-pack <file>" writes the generated ones to a pack. Packed meshes are stored in the
+    // vertex format they were written with, so a pack is loaded with the same --vertex-format.
+    // "--no-mesh-opt" uploads generated meshes as generated, for comparison with the optimized order.
+    // "--vertex-format float|snorm16|half" picks how the geometry pool stores vertices (default snorm16).
+    // "--sphere-segments <count>" sets the detail of the generated sphere (default 32).
+    // "--bench-geometry" times the procedural geometry generators against their scalar references and exits.
+    // "--shader-cache <dir|off>" sets where linked program binaries are cached (default shader_cache).
+    // "--shader-threads <count>" caps the driver's shader compiler threads (default: the driver's choice).
+    for (int i = 1; i < argc; ++i) {
+        string argument = argv[i];
+        string value = i + 1 < argc ? argv[i + 1] : "";
+        if (argument == "--headless")
+            gHeadless = true;
+        if (argument == "--frames")
+            gMaxFrames = static_cast<unsigned>(atoi(value.c_str()));
+        if (argument == "--trace")
+            gTracePath = value;
+        if (argument == "--texture-budget")
+            gTextureUploadBudget = max(atoi(value.c_str()), 1) * static_cast<GLsizeiptr>(1024);
+        if (argument == "--trace-frames" && value.find(':') != string::npos) {
+            gTraceFirstFrame = static_cast<unsigned>(atoi(value.substr(0, value.find(':')).c_str()));
+            gTraceLastFrame = static_cast<unsigned>(atoi(value.substr(value.find(':') + 1).c_str()));
+        }
+        if (argument == "--threads")
+            gWorkerThreads = atoi(value.c_str());
+        if (argument == "--bake" && i + 2 < argc) {
+            gBakeInput = value;
+            gBakeOutput = argv[i + 2];
+        }
+        if (argument == "--bake-format")
+            gBakeFormat = value;
+        if (argument == "--pack")
+            gPackPath = value;
+        if (argument == "--write-pack")
+            gPackWritePath = value;
+        if (argument == "--no-mesh-opt")
+            gOptimizeMeshes = false;
+        if (argument == "--shader-cache")
+            gProgramCachePath = value;
+        if (argument == "--shader-threads")
+            gShaderCompilerThreads = max(atoi(value.c_str()), 0);
+        if (argument == "--bench-geometry")
+            gBenchGeometry = true;
+        if (argument == "--sphere-segments")
+            gSphereSegments = max(atoi(value.c_str()), 4);
+        if (argument == "--vertex-format") {
+            for (int format = VERTEX_FLOAT; format <= VERTEX_HALF; ++format) {
+                if (value == VERTEX_FORMAT_NAMES[format])
+                    gVertexFormat = static_cast<VertexFormat>(format);
+            }
+        }
+    }
+
+    // Scene traversal, packet building and baking run on the calling thread plus this many workers
+    if (gWorkerThreads < 0)
+        gWorkerThreads = glm::clamp(static_cast<int>(thread::hardware_concurrency()) - 1, 0, 15);
+
+    // Baking needs neither a window nor a GL context
+    if (!gBakeInput.empty()) {
+        UCreateWorkerPool(gWorkerPool, gWorkerThreads);
+        bool baked = UBakeTexture(gBakeInput, gBakeOutput, gBakeFormat);
+        UDestroyWorkerPool(gWorkerPool);
+        return baked ? EXIT_SUCCESS : EXIT_FAILURE;
+    }
+    if (gBenchGeometry) {
+        UCreateWorkerPool(gWorkerPool, gWorkerThreads);
+        UBenchmarkGeometry();
+        UDestroyWorkerPool(gWorkerPool);
+        return EXIT_SUCCESS;
+    }
+
+#if U_PROFILE
+    if (!gTracePath.empty())
+        UProfileThreadRing();
+#endif
+    USetTraceFrame(0);
+    int64_t startupStart = UProfileNow();
+
+    if (!UInitialize(argc, argv, &gWindow))
+        return EXIT_FAILURE;
+
+    // The instance stream must exist before the geometry pool so its VAO can point the instance attributes at it
+    UCreateStreamBuffer(gInstanceStream, 256 * sizeof(GLInstance));
+    UCreateStreamBuffer(gIndirectStream, 64 * sizeof(GLDrawCommand));
+    UCreateGeometryPool(gGeometryPool, 65536, 262144);
+
+    // The worker pool also fills the rows of generated meshes
+    UCreateWorkerPool(gWorkerPool, gWorkerThreads);
+
+    // Create cube and cylinder meshes
+    if (!gPackPath.empty()) {
+        if (!UOpenAssetPack(gAssetPack, gPackPath) || !ULoadPackedMesh(gAssetPack, "cube", gCubeMesh) ||
+            !ULoadPackedMesh(gAssetPack, "cylinder", gCylinderMesh) || !ULoadPackedMesh(gAssetPack, "plane", gPlaneMesh) ||
+            !ULoadPackedMesh(gAssetPack, "sphere", gSphereMesh) || !ULoadPackedMesh(gAssetPack, "pyramid", gPyramidMesh))
+            return EXIT_FAILURE;
+    }
+    else {
+        // Generated meshes are captured level by level when a pack is being written
+        gPackWriter.capturing = !gPackWritePath.empty();
+        UBeginPackedMesh(gPackWriter, "cube");
+        UCubeMesh(gCubeMesh);
+        UEndPackedMesh(gPackWriter, gCubeMesh);
+        UBeginPackedMesh(gPackWriter, "cylinder");
+        UCylinderMesh(gCylinderMesh);
+        UEndPackedMesh(gPackWriter, gCylinderMesh);
+        UBeginPackedMesh(gPackWriter, "plane");
+        UPlaneMesh(gPlaneMesh, 5.0f, 5.0f); // Create a 3D plane with width 5.0 and length 5.0
+        UEndPackedMesh(gPackWriter, gPlaneMesh);
+        UBeginPackedMesh(gPackWriter, "sphere");
+        USphereMesh(gSphereMesh, 0.5f, gSphereSegments);
+        UEndPackedMesh(gPackWriter, gSphereMesh);
+        UBeginPackedMesh(gPackWriter, "pyramid");
+        UPyramidMesh(gPyramidMesh);
+        UEndPackedMesh(gPackWriter, gPyramidMesh);
+        gPackWriter.capturing = false;
+    }
+
+    // Every program is submitted here and finishes in the background; draws needing one that is not
+    // linked yet are skipped until it is
+    UOpenProgramCache(gProgramCache, gProgramCachePath);
+    UCreateShaderCompiler(gShaderCompiler, gShaderCompilerThreads);
+    gShaderVariants.vertexFormatDefines = UVertexFormatDefines(gVertexFormat);
+    // The comparison paths draw with every feature and the occlusion proxies with none; scene
+    // materials ask for theirs as they are placed
+    UShaderVariant(SHADER_FULL);
+    UShaderVariant(SHADER_FULL | SHADER_INSTANCING);
+    UShaderVariant(SHADER_INSTANCING);
+
+    UCreateFrameDataBuffer(gFrameDataStream);
+    UCreateGpuProfiler(gGpuProfiler);
+
+    // The scene renders offscreen so its depth can be sampled to build the occlusion pyramid
+    UCreateFramebuffer(gSceneFramebuffer, WINDOW_WIDTH, WINDOW_HEIGHT);
+    UCreateOcclusionCuller(gOcclusion, gSceneFramebuffer);
+    UCreateClusterGrid(gClusterGrid);
+
+    // Load the texture in the background; the scene draws with a placeholder until it is resident.
+    // A baked copy next to the source is preferred.
+    const char* texFilename = ifstream("textures/broth.ktx2") ? "textures/broth.ktx2" : "textures/broth.png";
+
+    UCreateTextureLoader(gTextureLoader, TEXTURE_DECODE_THREADS, gTextureUploadBudget);
+    if (gAssetPack.data)
+        gTextureId = URequestPackedTexture(gTextureLoader, gAssetPack, "broth");
+    else
+        gTextureId = URequestTexture(gTextureLoader, texFilename);
+
+    if (!gPackWritePath.empty()) {
+        if (!UPackTexture(gPackWriter, "broth", texFilename) || !UWriteAssetPack(gPackWriter, gPackWritePath))
+            return EXIT_FAILURE;
+        vector<PackEntry>().swap(gPackWriter.entries);
+        vector<unsigned char>().swap(gPackWriter.data);
+    }
+
+    UCreateScene();
+
+    // "--stress <count>" adds <count> spheres and <count> pyramids to the scene,
+    // "--occlusion off|hiz|queries" picks the occlusion culling mode,
+    // "--frames-in-flight <1-4>" sets how far the CPU may run ahead of the GPU,
+    // "--profile <file.json>" prints the CPU and GPU timings on exit and exports them to <file.json>,
+    // "--lights <count>" adds <count> moving point and spot lights, shaded through the light clusters
+    for (int i = 1; i < argc - 1; ++i) {
+        if (string(argv[i]) == "--stress")
+            UCreateStressScene(atoi(argv[i + 1]));
+        if (string(argv[i]) == "--lights")
+            UCreateLights(atoi(argv[i + 1]));
+        if (string(argv[i]) == "--occlusion") {
+            string mode = argv[i + 1];
+            gOcclusionMode = mode == "off" ? OCCLUSION_OFF : (mode == "queries" ? OCCLUSION_QUERIES : OCCLUSION_HIZ);
+        }
+        if (string(argv[i]) == "--frames-in-flight")
+            gFramesInFlight = glm::clamp(atoi(argv[i + 1]), 1, MAX_FRAMES_IN_FLIGHT);
+        if (string(argv[i]) == "--profile")
+            gProfilePath = argv[i + 1];
+        if (string(argv[i]) == "--benchmark") {
+            string path = argv[i + 1];
+            if (path == "orbit")
+                UOrbitCameraPath(gCameraPath);
+            else if (!ULoadCameraPath(path, gCameraPath))
+                return EXIT_FAILURE;
+        }
+        if (string(argv[i]) == "--benchmark-output")
+            gBenchmarkOutput = argv[i + 1];
+        if (string(argv[i]) == "--timestep")
+            gBenchmarkTimestep = max(static_cast<float>(atof(argv[i + 1])), 0.001f);
+        if (string(argv[i]) == "--record") {
+            gCameraRecording.open(argv[i + 1]);
+            if (!gCameraRecording)
+                cout << "ERROR::BENCHMARK::CANNOT_WRITE " << argv[i + 1] << endl;
+            else
+                gCameraRecording << "# time x y z yaw pitch zoom perspective" << endl;
+        }
+    }
+
+    if (!gCameraPath.empty()) {
+        // Benchmarks replay the path at fixed steps of simulated time and render as fast as they can
+        if (gMaxFrames == 0)
+            gMaxFrames = static_cast<unsigned>(gCameraPath.back().time / gBenchmarkTimestep) + 1;
+        if (!gHeadless)
+            glfwSwapInterval(0);
+        cout << "INFO: benchmark: " << gCameraPath.size() << " camera keys, " << gMaxFrames << " frames at "
+            << gBenchmarkTimestep * 1000.0f << " ms steps" << endl;
+    }
+    else if (gHeadless && gMaxFrames == 0)
+        gMaxFrames = 300;
+
+    glClearColor(0.0f, 0.0f, 0.0f, 1.0f);
+
+    if (!gHeadless) {
+        // Set the framebuffer size callback
+        glfwSetFramebufferSizeCallback(gWindow, UResizeWindow);
+
+        // Set the cursor position callback
+        glfwSetCursorPosCallback(gWindow, UMousePositionCallback);
+
+        // Set the scroll callback
+        glfwSetScrollCallback(gWindow, UMouseScrollCallback);
+
+        // Set cursor mode to normal
+        glfwSetInputMode(gWindow, GLFW_CURSOR, GLFW_CURSOR_NORMAL);
+
+        // Enable capturing mouse cursor movement
+        glfwSetInputMode(gWindow, GLFW_CURSOR, GLFW_CURSOR_DISABLED);
+    }
+
+    cout << "INFO: shader compiler: " << gShaderCompiler.submitted << " programs submitted, " << gShaderCompiler.pending.size()
+        << " compiling, parallel compile " << (gShaderCompiler.parallel ? "on" : "off") << endl;
+    // Benchmarks time the scene itself, so they wait for every program
+    if (!gCameraPath.empty() && !UPollShaderCompiler(gShaderCompiler, gProgramCache, true))
+        return EXIT_FAILURE;
+#if U_PROFILE
+    if (gProfileRecording.load(memory_order_relaxed))
+        UProfileRecord("startup", startupStart, UProfileNow());
+#endif
+    (void)startupStart;
+
+    chrono::steady_clock::time_point loopStart = chrono::steady_clock::now();
+    chrono::steady_clock::time_point lastFrame = loopStart;
+    while ((gHeadless || !glfwWindowShouldClose(gWindow)) && (gMaxFrames == 0 || gFrameIndex < gMaxFrames)) {
+        USetTraceFrame(gFrameIndex + 1);
+        {
+            U_PROFILE_SCOPE("frame");
+            if (!gHeadless)
+                glfwPollEvents();
+
+            // A benchmark path replaces live input; the frame about to render is number gFrameIndex from zero
+            if (!gCameraPath.empty())
+                UApplyCameraPath(gCameraPath, gFrameIndex * gBenchmarkTimestep);
+            else if (!gHeadless)
+                UProcessInput(gWindow);
+
+            if (gCameraRecording.is_open())
+                URecordCameraKey(gCameraRecording, chrono::duration<float>(chrono::steady_clock::now() - loopStart).count());
+
+            // A program that fails to build ends the run, as it did when programs were built at startup
+            if (!UPollShaderCompiler(gShaderCompiler, gProgramCache, false))
+                break;
+            URender();
+        }
+
+        chrono::steady_clock::time_point now = chrono::steady_clock::now();
+        float frameMs = chrono::duration<float, milli>(now - lastFrame).count();
+        URecordTiming(gCpuFrameTiming, frameMs);
+        if (!gCameraPath.empty())
+            gBenchmarkFrameTimes.push_back(frameMs);
+        lastFrame = now;
+    }
+
+    if (!gCameraPath.empty())
+        UWriteBenchmarkReport(gBenchmarkOutput, gBenchmarkFrameTimes);
+    gCameraRecording.close();
+
+    USetTraceFrame(0xFFFFFFFFu); // past any range, so nothing records during shutdown
+
+    if (!gProfilePath.empty()) {
+        UPrintProfile();
+        UExportProfile(gProfilePath);
+    }
+    if (!gTracePath.empty())
+        UExportTrace(gTracePath);
+    UReportProgramCache(gProgramCache);
+
+    UDestroyMesh(gCubeMesh);
+    UDestroyMesh(gCylinderMesh);
+    UDestroyMesh(gPlaneMesh);
+    UDestroyMesh(gSphereMesh);
+    UDestroyMesh(gPyramidMesh);
+    UDestroyMesh(gBoundsProxyMesh);
+    UDestroyGeometryPool(gGeometryPool);
+    UDestroyOcclusionCuller(gOcclusion);
+    UDestroyClusterGrid(gClusterGrid);
+    UDestroyFramebuffer(gSceneFramebuffer);
+    UDestroyShaderCompiler(gShaderCompiler);
+    UDestroyShaderVariants(gShaderVariants);
+    UDestroyFrameDataBuffer(gFrameDataStream);
+    UDestroyStreamBuffer(gInstanceStream);
+    UDestroyStreamBuffer(gIndirectStream);
+
+    // Report how long the CPU waited on the GPU, to tune the number of frames in flight
+    cout << "INFO: streaming: " << gFramesInFlight << " frames in flight, waited on a fence in " << gStreamFences.framesWaited
+        << " of " << gStreamFences.frames << " frames (" << gStreamFences.totalWaitMs << " ms total)" << endl;
+    UDestroyStreamFences(gStreamFences);
+    UDestroyGpuProfiler(gGpuProfiler);
+    // Release texture
+    UDestroyTextureLoader(gTextureLoader);
+    UDestroyTexture(gTextureId);
+    if (gAssetPack.data)
+        UCloseAssetPack(gAssetPack);
+
+    UDestroyWorkerPool(gWorkerPool);
+    if (gHeadless)
+        UDestroyHeadless();
+
+    exit(gShaderCompiler.failed > 0 ? EXIT_FAILURE : EXIT_SUCCESS);
+}
+
+void UMousePositionCallback(GLFWwindow* window, double xpos, double ypos) {
+    U_PROFILE_FUNCTION();
+    static float lastX = WINDOW_WIDTH / 2.0f;
+    static float lastY = WINDOW_HEIGHT / 2.0f;
+    static bool firstMouse = true;
+
+    if (firstMouse) {
+        lastX = xpos;
+        lastY = ypos;
+        firstMouse = false;
+    }
+
+    float xoffset = (xpos - lastX) * mouseSensitivity;
+    float yoffset = (lastY - ypos) * mouseSensitivity;
+
+    lastX = xpos;
+    lastY = ypos;
+
+    yaw += xoffset;
+    pitch += yoffset;
+
+    // constrain pitch to avoid camera flipping
+    if (pitch > 89.0f)
+        pitch = 89.0f;
+    if (pitch < -89.0f)
+        pitch = -89.0f;
+
+    UUpdateCameraFront();
+}
+
+// Function to derive the camera's front direction from its yaw and pitch
+void UUpdateCameraFront() {
+    U_PROFILE_FUNCTION();
+    glm::vec3 front;
+    front.x = cos(glm::radians(yaw)) * cos(glm::radians(pitch));
+    front.y = sin(glm::radians(pitch));
+    front.z = sin(glm::radians(yaw)) * cos(glm::radians(pitch));
+    cameraFront = glm::normalize(front);
+
+    // Update the view matrix
+    view = glm::lookAt(cameraPosition, cameraPosition + cameraFront, cameraUp);
+}
+
+// Function to read a camera path: one key per line as "time x y z yaw pitch zoom perspective", with
+// times in seconds and increasing, and lines starting with '#' ignored
+bool ULoadCameraPath(const string& path, vector<CameraKey>& keys) {
+    U_PROFILE_FUNCTION();
+    ifstream file(path.c_str());
+    if (!file) {
+        cout << "ERROR::BENCHMARK::CANNOT_READ " << path << endl;
+        return false;
+    }
+
+    keys.clear();
+    string line;
+    while (getline(file, line)) {
+        if (line.empty() || line[0] == '#')
+            continue;
+
+        istringstream fields(line);
+        CameraKey key;
+        int perspective = 1;
+        if (!(fields >> key.time >> key.position.x >> key.position.y >> key.position.z >> key.yaw >> key.pitch >> key.zoom >> perspective)) {
+            cout << "ERROR::BENCHMARK::BAD_KEY " << line << endl;
+            return false;
+        }
+        key.perspective = perspective != 0;
+        if (!keys.empty() && key.time < keys.back().time) {
+            cout << "ERROR::BENCHMARK::KEYS_OUT_OF_ORDER " << line << endl;
+            return false;
+        }
+        keys.push_back(key);
+    }
+
+    if (keys.empty()) {
+        cout << "ERROR::BENCHMARK::EMPTY_PATH " << path << endl;
+        return false;
+    }
+    return true;
+}
+
+// Function to build the built-in benchmark path: two slow turns around the broth box, dipping in close
+// halfway through so every level of detail is used, with a stretch in orthographic view at the end
+void UOrbitCameraPath(vector<CameraKey>& keys) {
+    U_PROFILE_FUNCTION();
+    const int keyCount = 121;
+    const float duration = 20.0f;
+
+    keys.clear();
+    for (int i = 0; i < keyCount; ++i) {
+        float t = static_cast<float>(i) / (keyCount - 1);
+        float angle = t * 4.0f * static_cast<float>(M_PI);
+        float radius = 6.0f - 4.5f * sin(t * static_cast<float>(M_PI));
+
+        // Look back at the origin from the orbit position
+        CameraKey key;
+        key.time = t * duration;
+        key.position = glm::vec3(radius * cos(angle), 1.0f + 1.5f * t, radius * sin(angle));
+        glm::vec3 toCenter = glm::normalize(-key.position);
+        key.yaw = glm::degrees(atan2(toCenter.z, toCenter.x));
+        key.pitch = glm::degrees(asin(toCenter.y));
+
+        // Keep yaw continuous so interpolation never turns the long way round
+        if (!keys.empty()) {
+            while (key.yaw - keys.back().yaw > 180.0f)
+                key.yaw -= 360.0f;
+            while (key.yaw - keys.back().yaw < -180.0f)
+                key.yaw += 360.0f;
+        }
+        key.zoom = 45.0f;
+        key.perspective = t < 0.9f;
+        keys.push_back(key);
+    }
+}
+
+// Function to set the camera from a path at the given time, interpolating between the surrounding keys.
+// The projection mode is not interpolated; it switches when the next key is reached.
+void UApplyCameraPath(const vector<CameraKey>& keys, float time) {
+    U_PROFILE_FUNCTION();
+    size_t next = 0;
+    while (next < keys.size() && keys[next].time <= time)
+        ++next;
+
+    CameraKey key;
+    if (next == 0)
+        key = keys.front();
+    else if (next == keys.size())
+        key = keys.back();
+    else {
+        const CameraKey& a = keys[next - 1];
+        const CameraKey& b = keys[next];
+        float t = b.time > a.time ? (time - a.time) / (b.time - a.time) : 1.0f;
+        key.position = glm::mix(a.position, b.position, t);
+        key.yaw = a.yaw + (b.yaw - a.yaw) * t;
+        key.pitch = a.pitch + (b.pitch - a.pitch) * t;
+        key.zoom = a.zoom + (b.zoom - a.zoom) * t;
+        key.perspective = a.perspective;
+    }
+
+    cameraPosition = key.position;
+    yaw = key.yaw;
+    pitch = key.pitch;
+    zoom = key.zoom;
+    usePerspective = key.perspective;
+    UUpdateCameraFront();
+}
+
+// Function to append the current camera state to a recording, in the format ULoadCameraPath reads.
+// The resulting camera is recorded rather than the raw input events, because movement is applied per
+// frame: replaying events at a different frame rate would not retrace the same path.
+void URecordCameraKey(ofstream& file, float time) {
+    U_PROFILE_FUNCTION();
+    file << time << ' ' << cameraPosition.x << ' ' << cameraPosition.y << ' ' << cameraPosition.z << ' '
+        << yaw << ' ' << pitch << ' ' << zoom << ' ' << (usePerspective ? 1 : 0) << '\n';
+}
+
+// Function to write the frame-time statistics of a benchmark run as JSON. Warm-up frames are left out.
+bool UWriteBenchmarkReport(const string& path, const vector<float>& frameTimes) {
+    U_PROFILE_FUNCTION();
+    vector<float> sorted;
+    if (static_cast<int>(frameTimes.size()) > BENCHMARK_WARMUP_FRAMES)
+        sorted.assign(frameTimes.begin() + BENCHMARK_WARMUP_FRAMES, frameTimes.end());
+    if (sorted.empty()) {
+        cout << "ERROR::BENCHMARK::TOO_FEW_FRAMES" << endl;
+        return false;
+    }
+    sort(sorted.begin(), sorted.end());
+
+    double sum = 0.0;
+    for (size_t i = 0; i < sorted.size(); ++i)
+        sum += sorted[i];
+    float mean = static_cast<float>(sum / sorted.size());
+    float p50 = sorted[sorted.size() / 2];
+    float p95 = sorted[min(sorted.size() - 1, static_cast<size_t>(sorted.size() * 0.95f))];
+    float p99 = sorted[min(sorted.size() - 1, static_cast<size_t>(sorted.size() * 0.99f))];
+    float stutterThreshold = p50 * BENCHMARK_STUTTER_FACTOR;
+    size_t stutters = sorted.end() - upper_bound(sorted.begin(), sorted.end(), stutterThreshold);
+
+    ofstream file(path.c_str());
+    if (!file) {
+        cout << "ERROR::BENCHMARK::CANNOT_WRITE " << path << endl;
+        return false;
+    }
+    file << "{\n  \"frames\": " << sorted.size() << ",\n  \"warmupFrames\": " << BENCHMARK_WARMUP_FRAMES
+        << ",\n  \"timestep\": " << gBenchmarkTimestep << ",\n  \"headless\": " << (gHeadless ? "true" : "false")
+        << ",\n  \"meanMs\": " << mean << ",\n  \"p50Ms\": " << p50 << ",\n  \"p95Ms\": " << p95
+        << ",\n  \"p99Ms\": " << p99 << ",\n  \"maxMs\": " << sorted.back()
+        << ",\n  \"stutterThresholdMs\": " << stutterThreshold << ",\n  \"stutters\": " << stutters << "\n}\n";
+
+    cout << "INFO: benchmark: mean " << mean << " p50 " << p50 << " p95 " << p95 << " p99 " << p99 << " max " << sorted.back()
+        << " ms, " << stutters << " stutters, written to " << path << endl;
+    return true;
+}
+
+void UMouseScrollCallback(GLFWwindow* window, double xoffset, double yoffset) {
+    U_PROFILE_FUNCTION();
+    zoom -= (float)yoffset;
+
+    if (zoom < 1.0f)
+        zoom = 1.0f;
+    if (zoom > 45.0f)
+        zoom = 45.0f;
+
+    // Update the projection matrix
+    projection = glm::perspective(glm::radians(zoom), (float)WINDOW_WIDTH / (float)WINDOW_HEIGHT, 0.1f, 100.0f);
+}
+
+bool UInitialize(int argc, char* argv[], GLFWwindow** window) {
+    U_PROFILE_FUNCTION();
+    if (gHeadless) {
+        *window = nullptr;
+        if (!UInitializeHeadless())
+            return false;
+    }
+    else {
+        if (!glfwInit()) {
+            cout << "Failed to initialize GLFW" << endl;
+            return false;
+        }
+
+        glfwWindowHint(GLFW_CONTEXT_VERSION_MAJOR, 4);
+        glfwWindowHint(GLFW_CONTEXT_VERSION_MINOR, 4);
+        glfwWindowHint(GLFW_OPENGL_PROFILE, GLFW_OPENGL_CORE_PROFILE);
+
+        *window = glfwCreateWindow(WINDOW_WIDTH, WINDOW_HEIGHT, WINDOW_TITLE, nullptr, nullptr);
+        if (*window == nullptr) {
+            cout << "Failed to create GLFW window" << endl;
+            glfwTerminate();
+            return false;
+        }
+
+        glfwMakeContextCurrent(*window);
+        glfwSetFramebufferSizeCallback(*window, UResizeWindow);
+
+        glfwSetCursorPosCallback(*window, UMousePositionCallback);
+        glfwSetScrollCallback(*window, UMouseScrollCallback);
+
+        // set cursor mode to normal
+        // glfwSetInputMode(*window, GLFW_CURSOR, GLFW_CURSOR_NORMAL);
+
+        // enable capturing mouse cursor movement
+        glfwSetInputMode(*window, GLFW_CURSOR, GLFW_CURSOR_DISABLED);
+
+        // register the scroll callback
+        glfwSetScrollCallback(*window, UMouseScrollCallback);
+    }
+
+    glewExperimental = GL_TRUE;
+    GLenum GlewInitResult = glewInit();
+
+    // A GLX build of GLEW loads every entry point and then reports the missing X display, which is
+    // expected with an EGL context
+#ifdef GLEW_ERROR_NO_GLX_DISPLAY
+    if (gHeadless && GlewInitResult == GLEW_ERROR_NO_GLX_DISPLAY)
+        GlewInitResult = GLEW_OK;
+#endif
+
+    if (GLEW_OK != GlewInitResult) {
+        cerr << glewGetErrorString(GlewInitResult) << endl;
+        return false;
+    }
+
+    cout << "INFO: OpenGL Version: " << glGetString(GL_VERSION) << endl;
+    cout << "INFO: OpenGL Renderer: " << glGetString(GL_RENDERER) << endl;
+
+    // Streamed uniform and storage ranges must start on these boundaries
+    glGetIntegerv(GL_UNIFORM_BUFFER_OFFSET_ALIGNMENT, &gUniformBufferAlignment);
+    glGetIntegerv(GL_SHADER_STORAGE_BUFFER_OFFSET_ALIGNMENT, &gStorageBufferAlignment);
+
+    return true;
+}
+
+// Function to create an OpenGL 4.4 core context without a window. Mesa's surfaceless EGL platform
+// needs no display server, and with llvmpipe no GPU either; other drivers fall back to the default
+// display. The scene is drawn into its offscreen framebuffer as usual, so no window surface is needed.
+bool UInitializeHeadless() {
+    U_PROFILE_FUNCTION();
+#if U_HEADLESS_EGL
+    PFNEGLGETPLATFORMDISPLAYEXTPROC getPlatformDisplay = (PFNEGLGETPLATFORMDISPLAYEXTPROC)eglGetProcAddress("eglGetPlatformDisplayEXT");
+    if (getPlatformDisplay)
+        gEglDisplay = getPlatformDisplay(EGL_PLATFORM_SURFACELESS_MESA, EGL_DEFAULT_DISPLAY, nullptr);
+    if (gEglDisplay == EGL_NO_DISPLAY)
+        gEglDisplay = eglGetDisplay(EGL_DEFAULT_DISPLAY);
+
+    EGLint major = 0, minor = 0;
+    if (gEglDisplay == EGL_NO_DISPLAY || !eglInitialize(gEglDisplay, &major, &minor)) {
+        cout << "Failed to initialize EGL" << endl;
+        return false;
+    }
+    if (!eglBindAPI(EGL_OPENGL_API)) {
+        cout << "EGL does not support desktop OpenGL" << endl;
+        return false;
+    }
+
+    // Prefer a config with pbuffer support; without one, fall back to a surfaceless context
+    EGLint configAttributes[] = {
+        EGL_SURFACE_TYPE, EGL_PBUFFER_BIT,
+        EGL_RENDERABLE_TYPE, EGL_OPENGL_BIT,
+        EGL_RED_SIZE, 8, EGL_GREEN_SIZE, 8, EGL_BLUE_SIZE, 8,
+        EGL_NONE
+    };
+    EGLConfig config;
+    EGLint configCount = 0;
+    bool pbuffer = eglChooseConfig(gEglDisplay, configAttributes, &config, 1, &configCount) && configCount > 0;
+    if (!pbuffer) {
+        configAttributes[1] = 0;
+        if (!eglChooseConfig(gEglDisplay, configAttributes, &config, 1, &configCount) || configCount == 0) {
+            cout << "Failed to find an EGL config for OpenGL" << endl;
+            return false;
+        }
+    }
+
+    const EGLint contextAttributes[] = {
+        EGL_CONTEXT_MAJOR_VERSION, 4,
+        EGL_CONTEXT_MINOR_VERSION, 4,
+        EGL_CONTEXT_OPENGL_PROFILE_MASK, EGL_CONTEXT_OPENGL_CORE_PROFILE_BIT,
+        EGL_NONE
+    };
+    gEglContext = eglCreateContext(gEglDisplay, config, EGL_NO_CONTEXT, contextAttributes);
+    if (gEglContext == EGL_NO_CONTEXT) {
+        cout << "Failed to create an OpenGL 4.4 core context through EGL" << endl;
+        return false;
+    }
+
+    if (pbuffer) {
+        const EGLint surfaceAttributes[] = { EGL_WIDTH, 1, EGL_HEIGHT, 1, EGL_NONE };
+        gEglSurface = eglCreatePbufferSurface(gEglDisplay, config, surfaceAttributes);
+    }
+    if (!eglMakeCurrent(gEglDisplay, gEglSurface, gEglSurface, gEglContext)) {
+        cout << "Failed to make the EGL context current" << endl;
+        return false;
+    }
+
+    cout << "INFO: headless EGL " << major << "." << minor << (pbuffer ? " (pbuffer)" : " (surfaceless)") << endl;
+    return true;
+#else
+    cout << "Headless mode needs EGL, which is only available on Linux builds" << endl;
+    return false;
+#endif
+}
+
+void UDestroyHeadless() {
+    U_PROFILE_FUNCTION();
+#if U_HEADLESS_EGL
+    eglMakeCurrent(gEglDisplay, EGL_NO_SURFACE, EGL_NO_SURFACE, EGL_NO_CONTEXT);
+    if (gEglSurface != EGL_NO_SURFACE)
+        eglDestroySurface(gEglDisplay, gEglSurface);
+    eglDestroyContext(gEglDisplay, gEglContext);
+    eglTerminate(gEglDisplay);
+#endif
+}
+
+void UResizeWindow(GLFWwindow* window, int width, int height) {
+    U_PROFILE_FUNCTION();
+    // The scene framebuffer keeps its size; the window size is only used when blitting to it
+    gWindowFramebufferWidth = width;
+    gWindowFramebufferHeight = height;
+}
+
+// function for keys
+void UProcessInput(GLFWwindow* window) {
+    U_PROFILE_FUNCTION();
+
+    // Esc button
+    if (glfwGetKey(window, GLFW_KEY_ESCAPE) == GLFW_PRESS)
+        glfwSetWindowShouldClose(window, true);
+
+    // WASD keys to control the forward, backward, left, and right motion
+    if (glfwGetKey(window, GLFW_KEY_W) == GLFW_PRESS)
+        cameraPosition += cameraSpeed * cameraFront; // forward
+    if (glfwGetKey(window, GLFW_KEY_S) == GLFW_PRESS)
+        cameraPosition -= cameraSpeed * cameraFront; // backward
+    if (glfwGetKey(window, GLFW_KEY_A) == GLFW_PRESS)
+        cameraPosition -= glm::normalize(glm::cross(cameraFront, cameraUp)) * cameraSpeed; // left
+    if (glfwGetKey(window, GLFW_KEY_D) == GLFW_PRESS)
+        cameraPosition += glm::normalize(glm::cross(cameraFront, cameraUp)) * cameraSpeed; // right
+
+    if (glfwGetKey(window, GLFW_KEY_W) == GLFW_PRESS)
+        cout << "W key pressed" << endl;
+    if (glfwGetKey(window, GLFW_KEY_S) == GLFW_PRESS)
+        cout << "S key pressed" << endl;
+
+    // QE keys for upward and downward movement
+    if (glfwGetKey(window, GLFW_KEY_Q) == GLFW_PRESS)
+        cameraPosition += cameraSpeed * cameraUp; // upward
+    if (glfwGetKey(window, GLFW_KEY_E) == GLFW_PRESS)
+        cameraPosition -= cameraSpeed * cameraUp; // downward
+
+    // Toggle between perspective and orthographic views with the "P" key
+    if (glfwGetKey(window, GLFW_KEY_P) == GLFW_PRESS) {
+        usePerspective = !usePerspective;
+    }
+
+    // Cycle the stress scene between per-object, instanced and multi-draw submission with the "I" key
+    static bool instancedKeyDown = false;
+    bool instancedKey = glfwGetKey(window, GLFW_KEY_I) == GLFW_PRESS;
+    if (instancedKey && !instancedKeyDown && gStressScene) {
+        gStressMode = static_cast<StressMode>((gStressMode + 1) % 3);
+        cout << "INFO: stress scene " << STRESS_MODE_NAMES[gStressMode] << endl;
+    }
+    instancedKeyDown = instancedKey;
+
+    // Cycle the occlusion culling mode with the "O" key
+    static bool occlusionKeyDown = false;
+    bool occlusionKey = glfwGetKey(window, GLFW_KEY_O) == GLFW_PRESS;
+    if (occlusionKey && !occlusionKeyDown) {
+        gOcclusionMode = static_cast<OcclusionMode>((gOcclusionMode + 1) % 3);
+        gOcclusion.hiZValid = false;
+        cout << "INFO: occlusion culling " << OCCLUSION_MODE_NAMES[gOcclusionMode] << endl;
+    }
+    occlusionKeyDown = occlusionKey;
+}
+
+// Function to point the pool VAO at the pool buffers; called again whenever the buffers are reallocated
+static void UBindGeometryPoolAttributes(GLGeometryPool& pool) {
+    U_PROFILE_FUNCTION();
+    glBindVertexArray(pool.vao);
+    glBindBuffer(GL_ARRAY_BUFFER, pool.vbos[0]);
+    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, pool.vbos[1]);
+
+    // Position at 0, color at 1, texture coordinate at 2, normal at NORMAL_LOCATION
+    GLsizei stride = VERTEX_FORMAT_STRIDES[gVertexFormat];
+    if (gVertexFormat == VERTEX_FLOAT) {
+        glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, stride, (char*)0);
+        glVertexAttribPointer(1, 4, GL_FLOAT, GL_FALSE, stride, (char*)(sizeof(GLfloat) * 3));
+        glVertexAttribPointer(2, 2, GL_FLOAT, GL_FALSE, stride, (char*)(sizeof(GLfloat) * 7));
+        glVertexAttribPointer(NORMAL_LOCATION, 3, GL_FLOAT, GL_FALSE, stride, (char*)(sizeof(GLfloat) * 9));
+    }
+    else {
+        if (gVertexFormat == VERTEX_SNORM16)
+            glVertexAttribPointer(0, 4, GL_SHORT, GL_TRUE, stride, (char*)0);
+        else
+            glVertexAttribPointer(0, 4, GL_HALF_FLOAT, GL_FALSE, stride, (char*)0);
+        glVertexAttribPointer(1, 4, GL_UNSIGNED_BYTE, GL_TRUE, stride, (char*)8);
+        glVertexAttribPointer(2, 2, GL_HALF_FLOAT, GL_FALSE, stride, (char*)12);
+        glVertexAttribPointer(NORMAL_LOCATION, 2, GL_SHORT, GL_TRUE, stride, (char*)16);
+    }
+    glEnableVertexAttribArray(0);
+    glEnableVertexAttribArray(1);
+    glEnableVertexAttribArray(2);
+    glEnableVertexAttribArray(NORMAL_LOCATION);
+
+    // Instance attributes advance once per instance and are only read by the instanced program
+    glBindBuffer(GL_ARRAY_BUFFER, gInstanceStream.buffer);
+    for (GLuint column = 0; column < 4; ++column) {
+        GLuint location = INSTANCE_MODEL_LOCATION + column;
+        glVertexAttribPointer(location, 4, GL_FLOAT, GL_FALSE, sizeof(GLInstance), (char*)(sizeof(glm::vec4) * column));
+        glVertexAttribDivisor(location, 1);
+        glEnableVertexAttribArray(location);
+    }
+    glVertexAttribPointer(INSTANCE_TINT_LOCATION, 4, GL_FLOAT, GL_FALSE, sizeof(GLInstance), (char*)offsetof(GLInstance, tint));
+    glVertexAttribDivisor(INSTANCE_TINT_LOCATION, 1);
+    glEnableVertexAttribArray(INSTANCE_TINT_LOCATION);
+
+    glBindVertexArray(0);
+}
+
+// Function to create the shared vertex and index buffers every mesh is sub-allocated from; the index
+// capacity is counted in 16-bit indices
+void UCreateGeometryPool(GLGeometryPool& pool, GLsizei vertexCapacity, GLsizei indexCapacity) {
+    U_PROFILE_FUNCTION();
+    pool.vertexCapacity = vertexCapacity;
+    pool.vertexCount = 0;
+    pool.indexByteCapacity = indexCapacity * static_cast<GLsizeiptr>(sizeof(GLushort));
+    pool.indexBytes = 0;
+    pool.meshlets.clear();
+
+    glGenVertexArrays(1, &pool.vao);
+    glGenBuffers(2, pool.vbos);
+
+    glBindBuffer(GL_ARRAY_BUFFER, pool.vbos[0]);
+    glBufferData(GL_ARRAY_BUFFER, vertexCapacity * static_cast<GLsizeiptr>(VERTEX_FORMAT_STRIDES[gVertexFormat]), nullptr, GL_STATIC_DRAW);
+    glBindBuffer(GL_ARRAY_BUFFER, pool.vbos[1]);
+    glBufferData(GL_ARRAY_BUFFER, pool.indexByteCapacity, nullptr, GL_STATIC_DRAW);
+    glBindBuffer(GL_ARRAY_BUFFER, 0);
+
+    UBindGeometryPoolAttributes(pool);
+}
+
+// Function to grow one of the pool buffers, keeping the data already uploaded to it
+static void UGrowGeometryPoolBuffer(GLuint& bufferId, GLsizeiptr usedBytes, GLsizeiptr newBytes) {
+    U_PROFILE_FUNCTION();
+    GLuint newBuffer;
+    glGenBuffers(1, &newBuffer);
+    glBindBuffer(GL_COPY_WRITE_BUFFER, newBuffer);
+    glBufferData(GL_COPY_WRITE_BUFFER, newBytes, nullptr, GL_STATIC_DRAW);
+    glBindBuffer(GL_COPY_READ_BUFFER, bufferId);
+    glCopyBufferSubData(GL_COPY_READ_BUFFER, GL_COPY_WRITE_BUFFER, 0, 0, usedBytes);
+    glDeleteBuffers(1, &bufferId);
+    bufferId = newBuffer;
+}
+
+void UDestroyGeometryPool(GLGeometryPool& pool) {
+    U_PROFILE_FUNCTION();
+    glDeleteVertexArrays(1, &pool.vao);
+    glDeleteBuffers(2, pool.vbos);
+    pool.meshlets.clear();
+}
+
+static void UCapturePackedMeshLod(AssetPackWriter& writer, const void* vertices, GLsizei vertexCount, const void* indices, GLsizei indexCount,
+    GLenum indexType, const GLMeshlet* meshlets, int meshletCount);
+
+// Function to count post-transform cache misses of an index buffer on a FIFO cache of cacheSize entries
+static int UCountCacheMisses(const GLuint* indices, int indexCount, int vertexCount, int cacheSize) {
+    vector<int> insertedAt(vertexCount, -cacheSize - 1);
+    int misses = 0;
+    for (int i = 0; i < indexCount; ++i) {
+        if (misses - insertedAt[indices[i]] > cacheSize - 1) {
+            insertedAt[indices[i]] = misses;
+            misses++;
+        }
+    }
+    return misses;
+}
+
+// Function to merge vertices whose attributes match to within 1e-5, so shared corners and seams are
+// transformed once. Returns the new vertex count; survivors keep their relative order.
+static int UWeldVertices(vector<GLfloat>& vertices, vector<GLuint>& indices, int vertexCount) {
+    U_PROFILE_FUNCTION();
+    vector<int64_t> keys(vertices.size());
+    for (size_t i = 0; i < vertices.size(); ++i)
+        keys[i] = llround(vertices[i] * 1.0e5);
+
+    vector<int> order(vertexCount);
+    for (int i = 0; i < vertexCount; ++i)
+        order[i] = i;
+    const int64_t* key = keys.data();
+    stable_sort(order.begin(), order.end(), [key](int a, int b) {
+        return lexicographical_compare(key + a * FLOATS_PER_VERTEX, key + (a + 1) * FLOATS_PER_VERTEX, key + b * FLOATS_PER_VERTEX, key + (b + 1) * FLOATS_PER_VERTEX);
+    });
+
+    // Runs of equal keys map to their first vertex in the original order
+    vector<int> representative(vertexCount);
+    for (int i = 0; i < vertexCount; ++i) {
+        bool same = i > 0 && equal(key + order[i] * FLOATS_PER_VERTEX, key + (order[i] + 1) * FLOATS_PER_VERTEX, key + order[i - 1] * FLOATS_PER_VERTEX);
+        representative[order[i]] = same ? representative[order[i - 1]] : order[i];
+    }
+
+    vector<int> remap(vertexCount, -1);
+    int welded = 0;
+    for (int i = 0; i < vertexCount; ++i) {
+        if (representative[i] != i)
+            continue;
+        remap[i] = welded;
+        copy(vertices.begin() + i * FLOATS_PER_VERTEX, vertices.begin() + (i + 1) * FLOATS_PER_VERTEX, vertices.begin() + welded * FLOATS_PER_VERTEX);
+        welded++;
+    }
+    vertices.resize(welded * FLOATS_PER_VERTEX);
+    for (size_t i = 0; i < indices.size(); ++i)
+        indices[i] = static_cast<GLuint>(remap[representative[indices[i]]]);
+    return welded;
+}
+
+// Function to reorder triangles for the post-transform cache with Tipsify (Sander, Nehab and Barczak,
+// "Fast Triangle Reordering for Vertex Locality and Reduced Overdraw", 2007): fan out around one
+// vertex at a time, moving next to the recently used vertex that will still be cached once its
+// remaining triangles are emitted, or to a dead-end vertex when none will be
+static void UTipsify(vector<GLuint>& indices, int vertexCount, int cacheSize) {
+    U_PROFILE_FUNCTION();
+    int triangleCount = static_cast<int>(indices.size() / 3);
+
+    // Triangles around each vertex
+    vector<int> offsets(vertexCount + 1, 0);
+    for (size_t i = 0; i < indices.size(); ++i)
+        offsets[indices[i] + 1]++;
+    for (int v = 0; v < vertexCount; ++v)
+        offsets[v + 1] += offsets[v];
+    vector<int> adjacency(indices.size());
+    vector<int> fill(offsets.begin(), offsets.end() - 1);
+    for (size_t i = 0; i < indices.size(); ++i)
+        adjacency[fill[indices[i]]++] = static_cast<int>(i / 3);
+
+    vector<int> live(vertexCount);
+    for (int v = 0; v < vertexCount; ++v)
+        live[v] = offsets[v + 1] - offsets[v];
+    vector<int> cachedAt(vertexCount, 0);
+    vector<char> emitted(triangleCount, 0);
+    vector<int> deadEnds;
+    vector<int> candidates;
+    vector<GLuint> output;
+    output.reserve(indices.size());
+
+    int time = cacheSize + 1;
+    int cursor = 0;
+    int fanning = 0;
+    while (fanning >= 0) {
+        candidates.clear();
+        for (int k = offsets[fanning]; k < offsets[fanning + 1]; ++k) {
+            int triangle = adjacency[k];
+            if (emitted[triangle])
+                continue;
+            emitted[triangle] = 1;
+            for (int c = 0; c < 3; ++c) {
+                int v = indices[triangle * 3 + c];
+                output.push_back(static_cast<GLuint>(v));
+                deadEnds.push_back(v);
+                candidates.push_back(v);
+                live[v]--;
+                if (time - cachedAt[v] > cacheSize)
+                    cachedAt[v] = time++;
+            }
+        }
+
+        int next = -1;
+        int bestPriority = -1;
+        for (size_t i = 0; i < candidates.size(); ++i) {
+            int v = candidates[i];
+            if (live[v] <= 0)
+                continue;
+            int priority = time - cachedAt[v] + 2 * live[v] <= cacheSize ? time - cachedAt[v] : 0;
+            if (priority > bestPriority) {
+                bestPriority = priority;
+                next = v;
+            }
+        }
+        while (next < 0 && !deadEnds.empty()) {
+            int v = deadEnds.back();
+            deadEnds.pop_back();
+            if (live[v] > 0)
+                next = v;
+        }
+        while (next < 0 && cursor < vertexCount) {
+            if (live[cursor] > 0)
+                next = cursor;
+            else
+                cursor++;
+        }
+        fanning = next;
+    }
+    indices.swap(output);
+}
+
+// Function to reduce overdraw without undoing the cache order: the triangle sequence is cut into
+// clusters where the cache starts cold anyway (a triangle missing all three vertices), and clusters
+// facing away from the mesh center are drawn first, since they tend to occlude the rest. Returns the
+// number of clusters.
+static int UOrderClustersForOverdraw(const vector<GLfloat>& vertices, vector<GLuint>& indices, int vertexCount, int cacheSize) {
+    U_PROFILE_FUNCTION();
+    int triangleCount = static_cast<int>(indices.size() / 3);
+    vector<int> clusterStarts;
+    vector<int> insertedAt(vertexCount, -cacheSize - 1);
+    int misses = 0;
+    for (int t = 0; t < triangleCount; ++t) {
+        int triangleMisses = 0;
+        for (int c = 0; c < 3; ++c) {
+            GLuint v = indices[t * 3 + c];
+            if (misses - insertedAt[v] > cacheSize - 1) {
+                insertedAt[v] = misses++;
+                triangleMisses++;
+            }
+        }
+        if (t == 0 || triangleMisses == 3)
+            clusterStarts.push_back(t);
+    }
+    clusterStarts.push_back(triangleCount);
+    int clusterCount = static_cast<int>(clusterStarts.size()) - 1;
+    if (clusterCount <= 1)
+        return clusterCount;
+
+    glm::vec3 meshCenter(0.0f);
+    for (int v = 0; v < vertexCount; ++v)
+        meshCenter += glm::vec3(vertices[v * FLOATS_PER_VERTEX], vertices[v * FLOATS_PER_VERTEX + 1], vertices[v * FLOATS_PER_VERTEX + 2]);
+    meshCenter /= static_cast<float>(max(vertexCount, 1));
+
+    // Area-weighted center and normal per cluster
+    vector<float> facing(clusterCount);
+    for (int i = 0; i < clusterCount; ++i) {
+        glm::vec3 center(0.0f), normal(0.0f);
+        float area = 0.0f;
+        for (int t = clusterStarts[i]; t < clusterStarts[i + 1]; ++t) {
+            glm::vec3 corners[3];
+            for (int c = 0; c < 3; ++c) {
+                const GLfloat* position = &vertices[indices[t * 3 + c] * FLOATS_PER_VERTEX];
+                corners[c] = glm::vec3(position[0], position[1], position[2]);
+            }
+            glm::vec3 cross = glm::cross(corners[1] - corners[0], corners[2] - corners[0]);
+            float triangleArea = glm::length(cross);
+            center += (corners[0] + corners[1] + corners[2]) * (triangleArea / 3.0f);
+            normal += cross;
+            area += triangleArea;
+        }
+        float normalLength = glm::length(normal);
+        facing[i] = area > 0.0f && normalLength > 0.0f ? glm::dot(center / area - meshCenter, normal / normalLength) : 0.0f;
+    }
+
+    vector<int> order(clusterCount);
+    for (int i = 0; i < clusterCount; ++i)
+        order[i] = i;
+    stable_sort(order.begin(), order.end(), [&facing](int a, int b) { return facing[a] > facing[b]; });
+
+    vector<GLuint> sorted;
+    sorted.reserve(indices.size());
+    for (int i = 0; i < clusterCount; ++i)
+        sorted.insert(sorted.end(), indices.begin() + clusterStarts[order[i]] * 3, indices.begin() + clusterStarts[order[i] + 1] * 3);
+    indices.swap(sorted);
+    return clusterCount;
+}
+
+// Function to renumber vertices in the order the index buffer first uses them, so vertex fetch walks
+// memory forwards; unreferenced vertices are dropped. Returns the new vertex count.
+static int UReorderVertexFetch(vector<GLfloat>& vertices, vector<GLuint>& indices, int vertexCount) {
+    U_PROFILE_FUNCTION();
+    vector<int> remap(vertexCount, -1);
+    vector<GLfloat> reordered;
+    reordered.reserve(vertices.size());
+    int next = 0;
+    for (size_t i = 0; i < indices.size(); ++i) {
+        int v = indices[i];
+        if (remap[v] < 0) {
+            remap[v] = next++;
+            reordered.insert(reordered.end(), vertices.begin() + v * FLOATS_PER_VERTEX, vertices.begin() + (v + 1) * FLOATS_PER_VERTEX);
+        }
+        indices[i] = static_cast<GLuint>(remap[v]);
+    }
+    vertices.swap(reordered);
+    return next;
+}
+
+// Function to optimize a mesh level before it is uploaded: weld, Tipsify, order clusters for overdraw
+// and reorder vertex fetch. On return the pointers refer to the optimized copy, which lives until the
+// next call. ACMR (cache misses per triangle) and ATVR (misses per vertex, 1 is ideal) are reported
+// before and after.
+static void UOptimizeMeshLod(const GLfloat*& vertices, const GLuint*& indices, int& vertexCount, int& indexCount) {
+    U_PROFILE_FUNCTION();
+    if (!gOptimizeMeshes || indexCount < 3)
+        return;
+
+    int missesBefore = UCountCacheMisses(indices, indexCount, vertexCount, VERTEX_CACHE_SIZE);
+    int verticesBefore = vertexCount;
+
+    gOptimizeVertices.assign(vertices, vertices + vertexCount * FLOATS_PER_VERTEX);
+    gOptimizeIndices.assign(indices, indices + indexCount);
+    int welded = UWeldVertices(gOptimizeVertices, gOptimizeIndices, vertexCount);
+    UTipsify(gOptimizeIndices, welded, VERTEX_CACHE_SIZE);
+    int clusters = UOrderClustersForOverdraw(gOptimizeVertices, gOptimizeIndices, welded, VERTEX_CACHE_SIZE);
+    vertexCount = UReorderVertexFetch(gOptimizeVertices, gOptimizeIndices, welded);
+
+    vertices = gOptimizeVertices.data();
+    indices = gOptimizeIndices.data();
+    int missesAfter = UCountCacheMisses(indices, indexCount, vertexCount, VERTEX_CACHE_SIZE);
+
+    float triangles = indexCount / 3.0f;
+    cout << "INFO: mesh optimize: " << verticesBefore << " -> " << vertexCount << " vertices, " << clusters << " clusters, ACMR "
+        << missesBefore / triangles << " -> " << missesAfter / triangles << ", ATVR " << static_cast<float>(missesBefore) / verticesBefore
+        << " -> " << static_cast<float>(missesAfter) / vertexCount << endl;
+}
+
+// Function to give every vertex on a crease one copy per group of faces that should be smoothed
+// together, so the normals generated from the triangles do not average across hard edges. Runs
+// whether or not the mesh is optimized, since welding would merge the copies back. On return the
+// pointers refer to the split copy, which lives until the next call.
+static void USplitCreases(const GLfloat*& vertices, const GLuint*& indices, int& vertexCount, int indexCount) {
+    U_PROFILE_FUNCTION();
+    int triangleCount = indexCount / 3;
+    vector<glm::vec3> faceNormals(triangleCount);
+    for (int t = 0; t < triangleCount; ++t) {
+        glm::vec3 corners[3];
+        for (int c = 0; c < 3; ++c) {
+            const GLfloat* position = vertices + indices[t * 3 + c] * FLOATS_PER_VERTEX;
+            corners[c] = glm::vec3(position[0], position[1], position[2]);
+        }
+        glm::vec3 normal = glm::cross(corners[1] - corners[0], corners[2] - corners[0]);
+        faceNormals[t] = glm::length(normal) > 0.0f ? glm::normalize(normal) : glm::vec3(0.0f);
+    }
+
+    // Triangle corners around each vertex
+    vector<int> offsets(vertexCount + 1, 0);
+    for (int i = 0; i < triangleCount * 3; ++i)
+        offsets[indices[i] + 1]++;
+    for (int v = 0; v < vertexCount; ++v)
+        offsets[v + 1] += offsets[v];
+    vector<int> corners(triangleCount * 3);
+    vector<int> filled(offsets.begin(), offsets.end() - 1);
+    for (int i = 0; i < triangleCount * 3; ++i)
+        corners[filled[indices[i]]++] = i;
+
+    gCreaseVertices.assign(vertices, vertices + vertexCount * FLOATS_PER_VERTEX);
+    gCreaseIndices.assign(indices, indices + indexCount);
+    int splitCount = vertexCount;
+    vector<glm::vec3> groupNormals;
+    vector<GLuint> groupVertices;
+    for (int v = 0; v < vertexCount; ++v) {
+        // Each corner joins the first group whose leading face is close enough, else starts a new one.
+        // Degenerate faces have no direction and join the first group.
+        groupNormals.clear();
+        groupVertices.clear();
+        for (int i = offsets[v]; i < offsets[v + 1]; ++i) {
+            const glm::vec3& normal = faceNormals[corners[i] / 3];
+            size_t group = 0;
+            while (group < groupNormals.size() && glm::length(normal) > 0.0f && glm::length(groupNormals[group]) > 0.0f
+                && glm::dot(normal, groupNormals[group]) < CREASE_ANGLE_COS)
+                group++;
+            if (group == groupNormals.size()) {
+                groupNormals.push_back(normal);
+                if (group == 0)
+                    groupVertices.push_back(v);
+                else {
+                    groupVertices.push_back(splitCount++);
+                    gCreaseVertices.insert(gCreaseVertices.end(), vertices + v * FLOATS_PER_VERTEX, vertices + (v + 1) * FLOATS_PER_VERTEX);
+                }
+            }
+            else if (glm::length(groupNormals[group]) == 0.0f)
+                groupNormals[group] = normal;
+            gCreaseIndices[corners[i]] = groupVertices[group];
+        }
+    }
+
+    // Copies are appended, so restore the fetch order the optimizer left
+    if (gOptimizeMeshes && splitCount > vertexCount)
+        splitCount = UReorderVertexFetch(gCreaseVertices, gCreaseIndices, splitCount);
+    vertices = gCreaseVertices.data();
+    indices = gCreaseIndices.data();
+    vertexCount = splitCount;
+}
+
+// Function to convert a float to a half float, rounding to nearest
+static uint16_t UFloatToHalf(float value) {
+    uint32_t bits;
+    memcpy(&bits, &value, sizeof(bits));
+    uint32_t sign = (bits >> 16) & 0x8000;
+    int exponent = static_cast<int>((bits >> 23) & 0xFF) - 127 + 15;
+    uint32_t mantissa = bits & 0x7FFFFF;
+
+    if (exponent <= 0) {
+        // Too small for a normal half: denormal or zero
+        if (exponent < -10)
+            return static_cast<uint16_t>(sign);
+        mantissa |= 0x800000;
+        int shift = 14 - exponent;
+        uint32_t half = mantissa >> shift;
+        if ((mantissa >> (shift - 1)) & 1)
+            half++;
+        return static_cast<uint16_t>(sign | half);
+    }
+    if (exponent >= 31)
+        return static_cast<uint16_t>(sign | 0x7C00);
+
+    // A carry out of the mantissa correctly bumps the exponent
+    uint32_t half = sign | (exponent << 10) | (mantissa >> 13);
+    if (mantissa & 0x1000)
+        half++;
+    return static_cast<uint16_t>(half);
+}
+
+// Function to convert a value in [-1, 1] to a normalized short
+static int16_t UFloatToSnorm16(float value) {
+    return static_cast<int16_t>(lround(glm::clamp(value, -1.0f, 1.0f) * 32767.0f));
+}
+
+// Function to compute the mesh-space center and half-size that quantized positions are stored
+// relative to. Flat meshes keep a tiny extent on their flat axis so nothing divides by zero.
+static void UQuantizationBounds(const GLMesh& mesh, glm::vec3& center, glm::vec3& extent) {
+    center = (mesh.boundsMin + mesh.boundsMax) * 0.5f;
+    extent = glm::max((mesh.boundsMax - mesh.boundsMin) * 0.5f, glm::vec3(1.0e-6f));
+}
+
+// Function to convert a mesh level from the generators' layout to the pool's vertex format. Normals are
+// generated from the triangles, each vertex getting the area-weighted sum of the faces around it, which
+// USplitCreases has already limited to one side of any hard edge;
+// texture coordinates are generated by projecting along the normal's dominant axis onto the mesh
+// bounds. For quantized formats the normal is pre-scaled by the inverse of the dequantize scale, so that
+// mat3(model * dequantize) cancels it and turns it back into the right direction.
+static void UEncodeVertices(const GLMesh& mesh, const GLfloat* vertices, const GLuint* indices, int vertexCount, int indexCount,
+    vector<unsigned char>& encoded) {
+    U_PROFILE_FUNCTION();
+    vector<glm::vec3> normals(vertexCount, glm::vec3(0.0f));
+    for (int i = 0; i + 2 < indexCount; i += 3) {
+        glm::vec3 corners[3];
+        for (int c = 0; c < 3; ++c) {
+            const GLfloat* position = vertices + indices[i + c] * FLOATS_PER_VERTEX;
+            corners[c] = glm::vec3(position[0], position[1], position[2]);
+        }
+        glm::vec3 faceNormal = glm::cross(corners[1] - corners[0], corners[2] - corners[0]);
+        for (int c = 0; c < 3; ++c)
+            normals[indices[i + c]] += faceNormal;
+    }
+
+    glm::vec3 center, extent;
+    UQuantizationBounds(mesh, center, extent);
+    glm::vec3 size = extent * 2.0f;
+
+    const GLsizei stride = VERTEX_FORMAT_STRIDES[gVertexFormat];
+    encoded.assign(static_cast<size_t>(vertexCount) * stride, 0);
+    for (int v = 0; v < vertexCount; ++v) {
+        const GLfloat* source = vertices + v * FLOATS_PER_VERTEX;
+        glm::vec3 position(source[0], source[1], source[2]);
+        glm::vec3 normal = glm::length(normals[v]) > 0.0f ? glm::normalize(normals[v]) : glm::vec3(0.0f, 1.0f, 0.0f);
+
+        glm::vec3 fromMin = (position - mesh.boundsMin) / size;
+        glm::vec3 axis = glm::abs(normal);
+        float uv[2];
+        if (axis.x >= axis.y && axis.x >= axis.z) {
+            uv[0] = fromMin.z;
+            uv[1] = fromMin.y;
+        }
+        else if (axis.y >= axis.z) {
+            uv[0] = fromMin.x;
+            uv[1] = fromMin.z;
+        }
+        else {
+            uv[0] = fromMin.x;
+            uv[1] = fromMin.y;
+        }
+
+        unsigned char* destination = &encoded[static_cast<size_t>(v) * stride];
+        if (gVertexFormat == VERTEX_FLOAT) {
+            GLfloat attributes[12] = { source[0], source[1], source[2], source[3], source[4], source[5], source[6], uv[0], uv[1], normal.x, normal.y, normal.z };
+            memcpy(destination, attributes, sizeof(attributes));
+            continue;
+        }
+
+        glm::vec3 quantized = (position - center) / extent;
+        int16_t packedPosition[4];
+        uint16_t packedHalfs[2] = { UFloatToHalf(uv[0]), UFloatToHalf(uv[1]) };
+        unsigned char packedColor[4];
+        for (int c = 0; c < 3; ++c) {
+            if (gVertexFormat == VERTEX_SNORM16)
+                packedPosition[c] = UFloatToSnorm16(quantized[c]);
+            else {
+                uint16_t half = UFloatToHalf(quantized[c]);
+                memcpy(&packedPosition[c], &half, sizeof(half));
+            }
+        }
+        if (gVertexFormat == VERTEX_SNORM16)
+            packedPosition[3] = 32767;
+        else {
+            uint16_t one = UFloatToHalf(1.0f);
+            memcpy(&packedPosition[3], &one, sizeof(one));
+        }
+        for (int c = 0; c < 4; ++c)
+            packedColor[c] = static_cast<unsigned char>(lround(glm::clamp(source[3 + c], 0.0f, 1.0f) * 255.0f));
+
+        // Octahedral encoding of the normal pre-scaled by the inverse dequantize scale
+        glm::vec3 scaled = glm::normalize(normal / extent);
+        scaled /= fabs(scaled.x) + fabs(scaled.y) + fabs(scaled.z);
+        float octahedral[2] = { scaled.x, scaled.y };
+        if (scaled.z < 0.0f) {
+            octahedral[0] = (1.0f - fabs(scaled.y)) * (scaled.x >= 0.0f ? 1.0f : -1.0f);
+            octahedral[1] = (1.0f - fabs(scaled.x)) * (scaled.y >= 0.0f ? 1.0f : -1.0f);
+        }
+        int16_t packedNormal[2] = { UFloatToSnorm16(octahedral[0]), UFloatToSnorm16(octahedral[1]) };
+
+        memcpy(destination, packedPosition, 8);
+        memcpy(destination + 8, packedColor, 4);
+        memcpy(destination + 12, packedHalfs, 4);
+        memcpy(destination + 16, packedNormal, 4);
+    }
+}
+
+// Function to build the matrix that maps a mesh's stored positions back to mesh space
+static glm::mat4 UDequantizeMatrix(const GLMesh& mesh) {
+    if (gVertexFormat == VERTEX_FLOAT)
+        return glm::mat4(1.0f);
+    glm::vec3 center, extent;
+    UQuantizationBounds(mesh, center, extent);
+    return glm::scale(glm::translate(glm::mat4(1.0f), center), extent);
+}
+
+// Function to give the size in bytes of one index of an index type
+static GLsizeiptr UIndexSize(GLenum indexType) {
+    return indexType == GL_UNSIGNED_INT ? sizeof(GLuint) : sizeof(GLushort);
+}
+
+// Function to split a level's triangles, in order, into meshlets of at most MESHLET_MAX_VERTICES vertices.
+// Fills gMeshletVertices and gMeshletIndices and returns where each meshlet starts in them, as pairs of
+// (first vertex, first index) with a closing pair at the end.
+static vector<pair<int, int>> USplitMeshlets(const GLuint* indices, int vertexCount, int indexCount) {
+    U_PROFILE_FUNCTION();
+    gMeshletOwner.assign(vertexCount, -1);
+    gMeshletLocalIndex.resize(vertexCount);
+    gMeshletVertices.clear();
+    gMeshletIndices.clear();
+
+    vector<pair<int, int>> starts(1, make_pair(0, 0));
+    int meshlet = 0;
+    int meshletVertices = 0;
+    for (int t = 0; t + 2 < indexCount; t += 3) {
+        int added = 0;
+        for (int c = 0; c < 3; ++c) {
+            GLuint v = indices[t + c];
+            bool seen = gMeshletOwner[v] == meshlet;
+            for (int earlier = 0; earlier < c; ++earlier)
+                seen = seen || indices[t + earlier] == v;
+            if (!seen)
+                added++;
+        }
+
+        if (meshletVertices + added > MESHLET_MAX_VERTICES) {
+            starts.push_back(make_pair(static_cast<int>(gMeshletVertices.size()), static_cast<int>(gMeshletIndices.size())));
+            meshlet++;
+            meshletVertices = 0;
+        }
+
+        for (int c = 0; c < 3; ++c) {
+            GLuint v = indices[t + c];
+            if (gMeshletOwner[v] != meshlet) {
+                gMeshletOwner[v] = meshlet;
+                gMeshletLocalIndex[v] = meshletVertices++;
+                gMeshletVertices.push_back(v);
+            }
+            gMeshletIndices.push_back(static_cast<GLushort>(gMeshletLocalIndex[v]));
+        }
+    }
+    starts.push_back(make_pair(static_cast<int>(gMeshletVertices.size()), static_cast<int>(gMeshletIndices.size())));
+    return starts;
+}
+
+// Function to compute the mesh-space bounds of the vertices a run of indices refers to
+static void UIndexedBounds(const GLfloat* vertices, const GLuint* indices, int indexCount, glm::vec3& boundsMin, glm::vec3& boundsMax) {
+    boundsMin = glm::vec3(FLT_MAX);
+    boundsMax = glm::vec3(-FLT_MAX);
+    for (int i = 0; i < indexCount; ++i) {
+        const GLfloat* position = vertices + indices[i] * FLOATS_PER_VERTEX;
+        glm::vec3 point(position[0], position[1], position[2]);
+        boundsMin = glm::min(boundsMin, point);
+        boundsMax = glm::max(boundsMax, point);
+    }
+}
+
+// Function to make room in the pool for more vertices and index bytes, doubling the buffers as needed
+static void UReserveGeometryPool(GLGeometryPool& pool, GLsizei vertexCount, GLsizeiptr indexBytes) {
+    const GLsizeiptr vertexSize = VERTEX_FORMAT_STRIDES[gVertexFormat];
+    if (pool.vertexCount + vertexCount <= pool.vertexCapacity && pool.indexBytes + indexBytes <= pool.indexByteCapacity)
+        return;
+
+    GLsizei newVertexCapacity = pool.vertexCapacity;
+    GLsizeiptr newIndexByteCapacity = pool.indexByteCapacity;
+    while (pool.vertexCount + vertexCount > newVertexCapacity)
+        newVertexCapacity *= 2;
+    while (pool.indexBytes + indexBytes > newIndexByteCapacity)
+        newIndexByteCapacity *= 2;
+
+    UGrowGeometryPoolBuffer(pool.vbos[0], pool.vertexCount * vertexSize, newVertexCapacity * vertexSize);
+    UGrowGeometryPoolBuffer(pool.vbos[1], pool.indexBytes, newIndexByteCapacity);
+    pool.vertexCapacity = newVertexCapacity;
+    pool.indexByteCapacity = newIndexByteCapacity;
+    UBindGeometryPoolAttributes(pool);
+}
+
+// Function to sub-allocate a range of the geometry pool for a level and upload it as given: vertices
+// already in the pool's format, indices of indexType, and meshlets whose first index and base vertex are
+// relative to the level's own indices and vertices
+static void UUploadMeshLod(GLMeshLod& lod, const void* vertices, GLsizei vertexCount, const void* indices, GLsizei indexCount, GLenum indexType,
+    const GLMeshlet* meshlets, int meshletCount) {
+    U_PROFILE_FUNCTION();
+    GLGeometryPool& pool = gGeometryPool;
+    const GLsizeiptr vertexSize = VERTEX_FORMAT_STRIDES[gVertexFormat];
+
+    lod.nIndices = indexCount;
+    lod.indexType = indexType;
+    lod.firstMeshlet = static_cast<int>(pool.meshlets.size());
+    lod.meshletCount = meshletCount;
+    lod.error = 0.0f;
+
+    // 32-bit indices have to start on a 4-byte boundary
+    GLsizeiptr indexStart = indexType == GL_UNSIGNED_INT ? (pool.indexBytes + 3) & ~static_cast<GLsizeiptr>(3) : pool.indexBytes;
+    GLsizeiptr indexBytes = indexCount * UIndexSize(indexType);
+    UReserveGeometryPool(pool, vertexCount, indexStart - pool.indexBytes + indexBytes);
+
+    for (int m = 0; m < meshletCount; ++m) {
+        GLMeshlet meshlet = meshlets[m];
+        meshlet.firstIndex += static_cast<GLuint>(indexStart / UIndexSize(indexType));
+        meshlet.baseVertex += pool.vertexCount;
+        pool.meshlets.push_back(meshlet);
+    }
+
+    glBindBuffer(GL_ARRAY_BUFFER, pool.vbos[0]);
+    glBufferSubData(GL_ARRAY_BUFFER, pool.vertexCount * vertexSize, vertexCount * vertexSize, vertices);
+    glBindBuffer(GL_ARRAY_BUFFER, pool.vbos[1]);
+    glBufferSubData(GL_ARRAY_BUFFER, indexStart, indexBytes, indices);
+    glBindBuffer(GL_ARRAY_BUFFER, 0);
+
+    pool.vertexCount += vertexCount;
+    pool.indexBytes = indexStart + indexBytes;
+}
+
+// Function to lay out a level for the geometry pool and upload it. Levels that fit 16-bit indices become
+// one meshlet. Larger ones are split into meshlets, each with its own copy of the vertices it shares with
+// its neighbours; if those copies would cost more than 32-bit indices save, the level keeps its vertices
+// whole and uses 32-bit indices instead, with the same triangle runs as meshlets so it can still be
+// culled piece by piece. Source vertices give the meshlet bounds; encoded vertices are what gets
+// uploaded, and what a pack being written records.
+static void UAllocateMeshLod(GLMeshLod& lod, const GLfloat* sourceVertices, const void* vertices, const GLuint* indices, int vertexCount, int indexCount) {
+    U_PROFILE_FUNCTION();
+    const GLsizeiptr vertexSize = VERTEX_FORMAT_STRIDES[gVertexFormat];
+    vector<GLMeshlet> meshlets;
+
+    GLenum indexType = GL_UNSIGNED_SHORT;
+    GLsizei uploadVertices = vertexCount;
+    const void* uploadData = vertices;
+    const void* indexData;
+    if (vertexCount <= MESHLET_MAX_VERTICES) {
+        gMeshletIndices.assign(indices, indices + indexCount);
+        indexData = gMeshletIndices.data();
+
+        GLMeshlet meshlet;
+        meshlet.nIndices = indexCount;
+        meshlet.firstIndex = 0;
+        meshlet.baseVertex = 0;
+        UIndexedBounds(sourceVertices, indices, indexCount, meshlet.boundsMin, meshlet.boundsMax);
+        meshlets.push_back(meshlet);
+    }
+    else {
+        vector<pair<int, int>> starts = USplitMeshlets(indices, vertexCount, indexCount);
+        int meshletCount = static_cast<int>(starts.size()) - 1;
+        GLsizei splitVertices = static_cast<GLsizei>(gMeshletVertices.size());
+        GLsizeiptr splitBytes = splitVertices * vertexSize + indexCount * static_cast<GLsizeiptr>(sizeof(GLushort));
+        GLsizeiptr wideBytes = vertexCount * vertexSize + indexCount * static_cast<GLsizeiptr>(sizeof(GLuint));
+        bool wide = wideBytes < splitBytes;
+
+        for (int m = 0; m < meshletCount; ++m) {
+            GLMeshlet meshlet;
+            meshlet.nIndices = starts[m + 1].second - starts[m].second;
+            meshlet.firstIndex = starts[m].second;
+            meshlet.baseVertex = wide ? 0 : starts[m].first;
+            UIndexedBounds(sourceVertices, indices + starts[m].second, meshlet.nIndices, meshlet.boundsMin, meshlet.boundsMax);
+            meshlets.push_back(meshlet);
+        }
+
+        if (wide) {
+            indexType = GL_UNSIGNED_INT;
+            indexData = indices;
+        }
+        else {
+            // Gather each meshlet's vertices so its local indices address them from its base vertex
+            const unsigned char* source = static_cast<const unsigned char*>(vertices);
+            gMeshletVertexData.resize(static_cast<size_t>(splitVertices) * vertexSize);
+            for (GLsizei v = 0; v < splitVertices; ++v)
+                memcpy(&gMeshletVertexData[v * vertexSize], source + gMeshletVertices[v] * vertexSize, vertexSize);
+            uploadVertices = splitVertices;
+            uploadData = gMeshletVertexData.data();
+            indexData = gMeshletIndices.data();
+        }
+
+        cout << "INFO: meshlets: " << vertexCount << " vertices in " << meshletCount << " meshlets, "
+            << (wide ? "32-bit indices (" : "16-bit indices (") << splitBytes / 1024 << " KiB split, " << wideBytes / 1024 << " KiB with 32-bit indices)" << endl;
+    }
+
+    int meshletCount = static_cast<int>(meshlets.size());
+    UUploadMeshLod(lod, uploadData, uploadVertices, indexData, indexCount, indexType, meshlets.data(), meshletCount);
+    if (gPackWriter.capturing)
+        UCapturePackedMeshLod(gPackWriter, uploadData, uploadVertices, indexData, indexCount, indexType, meshlets.data(), meshletCount);
+}
+
+// Function to tell whether any vertex has a color other than color
+static bool UHasVertexColors(const GLfloat* vertices, int vertexCount, const glm::vec4& color) {
+    for (int i = 0; i < vertexCount; ++i) {
+        const GLfloat* vertex = vertices + i * FLOATS_PER_VERTEX;
+        if (vertex[3] != color.x || vertex[4] != color.y || vertex[5] != color.z || vertex[6] != color.w)
+            return true;
+    }
+    return false;
+}
+
+// Function to sub-allocate a mesh from the geometry pool and upload its vertices and indices
+void UCreateMesh(GLMesh& mesh, const GLfloat* vertices, const GLuint* indices, int vertexCount, int indexCount) {
+    U_PROFILE_FUNCTION();
+    UOptimizeMeshLod(vertices, indices, vertexCount, indexCount);
+    USplitCreases(vertices, indices, vertexCount, indexCount);
+    mesh.vao = gGeometryPool.vao;
+    mesh.lodCount = 1;
+
+    // Bounding box and sphere in mesh space, used for culling
+    mesh.boundsMin = glm::vec3(FLT_MAX);
+    mesh.boundsMax = glm::vec3(-FLT_MAX);
+    for (int i = 0; i < vertexCount; ++i) {
+        glm::vec3 position(vertices[i * FLOATS_PER_VERTEX], vertices[i * FLOATS_PER_VERTEX + 1], vertices[i * FLOATS_PER_VERTEX + 2]);
+        mesh.boundsMin = glm::min(mesh.boundsMin, position);
+        mesh.boundsMax = glm::max(mesh.boundsMax, position);
+    }
+    mesh.sphereCenter = (mesh.boundsMin + mesh.boundsMax) * 0.5f;
+    mesh.sphereRadius = 0.0f;
+    for (int i = 0; i < vertexCount; ++i) {
+        glm::vec3 position(vertices[i * FLOATS_PER_VERTEX], vertices[i * FLOATS_PER_VERTEX + 1], vertices[i * FLOATS_PER_VERTEX + 2]);
+        mesh.sphereRadius = max(mesh.sphereRadius, glm::length(position - mesh.sphereCenter));
+    }
+
+    mesh.color = glm::vec4(vertices[3], vertices[4], vertices[5], vertices[6]);
+    mesh.vertexColors = UHasVertexColors(vertices, vertexCount, mesh.color);
+
+    // Quantized positions are relative to the bounds, so these must be known before encoding
+    mesh.dequantize = UDequantizeMatrix(mesh);
+    UEncodeVertices(mesh, vertices, indices, vertexCount, indexCount, gEncodedVertices);
+    UAllocateMeshLod(mesh.lods[0], vertices, gEncodedVertices.data(), indices, vertexCount, indexCount);
+}
+
+// Function to append a coarser level of detail to a mesh. Levels must be added finest first and
+// stay within the bounds of the full-resolution mesh, which quantized positions are relative to.
+void UAddMeshLod(GLMesh& mesh, const GLfloat* vertices, const GLuint* indices, int vertexCount, int indexCount, float error) {
+    U_PROFILE_FUNCTION();
+    if (mesh.lodCount >= MAX_MESH_LODS) {
+        cout << "ERROR::MESH::TOO_MANY_LODS" << endl;
+        return;
+    }
+
+    UOptimizeMeshLod(vertices, indices, vertexCount, indexCount);
+    USplitCreases(vertices, indices, vertexCount, indexCount);
+    mesh.vertexColors = mesh.vertexColors || UHasVertexColors(vertices, vertexCount, mesh.color);
+    GLMeshLod& lod = mesh.lods[mesh.lodCount++];
+    UEncodeVertices(mesh, vertices, indices, vertexCount, indexCount, gEncodedVertices);
+    UAllocateMeshLod(lod, vertices, gEncodedVertices.data(), indices, vertexCount, indexCount);
+    lod.error = error;
+}
+
+// The pool owns the geometry, so destroying a mesh only forgets its range
+void UDestroyMesh(GLMesh& mesh) {
+    U_PROFILE_FUNCTION();
+    mesh.vao = 0;
+    mesh.lodCount = 0;
+}
+
+// Function to draw a single mesh with the currently bound program
+void UDrawMesh(const GLMesh& mesh) {
+    U_PROFILE_FUNCTION();
+    const GLMeshLod& lod = mesh.lods[0];
+    glBindVertexArray(mesh.vao);
+    for (int m = 0; m < lod.meshletCount; ++m) {
+        const GLMeshlet& meshlet = gGeometryPool.meshlets[lod.firstMeshlet + m];
+        glDrawElementsBaseVertex(GL_TRIANGLES, meshlet.nIndices, lod.indexType, (void*)(meshlet.firstIndex * UIndexSize(lod.indexType)), meshlet.baseVertex);
+        gFrameStats.drawCalls++;
+    }
+    gFrameStats.objects++;
+    gFrameStats.triangles += lod.nIndices / 3;
+}
+
+// Function to insert preprocessor lines into a shader source right after its #version line
+string UInjectDefines(const char* source, const string& defines) {
+    string injected = source;
+    size_t lineEnd = injected.find('\n');
+    injected.insert(lineEnd == string::npos ? injected.size() : lineEnd + 1, defines);
+    return injected;
+}
+
+// Function to give the vertex shaders the normal attribute type and decoding for a vertex format
+string UVertexFormatDefines(VertexFormat format) {
+    if (format == VERTEX_FLOAT)
+        return "#define NORMAL_TYPE vec3\n#define DECODE_NORMAL(n) normalize(n)\n";
+    return "#define NORMAL_TYPE vec2\n#define DECODE_NORMAL(n) normalize(octahedralDecode(n))\n";
+}
+
+// Function to give the shaders a 0 or 1 define for every feature
+string UShaderFeatureDefines(unsigned features) {
+    string defines;
+    for (int i = 0; i < SHADER_FEATURE_COUNT; ++i)
+        defines += string("#define ") + SHADER_FEATURE_NAMES[i] + ((features & (1u << i)) ? " 1\n" : " 0\n");
+    return defines;
+}
+
+// Function to get the program for a set of features, submitting it on first use. Like every program it
+// has id 0 until it is linked.
+const GLProgram& UShaderVariant(unsigned features) {
+    U_PROFILE_FUNCTION();
+    GLProgram& program = gShaderVariants.programs[features];
+    if (gShaderVariants.submitted[features])
+        return program;
+
+    gShaderVariants.submitted[features] = true;
+    string featureDefines = UShaderFeatureDefines(features);
+    UCreateShaderProgram(UInjectDefines(vertexShaderSource, featureDefines + gShaderVariants.vertexFormatDefines).c_str(),
+        UInjectDefines(fragmentShaderSource, featureDefines + UClusterDefines()).c_str(), program);
+    return program;
+}
+
+// Function to work out the fewest features that draw a material on a mesh as the full shader would.
+// A mesh of one color has it folded into the tint by UAddSceneObject, so it needs no vertex colors.
+unsigned UMaterialFeatures(const Material& material, const GLMesh& mesh) {
+    unsigned features = 0;
+    if (material.lit)
+        features |= SHADER_LIGHTING;
+    if (material.texture)
+        features |= SHADER_TEXTURE;
+    if (mesh.vertexColors)
+        features |= SHADER_VERTEX_COLOR;
+    return features;
+}
+
+void UDestroyShaderVariants(ShaderVariants& variants) {
+    U_PROFILE_FUNCTION();
+    for (int i = 0; i < SHADER_VARIANT_COUNT; ++i) {
+        UDestroyShaderProgram(variants.programs[i]);
+        variants.submitted[i] = false;
+    }
+}
+
+// Function to hash bytes with 64-bit FNV-1a, continuing from a previous hash
+static uint64_t UFnv1a(const void* data, size_t size, uint64_t hash) {
+    const unsigned char* bytes = static_cast<const unsigned char*>(data);
+    for (size_t i = 0; i < size; ++i) {
+        hash ^= bytes[i];
+        hash *= FNV_PRIME;
+    }
+    return hash;
+}
+
+// Function to set up the program binary cache in directory, or leave it off when directory is "off"
+// or the driver offers no binary formats
+void UOpenProgramCache(ProgramCache& cache, const string& directory) {
+    U_PROFILE_FUNCTION();
+    cache.directory.clear();
+    cache.hits = 0;
+    cache.misses = 0;
+    cache.rejected = 0;
+    cache.nsSaved = 0;
+
+    GLint formats = 0;
+    glGetIntegerv(GL_NUM_PROGRAM_BINARY_FORMATS, &formats);
+    if (directory.empty() || directory == "off" || formats == 0)
+        return;
+
+    error_code error;
+    filesystem::create_directories(directory, error);
+    if (error) {
+        cout << "ERROR::PROGRAM_CACHE::CANNOT_CREATE " << directory << endl;
+        return;
+    }
+    cache.directory = directory;
+
+    const GLenum driverStrings[] = { GL_VENDOR, GL_RENDERER, GL_VERSION, GL_SHADING_LANGUAGE_VERSION };
+    cache.driverHash = FNV_OFFSET_BASIS;
+    for (GLenum name : driverStrings) {
+        const char* value = reinterpret_cast<const char*>(glGetString(name));
+        if (value)
+            cache.driverHash = UFnv1a(value, strlen(value) + 1, cache.driverHash);
+    }
+}
+
+// Function to give the path of a program's cache entry
+static string UProgramCachePath(const ProgramCache& cache, uint64_t key) {
+    ostringstream path;
+    path << cache.directory << "/" << hex << key << ".bin";
+    return path.str();
+}
+
+// Function to load a cached binary into programId. Returns false on a miss or when the driver rejects
+// the binary, in which case the entry is deleted so it gets rebuilt.
+static bool ULoadCachedProgram(ProgramCache& cache, uint64_t key, GLuint programId) {
+    U_PROFILE_FUNCTION();
+    int64_t start = UProfileNow();
+    string path = UProgramCachePath(cache, key);
+    ifstream file(path, ios::binary);
+    ProgramCacheHeader header;
+    if (!file.read(reinterpret_cast<char*>(&header), sizeof(header)) || header.magic != PROGRAM_CACHE_MAGIC ||
+        header.version != PROGRAM_CACHE_VERSION || header.key != key)
+        return false;
+    vector<char> binary(header.binarySize);
+    if (!file.read(binary.data(), binary.size()))
+        return false;
+    file.close();
+
+    GLint success = 0;
+    glProgramBinary(programId, header.binaryFormat, binary.data(), static_cast<GLsizei>(binary.size()));
+    glGetProgramiv(programId, GL_LINK_STATUS, &success);
+    if (!success) {
+        cache.rejected++;
+        error_code error;
+        filesystem::remove(path, error);
+        return false;
+    }
+
+    cache.hits++;
+    cache.nsSaved += header.compileNs - (UProfileNow() - start);
+    return true;
+}
+
+// Function to write a linked program's binary to the cache, along with what building it cost
+static void UStoreCachedProgram(const ProgramCache& cache, uint64_t key, GLuint programId, int64_t compileNs) {
+    U_PROFILE_FUNCTION();
+    GLint length = 0;
+    glGetProgramiv(programId, GL_PROGRAM_BINARY_LENGTH, &length);
+    if (length <= 0)
+        return;
+
+    ProgramCacheHeader header;
+    vector<char> binary(length);
+    GLenum binaryFormat = 0;
+    glGetProgramBinary(programId, length, nullptr, &binaryFormat, binary.data());
+    header.magic = PROGRAM_CACHE_MAGIC;
+    header.version = PROGRAM_CACHE_VERSION;
+    header.key = key;
+    header.binaryFormat = binaryFormat;
+    header.binarySize = static_cast<uint32_t>(length);
+    header.compileNs = compileNs;
+
+    ofstream file(UProgramCachePath(cache, key), ios::binary | ios::trunc);
+    file.write(reinterpret_cast<const char*>(&header), sizeof(header));
+    file.write(binary.data(), binary.size());
+}
+
+// Function to set up the shader compiler, letting the driver compile on up to threads threads (or as
+// many as it likes when threads is negative) if it supports parallel shader compilation
+void UCreateShaderCompiler(ShaderCompiler& compiler, int threads) {
+    U_PROFILE_FUNCTION();
+    compiler.pending.clear();
+    compiler.submitted = 0;
+    compiler.finished = 0;
+    compiler.failed = 0;
+    compiler.start = UProfileNow();
+
+    GLuint count = threads < 0 ? 0xFFFFFFFFu : static_cast<GLuint>(threads);
+    compiler.parallel = GLEW_KHR_parallel_shader_compile || GLEW_ARB_parallel_shader_compile;
+    if (GLEW_KHR_parallel_shader_compile)
+        glMaxShaderCompilerThreadsKHR(count);
+    else if (GLEW_ARB_parallel_shader_compile)
+        glMaxShaderCompilerThreadsARB(count);
+}
+
+// Function to start building a program from one source per stage. A binary in the program cache for
+// the same sources and driver is loaded on the spot; otherwise every stage is handed to the driver to
+// compile and the build is left pending. ready is called once the program is linked.
+void USubmitProgram(ShaderCompiler& compiler, ProgramCache& cache, const GLenum* stages, const char* const* sources, int stageCount, function<void(GLuint)> ready) {
+    U_PROFILE_FUNCTION();
+    compiler.submitted++;
+
+    ProgramBuild build;
+    build.programId = glCreateProgram();
+    build.stageCount = stageCount;
+    build.submitted = UProfileNow();
+    build.linking = false;
+    build.ready = move(ready);
+
+    bool caching = !cache.directory.empty();
+    build.key = cache.driverHash;
+    for (int i = 0; caching && i < stageCount; ++i) {
+        build.key = UFnv1a(&stages[i], sizeof(stages[i]), build.key);
+        build.key = UFnv1a(sources[i], strlen(sources[i]), build.key);
+    }
+    if (caching && ULoadCachedProgram(cache, build.key, build.programId)) {
+        compiler.finished++;
+        build.ready(build.programId);
+        return;
+    }
+
+    // No status is queried here; that would wait for the compile
+    for (int i = 0; i < stageCount; ++i) {
+        build.stages[i] = stages[i];
+        build.shaderIds[i] = glCreateShader(stages[i]);
+        glShaderSource(build.shaderIds[i], 1, &sources[i], NULL);
+        glCompileShader(build.shaderIds[i]);
+    }
+    compiler.pending.push_back(move(build));
+}
+
+// Function to move a build along as far as it goes without waiting on the driver, or all the way when
+// wait is set: link once every stage has compiled, then hand the program over once it has linked.
+// Prints the stage's compile log, or the link log, on failure.
+static ProgramBuildStatus UAdvanceProgramBuild(const ShaderCompiler& compiler, ProgramCache& cache, ProgramBuild& build, bool wait) {
+    U_PROFILE_FUNCTION();
+    bool poll = compiler.parallel && !wait;
+    GLint status = GL_TRUE;
+    char infoLog[512];
+
+    if (!build.linking) {
+        for (int i = 0; poll && i < build.stageCount; ++i) {
+            glGetShaderiv(build.shaderIds[i], GL_COMPLETION_STATUS_KHR, &status);
+            if (!status)
+                return PROGRAM_BUILD_PENDING;
+        }
+        for (int i = 0; i < build.stageCount; ++i) {
+            glGetShaderiv(build.shaderIds[i], GL_COMPILE_STATUS, &status);
+            if (!status) {
+                const char* stageName = build.stages[i] == GL_VERTEX_SHADER ? "VERTEX" : (build.stages[i] == GL_FRAGMENT_SHADER ? "FRAGMENT" : "COMPUTE");
+                glGetShaderInfoLog(build.shaderIds[i], sizeof(infoLog), NULL, infoLog);
+                cout << "ERROR::SHADER::" << stageName << "::COMPILATION_FAILED\n" << infoLog << endl;
+                for (int j = 0; j < build.stageCount; ++j)
+                    glDeleteShader(build.shaderIds[j]);
+                glDeleteProgram(build.programId);
+                return PROGRAM_BUILD_FAILED;
+            }
+            glAttachShader(build.programId, build.shaderIds[i]);
+        }
+
+        if (!cache.directory.empty())
+            glProgramParameteri(build.programId, GL_PROGRAM_BINARY_RETRIEVABLE_HINT, GL_TRUE);
+        glLinkProgram(build.programId);
+        build.linking = true;
+    }
+
+    if (poll) {
+        glGetProgramiv(build.programId, GL_COMPLETION_STATUS_KHR, &status);
+        if (!status)
+            return PROGRAM_BUILD_PENDING;
+    }
+    for (int i = 0; i < build.stageCount; ++i) {
+        glDetachShader(build.programId, build.shaderIds[i]);
+        glDeleteShader(build.shaderIds[i]);
+    }
+    glGetProgramiv(build.programId, GL_LINK_STATUS, &status);
+    if (!status) {
+        glGetProgramInfoLog(build.programId, sizeof(infoLog), NULL, infoLog);
+        cout << "ERROR::SHADER::PROGRAM::LINKING_FAILED\n" << infoLog << endl;
+        glDeleteProgram(build.programId);
+        return PROGRAM_BUILD_FAILED;
+    }
+
+    // The time stored is from submission, so with builds overlapping it is an upper bound
+    if (!cache.directory.empty()) {
+        cache.misses++;
+        UStoreCachedProgram(cache, build.key, build.programId, UProfileNow() - build.submitted);
+    }
+    build.ready(build.programId);
+    return PROGRAM_BUILD_READY;
+}
+
+// Function to advance every pending build, or to finish them all when wait is set. Returns false if a
+// build failed during this call.
+bool UPollShaderCompiler(ShaderCompiler& compiler, ProgramCache& cache, bool wait) {
+    U_PROFILE_FUNCTION();
+    if (compiler.pending.empty())
+        return true;
+
+    int failed = compiler.failed;
+    size_t kept = 0;
+    for (size_t i = 0; i < compiler.pending.size(); ++i) {
+        ProgramBuildStatus status = UAdvanceProgramBuild(compiler, cache, compiler.pending[i], wait);
+        if (status == PROGRAM_BUILD_PENDING) {
+            if (kept != i)
+                compiler.pending[kept] = move(compiler.pending[i]);
+            kept++;
+        }
+        else if (status == PROGRAM_BUILD_READY)
+            compiler.finished++;
+        else
+            compiler.failed++;
+    }
+    compiler.pending.erase(compiler.pending.begin() + kept, compiler.pending.end());
+
+    if (compiler.pending.empty())
+        cout << "INFO: shader compiler: " << compiler.finished << " of " << compiler.submitted << " programs ready "
+            << (UProfileNow() - compiler.start) / 1.0e6 << " ms after submission" << endl;
+    return compiler.failed == failed;
+}
+
+// Function to drop the builds still pending, as when the run ends before they finish
+void UDestroyShaderCompiler(ShaderCompiler& compiler) {
+    U_PROFILE_FUNCTION();
+    for (size_t i = 0; i < compiler.pending.size(); ++i) {
+        const ProgramBuild& build = compiler.pending[i];
+        for (int j = 0; j < build.stageCount; ++j)
+            glDeleteShader(build.shaderIds[j]);
+        glDeleteProgram(build.programId);
+    }
+    compiler.pending.clear();
+}
+
+// Function to print how the program cache did this run
+void UReportProgramCache(const ProgramCache& cache) {
+    if (cache.directory.empty()) {
+        cout << "INFO: program cache: off" << endl;
+        return;
+    }
+    cout << "INFO: program cache: " << cache.hits << " hits, " << cache.misses << " misses, " << cache.rejected << " rejected by the driver, "
+        << cache.nsSaved / 1.0e6 << " ms saved" << endl;
+}
+
+// Function to submit a graphics program; program.id stays 0, and draws using it are skipped, until it is linked
+void UCreateShaderProgram(const char* vtxShaderSource, const char* fragShaderSource, GLProgram& program) {
+    U_PROFILE_FUNCTION();
+    const GLenum stages[] = { GL_VERTEX_SHADER, GL_FRAGMENT_SHADER };
+    const char* sources[] = { vtxShaderSource, fragShaderSource };
+    program.id = 0;
+    USubmitProgram(gShaderCompiler, gProgramCache, stages, sources, 2, [&program](GLuint programId) {
+        // Reflect the uniforms once here so rendering never looks them up by name
+        program.modelLoc = glGetUniformLocation(programId, "model");
+        program.tintLoc = glGetUniformLocation(programId, "tint");
+        program.textureLoc = glGetUniformLocation(programId, "uTexture");
+
+        GLuint frameDataIndex = glGetUniformBlockIndex(programId, "FrameData");
+        if (frameDataIndex != GL_INVALID_INDEX)
+            glUniformBlockBinding(programId, frameDataIndex, FRAME_DATA_BINDING);
+
+        glUseProgram(programId);
+        // We set the texture as texture unit 0 (only has to be done once)
+        if (program.textureLoc >= 0)
+            glUniform1i(program.textureLoc, 0);
+        // Untinted until a draw sets it
+        if (program.tintLoc >= 0)
+            glUniform4f(program.tintLoc, 1.0f, 1.0f, 1.0f, 1.0f);
+        program.id = programId;
+    });
+}
+
+void UDestroyShaderProgram(GLProgram& program) {
+    U_PROFILE_FUNCTION();
+    glDeleteProgram(program.id);
+    program.id = 0;
+}
+
+// Function to create a persistently mapped streaming buffer with MAX_FRAMES_IN_FLIGHT regions of
+// regionSize bytes each. The buffer is bound to no target; users bind the ranges they allocate.
+void UCreateStreamBuffer(GLStreamBuffer& stream, GLsizeiptr regionSize) {
+    U_PROFILE_FUNCTION();
+    const GLbitfield flags = GL_MAP_WRITE_BIT | GL_MAP_PERSISTENT_BIT | GL_MAP_COHERENT_BIT;
+
+    stream.regionSize = regionSize;
+    stream.region = -1;
+    stream.used = 0;
+
+    glGenBuffers(1, &stream.buffer);
+    glBindBuffer(GL_COPY_WRITE_BUFFER, stream.buffer);
+    glBufferStorage(GL_COPY_WRITE_BUFFER, regionSize * MAX_FRAMES_IN_FLIGHT, nullptr, flags);
+    stream.mapped = static_cast<GLbyte*>(glMapBufferRange(GL_COPY_WRITE_BUFFER, 0, regionSize * MAX_FRAMES_IN_FLIGHT, flags));
+    glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+
+    if (!stream.mapped)
+        cout << "ERROR::STREAM::MAP_FAILED" << endl;
+}
+
+void UDestroyStreamBuffer(GLStreamBuffer& stream) {
+    U_PROFILE_FUNCTION();
+    // Deleting a mapped buffer unmaps it
+    glDeleteBuffers(1, &stream.buffer);
+    stream.buffer = 0;
+    stream.mapped = nullptr;
+}
+
+// Function to reserve size bytes of the current frame's region and return where to write them; offset
+// receives their position in the buffer. A region that is too small is replaced by a larger buffer.
+// Ranges allocated earlier in the frame stay valid for the commands that already used them, because
+// the old buffer lives on until the GPU is done with it, but they must not be used again afterwards.
+GLbyte* UStreamAllocate(GLStreamBuffer& stream, GLsizeiptr size, GLsizeiptr alignment, GLintptr& offset) {
+    U_PROFILE_FUNCTION();
+    if (stream.region != gStreamFences.region) {
+        stream.region = gStreamFences.region;
+        stream.used = 0;
+    }
+
+    GLintptr regionStart = stream.region * stream.regionSize;
+    offset = (regionStart + stream.used + alignment - 1) / alignment * alignment;
+    if (offset + size > regionStart + stream.regionSize) {
+        GLsizeiptr regionSize = stream.regionSize * 2;
+        while (regionSize < size + alignment)
+            regionSize *= 2;
+
+        // Create the replacement before deleting the old buffer so the two never share a name
+        GLStreamBuffer grown;
+        UCreateStreamBuffer(grown, regionSize);
+        UDestroyStreamBuffer(stream);
+        stream = grown;
+        stream.region = gStreamFences.region;
+
+        regionStart = stream.region * stream.regionSize;
+        offset = (regionStart + alignment - 1) / alignment * alignment;
+    }
+
+    stream.used = offset + size - regionStart;
+    return stream.mapped + offset;
+}
+
+// Function to start a frame's use of the streaming buffers: moves to the next region and, if the GPU
+// has not finished the frame that last wrote it, waits and records how long that took
+void UBeginStreamFrame(GLStreamFences& fences) {
+    U_PROFILE_FUNCTION();
+    fences.region = (fences.region + 1) % gFramesInFlight;
+    fences.frameWaitMs = 0.0;
+    fences.frames++;
+
+    GLsync fence = fences.fences[fences.region];
+    if (!fence)
+        return;
+
+    GLenum result = glClientWaitSync(fence, 0, 0);
+    if (result == GL_TIMEOUT_EXPIRED) {
+        chrono::steady_clock::time_point start = chrono::steady_clock::now();
+        do {
+            result = glClientWaitSync(fence, GL_SYNC_FLUSH_COMMANDS_BIT, 1000000000); // one second, in nanoseconds
+        } while (result == GL_TIMEOUT_EXPIRED);
+        fences.frameWaitMs = chrono::duration<double, milli>(chrono::steady_clock::now() - start).count();
+        fences.totalWaitMs += fences.frameWaitMs;
+        fences.framesWaited++;
+    }
+    if (result == GL_WAIT_FAILED)
+        cout << "ERROR::STREAM::FENCE_WAIT_FAILED" << endl;
+
+    glDeleteSync(fence);
+    fences.fences[fences.region] = 0;
+}
+
+// Function to mark the end of the commands that read the current frame's regions
+void UEndStreamFrame(GLStreamFences& fences) {
+    U_PROFILE_FUNCTION();
+    fences.fences[fences.region] = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+}
+
+void UDestroyStreamFences(GLStreamFences& fences) {
+    U_PROFILE_FUNCTION();
+    for (int i = 0; i < MAX_FRAMES_IN_FLIGHT; ++i) {
+        if (fences.fences[i])
+            glDeleteSync(fences.fences[i]);
+        fences.fences[i] = 0;
+    }
+}
+
+// Function to turn zone recording on for the frames in the trace range; frame 0 is startup
+void USetTraceFrame(unsigned frame) {
+#if U_PROFILE
+    gProfileRecording.store(!gTracePath.empty() && frame >= gTraceFirstFrame && frame <= gTraceLastFrame, memory_order_relaxed);
+#endif
+}
+
+// Function to write one zone as a Chrome trace_event complete event, with times in microseconds
+static void UWriteTraceEvent(ofstream& file, const ProfileEvent& event, int threadId, bool& first) {
+    file << (first ? "" : ",\n") << "{\"name\":\"" << event.name << "\",\"ph\":\"X\",\"pid\":1,\"tid\":" << threadId
+        << ",\"ts\":" << event.start / 1000.0 << ",\"dur\":" << (event.end - event.start) / 1000.0 << "}";
+    first = false;
+}
+
+// Function to write the recorded CPU and GPU zones as Chrome trace_event JSON, viewable in
+// chrome://tracing or Perfetto. GPU zones go on their own track, moved onto the CPU clock.
+bool UExportTrace(const string& path) {
+#if U_PROFILE
+    const int GPU_TRACK = 1000;
+
+    ofstream file(path.c_str());
+    if (!file) {
+        cout << "ERROR::PROFILE::CANNOT_WRITE " << path << endl;
+        return false;
+    }
+    file.precision(15);
+
+    bool first = true;
+    uint32_t dropped = 0;
+    file << "{\"traceEvents\":[\n";
+
+    lock_guard<mutex> lock(gProfileRingsMutex);
+    for (size_t i = 0; i < gProfileRings.size(); ++i) {
+        const ProfileRing& ring = *gProfileRings[i];
+        file << (first ? "" : ",\n") << "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":" << ring.threadIndex
+            << ",\"args\":{\"name\":\"" << (ring.threadIndex == 0 ? "main" : "worker " + to_string(ring.threadIndex)) << "\"}}";
+        first = false;
+
+        uint32_t count = ring.count.load(memory_order_acquire);
+        for (uint32_t e = 0; e < count; ++e)
+            UWriteTraceEvent(file, ring.events[e], ring.threadIndex, first);
+        dropped += ring.dropped.load(memory_order_relaxed);
+    }
+
+    file << (first ? "" : ",\n") << "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":" << GPU_TRACK << ",\"args\":{\"name\":\"GPU\"}}";
+    first = false;
+    for (size_t i = 0; i < gGpuProfiler.traceEvents.size(); ++i)
+        UWriteTraceEvent(file, gGpuProfiler.traceEvents[i], GPU_TRACK, first);
+    file << "\n]}\n";
+
+    cout << "INFO: trace of frames " << gTraceFirstFrame << "-" << gTraceLastFrame << " written to " << path;
+    if (dropped > 0)
+        cout << " (" << dropped << " zones dropped, rings full)";
+    cout << endl;
+    return true;
+#else
+    cout << "ERROR::PROFILE::TRACE_NOT_COMPILED_IN (build with U_PROFILE=1)" << endl;
+    return false;
+#endif
+}
+
+// Function to add a sample to a rolling timing
+void URecordTiming(GLTimingStats& timing, float milliseconds) {
+    U_PROFILE_FUNCTION();
+    if (static_cast<int>(timing.samples.size()) < TIMING_WINDOW)
+        timing.samples.push_back(milliseconds);
+    else
+        timing.samples[timing.next] = milliseconds;
+    timing.next = (timing.next + 1) % TIMING_WINDOW;
+}
+
+// Function to compute the minimum, average and 99th percentile of a timing's current window
+static void USummarizeTiming(const GLTimingStats& timing, float& minMs, float& avgMs, float& p99Ms) {
+    U_PROFILE_FUNCTION();
+    minMs = avgMs = p99Ms = 0.0f;
+    if (timing.samples.empty())
+        return;
+
+    vector<float> sorted(timing.samples);
+    sort(sorted.begin(), sorted.end());
+    float sum = 0.0f;
+    for (size_t i = 0; i < sorted.size(); ++i)
+        sum += sorted[i];
+    minMs = sorted.front();
+    avgMs = sum / sorted.size();
+    p99Ms = sorted[min(sorted.size() - 1, static_cast<size_t>(sorted.size() * 0.99f))];
+}
+
+void UCreateGpuProfiler(GLGpuProfiler& profiler) {
+    U_PROFILE_FUNCTION();
+    for (int i = 0; i < GPU_PROFILER_FRAMES; ++i) {
+        glGenQueries(MAX_GPU_QUERIES, profiler.frames[i].queries);
+        profiler.frames[i].queryCount = 0;
+        profiler.frames[i].lastQuery = 0;
+        profiler.frames[i].traced = false;
+    }
+    profiler.frame = 0;
+    profiler.droppedFrames = 0;
+
+    // Offset between the GPU clock and the CPU profiler clock, so GPU zones line up in the trace
+    GLint64 gpuNow = 0;
+    glGetInteger64v(GL_TIMESTAMP, &gpuNow);
+    profiler.clockOffset = gpuNow - UProfileNow();
+}
+
+void UDestroyGpuProfiler(GLGpuProfiler& profiler) {
+    U_PROFILE_FUNCTION();
+    for (int i = 0; i < GPU_PROFILER_FRAMES; ++i)
+        glDeleteQueries(MAX_GPU_QUERIES, profiler.frames[i].queries);
+}
+
+// Function to collect a pending frame's timestamps into the scope statistics; returns false, without
+// waiting, if the GPU has not reached the last query the frame issued yet
+static bool UReadGpuFrame(GLGpuProfiler& profiler, GLGpuProfilerFrame& frame) {
+    U_PROFILE_FUNCTION();
+    GLuint available = 0;
+    glGetQueryObjectuiv(frame.queries[frame.lastQuery], GL_QUERY_RESULT_AVAILABLE, &available);
+    if (!available)
+        return false;
+
+    // Timestamps complete in order, so every query issued before it is available too
+    for (size_t i = 0; i < frame.scopes.size(); ++i) {
+        const GLGpuScopeRecord& record = frame.scopes[i];
+        if (record.stats < 0)
+            continue;
+        GLuint64 begin = 0, end = 0;
+        glGetQueryObjectui64v(frame.queries[record.beginQuery], GL_QUERY_RESULT, &begin);
+        glGetQueryObjectui64v(frame.queries[record.endQuery], GL_QUERY_RESULT, &end);
+        URecordTiming(profiler.scopes[record.stats], static_cast<float>((end - begin) / 1.0e6));
+
+        if (frame.traced) {
+            ProfileEvent event;
+            event.name = profiler.scopes[record.stats].name;
+            event.start = static_cast<int64_t>(begin) - profiler.clockOffset;
+            event.end = static_cast<int64_t>(end) - profiler.clockOffset;
+            profiler.traceEvents.push_back(event);
+        }
+    }
+    frame.queryCount = 0;
+    return true;
+}
+
+// Function to start profiling a frame: reads back whatever earlier frames have finished, oldest first,
+// then takes the next query pool. A pool whose results are still pending by then is dropped rather
+// than waited for.
+void UBeginGpuFrame(GLGpuProfiler& profiler) {
+    U_PROFILE_FUNCTION();
+    for (int i = 1; i <= GPU_PROFILER_FRAMES; ++i) {
+        GLGpuProfilerFrame& frame = profiler.frames[(profiler.frame + i) % GPU_PROFILER_FRAMES];
+        if (frame.queryCount > 0 && !UReadGpuFrame(profiler, frame))
+            break;
+    }
+
+    profiler.frame = (profiler.frame + 1) % GPU_PROFILER_FRAMES;
+    GLGpuProfilerFrame& frame = profiler.frames[profiler.frame];
+    if (frame.queryCount > 0)
+        profiler.droppedFrames++;
+    frame.queryCount = 0;
+    frame.lastQuery = 0;
+    frame.scopes.clear();
+    profiler.stack.clear();
+#if U_PROFILE
+    frame.traced = gProfileRecording.load(memory_order_relaxed);
+#else
+    frame.traced = false;
+#endif
+}
+
+// Function to open a named GPU scope; scopes nest and must be closed in reverse order. The name must
+// outlive the profiler, which in practice means a string literal.
+void UBeginGpuScope(GLGpuProfiler& profiler, const char* name) {
+    U_PROFILE_FUNCTION();
+    GLGpuProfilerFrame& frame = profiler.frames[profiler.frame];
+    int depth = static_cast<int>(profiler.stack.size());
+
+    GLGpuScopeRecord record;
+    record.stats = -1;
+    record.beginQuery = record.endQuery = 0;
+    if (frame.queryCount + 2 <= MAX_GPU_QUERIES) {
+        for (size_t i = 0; i < profiler.scopes.size() && record.stats < 0; ++i) {
+            if (profiler.scopes[i].depth == depth && strcmp(profiler.scopes[i].name, name) == 0)
+                record.stats = static_cast<int>(i);
+        }
+        if (record.stats < 0) {
+            GLTimingStats timing = { name, depth, vector<float>(), 0 };
+            profiler.scopes.push_back(timing);
+            record.stats = static_cast<int>(profiler.scopes.size()) - 1;
+        }
+
+        record.beginQuery = frame.queryCount++;
+        record.endQuery = frame.queryCount++;
+        glQueryCounter(frame.queries[record.beginQuery], GL_TIMESTAMP);
+        frame.lastQuery = record.beginQuery;
+    }
+
+    profiler.stack.push_back(static_cast<int>(frame.scopes.size()));
+    frame.scopes.push_back(record);
+}
+
+void UEndGpuScope(GLGpuProfiler& profiler) {
+    U_PROFILE_FUNCTION();
+    GLGpuProfilerFrame& frame = profiler.frames[profiler.frame];
+    const GLGpuScopeRecord& record = frame.scopes[profiler.stack.back()];
+    profiler.stack.pop_back();
+    if (record.stats >= 0) {
+        glQueryCounter(frame.queries[record.endQuery], GL_TIMESTAMP);
+        frame.lastQuery = record.endQuery;
+    }
+}
+
+// Function to print the rolling CPU and GPU timings, one line per scope indented by depth
+void UPrintProfile() {
+    U_PROFILE_FUNCTION();
+    float minMs, avgMs, p99Ms;
+    USummarizeTiming(gCpuFrameTiming, minMs, avgMs, p99Ms);
+    cout << "INFO: cpu frame: min " << minMs << " avg " << avgMs << " p99 " << p99Ms << " ms" << endl;
+    USummarizeTiming(gCpuRenderTiming, minMs, avgMs, p99Ms);
+    cout << "INFO: cpu render: min " << minMs << " avg " << avgMs << " p99 " << p99Ms << " ms" << endl;
+
+    for (size_t i = 0; i < gGpuProfiler.scopes.size(); ++i) {
+        const GLTimingStats& timing = gGpuProfiler.scopes[i];
+        USummarizeTiming(timing, minMs, avgMs, p99Ms);
+        cout << "INFO: gpu " << string(timing.depth * 2, ' ') << timing.name << ": min " << minMs << " avg " << avgMs << " p99 " << p99Ms << " ms" << endl;
+    }
+    if (gGpuProfiler.droppedFrames > 0)
+        cout << "INFO: gpu profiler dropped " << gGpuProfiler.droppedFrames << " frames whose results were late" << endl;
+}
+
+// Function to write one timing as a JSON object
+static void UWriteTimingJson(ofstream& file, const GLTimingStats& timing) {
+    U_PROFILE_FUNCTION();
+    float minMs, avgMs, p99Ms;
+    USummarizeTiming(timing, minMs, avgMs, p99Ms);
+    file << "    { \"name\": \"" << timing.name << "\", \"depth\": " << timing.depth << ", \"min\": " << minMs
+        << ", \"avg\": " << avgMs << ", \"p99\": " << p99Ms << ", \"samples\": " << timing.samples.size() << " }";
+}
+
+// Function to export the CPU and GPU timings, in milliseconds, as JSON
+bool UExportProfile(const string& path) {
+    U_PROFILE_FUNCTION();
+    ofstream file(path.c_str());
+    if (!file) {
+        cout << "ERROR::PROFILE::CANNOT_WRITE " << path << endl;
+        return false;
+    }
+
+    file << "{\n  \"cpu\": [\n";
+    UWriteTimingJson(file, gCpuFrameTiming);
+    file << ",\n";
+    UWriteTimingJson(file, gCpuRenderTiming);
+    file << "\n  ],\n  \"gpu\": [\n";
+    for (size_t i = 0; i < gGpuProfiler.scopes.size(); ++i) {
+        UWriteTimingJson(file, gGpuProfiler.scopes[i]);
+        file << (i + 1 < gGpuProfiler.scopes.size() ? ",\n" : "\n");
+    }
+    file << "  ],\n  \"gpuDroppedFrames\": " << gGpuProfiler.droppedFrames << "\n}\n";
+    return true;
+}
+
+// Function to create the streaming buffer holding the per-frame camera and light data
+void UCreateFrameDataBuffer(GLStreamBuffer& stream) {
+    U_PROFILE_FUNCTION();
+    GLsizeiptr regionSize = (sizeof(GLFrameData) + gUniformBufferAlignment - 1) / gUniformBufferAlignment * gUniformBufferAlignment;
+    UCreateStreamBuffer(stream, regionSize);
+}
+
+// Function to write the per-frame data, called once at the start of every frame
+void UUpdateFrameDataBuffer(GLStreamBuffer& stream, const GLFrameData& frameData) {
+    U_PROFILE_FUNCTION();
+    GLintptr offset;
+    GLbyte* destination = UStreamAllocate(stream, sizeof(GLFrameData), gUniformBufferAlignment, offset);
+    memcpy(destination, &frameData, sizeof(GLFrameData));
+    glBindBufferRange(GL_UNIFORM_BUFFER, FRAME_DATA_BINDING, stream.buffer, offset, sizeof(GLFrameData));
+}
+
+void UDestroyFrameDataBuffer(GLStreamBuffer& stream) {
+    U_PROFILE_FUNCTION();
+    UDestroyStreamBuffer(stream);
+}
+
+// Function to reserve count instance records in the instance stream; baseInstance receives the index of
+// the first one as the instance attributes see it
+static GLInstance* UAllocateInstances(int count, GLuint& baseInstance) {
+    U_PROFILE_FUNCTION();
+    GLuint previousBuffer = gInstanceStream.buffer;
+    GLintptr offset;
+    GLInstance* instances = reinterpret_cast<GLInstance*>(UStreamAllocate(gInstanceStream, count * sizeof(GLInstance), sizeof(GLInstance), offset));
+
+    // A grown stream is a new buffer, so the pool's VAO has to be pointed at it again
+    if (gInstanceStream.buffer != previousBuffer)
+        UBindGeometryPoolAttributes(gGeometryPool);
+
+    baseInstance = static_cast<GLuint>(offset / sizeof(GLInstance));
+    return instances;
+}
+
+// Function to draw count copies of a mesh with one draw call; tints may be null for untinted instances
+void UDrawMeshInstanced(const GLMesh& mesh, const glm::mat4* transforms, const glm::vec4* tints, int count) {
+    U_PROFILE_FUNCTION();
+    const GLProgram& program = UShaderVariant(SHADER_FULL | SHADER_INSTANCING);
+    if (count <= 0 || !program.id)
+        return;
+
+    // Instance records are written straight into the mapped stream
+    GLuint baseInstance;
+    GLInstance* instances = UAllocateInstances(count, baseInstance);
+    for (int i = 0; i < count; ++i) {
+        instances[i].model = transforms[i] * mesh.dequantize;
+        instances[i].tint = tints ? tints[i] : glm::vec4(1.0f);
+    }
+
+    glUseProgram(program.id);
+    const GLMeshLod& lod = mesh.lods[0];
+    glBindVertexArray(mesh.vao);
+    for (int m = 0; m < lod.meshletCount; ++m) {
+        const GLMeshlet& meshlet = gGeometryPool.meshlets[lod.firstMeshlet + m];
+        glDrawElementsInstancedBaseVertexBaseInstance(GL_TRIANGLES, meshlet.nIndices, lod.indexType, (void*)(meshlet.firstIndex * UIndexSize(lod.indexType)),
+            count, meshlet.baseVertex, baseInstance);
+        gFrameStats.drawCalls++;
+    }
+
+    gFrameStats.objects += count;
+    gFrameStats.triangles += lod.nIndices / 3 * count;
+}
+
+// Function to append count copies of one level of a mesh to a draw list, as one indirect command per
+// meshlet (or just the given one) along with the world bounds of each meshlet's instances for the
+// occlusion culling pass. The commands share their instance records. Returns the number of commands added.
+int UDrawListAdd(GLDrawList& list, const GLMesh& mesh, int lod, int meshlet, const glm::mat4* transforms, const glm::vec4* tints, int count, int object) {
+    U_PROFILE_FUNCTION();
+    if (count <= 0)
+        return 0;
+
+    GLuint baseInstance = static_cast<GLuint>(list.instances.size());
+    for (int i = 0; i < count; ++i) {
+        GLInstance instance;
+        instance.model = transforms[i] * mesh.dequantize;
+        instance.tint = tints ? tints[i] : glm::vec4(1.0f);
+        list.instances.push_back(instance);
+    }
+
+    const GLMeshLod& level = mesh.lods[lod];
+    int firstMeshlet = meshlet < 0 ? 0 : meshlet;
+    int lastMeshlet = meshlet < 0 ? level.meshletCount : meshlet + 1;
+    for (int m = firstMeshlet; m < lastMeshlet; ++m) {
+        const GLMeshlet& range = gGeometryPool.meshlets[level.firstMeshlet + m];
+        GLDrawCommand command;
+        command.count = range.nIndices;
+        command.instanceCount = count;
+        command.firstIndex = range.firstIndex;
+        command.baseVertex = range.baseVertex;
+        command.baseInstance = baseInstance;
+        list.commands.push_back(command);
+        list.objects.push_back(object);
+
+        GLDrawBounds bounds;
+        glm::vec3 commandMin(FLT_MAX), commandMax(-FLT_MAX);
+        for (int i = 0; i < count; ++i) {
+            glm::vec3 worldMin, worldMax;
+            UTransformBounds(transforms[i], range.boundsMin, range.boundsMax, worldMin, worldMax);
+            commandMin = glm::min(commandMin, worldMin);
+            commandMax = glm::max(commandMax, worldMax);
+        }
+        bounds.boundsMin = glm::vec4(commandMin, 1.0f);
+        bounds.boundsMax = glm::vec4(commandMax, 1.0f);
+        list.bounds.push_back(bounds);
+    }
+    return lastMeshlet - firstMeshlet;
+}
+
+// Function to empty a draw list for the next frame
+void UClearDrawList(GLDrawList& list) {
+    U_PROFILE_FUNCTION();
+    list.commands.clear();
+    list.instances.clear();
+    list.bounds.clear();
+    list.objects.clear();
+}
+
+// Function to copy a draw list's instance records and commands into this frame's stream regions. Each
+// command's baseInstance offsets the instance attributes to its own records, so the shader reads
+// per-draw data without a uniform update between draws.
+void UUploadDrawList(GLDrawList& list) {
+    U_PROFILE_FUNCTION();
+    GLsizei commandCount = static_cast<GLsizei>(list.commands.size());
+    GLsizei instanceCount = static_cast<GLsizei>(list.instances.size());
+    if (commandCount == 0)
+        return;
+
+    GLuint baseInstance;
+    GLInstance* instances = UAllocateInstances(instanceCount, baseInstance);
+    memcpy(instances, list.instances.data(), instanceCount * sizeof(GLInstance));
+
+    // Commands were numbered from the start of the list; move them to where the records actually landed
+    for (GLsizei i = 0; i < commandCount; ++i)
+        list.commands[i].baseInstance += baseInstance;
+
+    // The culling pass binds the commands as a storage buffer range, so they start on that alignment
+    GLbyte* commands = UStreamAllocate(gIndirectStream, commandCount * sizeof(GLDrawCommand), gStorageBufferAlignment, list.commandOffset);
+    memcpy(commands, list.commands.data(), commandCount * sizeof(GLDrawCommand));
+    glBindBuffer(GL_DRAW_INDIRECT_BUFFER, gIndirectStream.buffer);
+}
+
+// Function to submit a range of an uploaded draw list with one glMultiDrawElementsIndirect, using
+// whatever program, texture and VAO are bound
+void UDrawListRange(const GLDrawList& list, int firstCommand, int commandCount, GLenum indexType) {
+    U_PROFILE_FUNCTION();
+    if (commandCount <= 0)
+        return;
+
+    glMultiDrawElementsIndirect(GL_TRIANGLES, indexType, (void*)(list.commandOffset + firstCommand * sizeof(GLDrawCommand)), commandCount, 0);
+
+    gFrameStats.drawCalls++;
+    for (int i = firstCommand; i < firstCommand + commandCount; ++i) {
+        if (i == firstCommand || list.objects[i - 1] != list.objects[i])
+            gFrameStats.objects += list.commands[i].instanceCount;
+        gFrameStats.triangles += list.commands[i].count / 3 * list.commands[i].instanceCount;
+    }
+}
+
+// Function to start collecting a frame's draw packets; view and far plane are used for the depth part of the sort key
+void UBeginRenderQueue(GLRenderQueue& queue, const glm::mat4& view, float farPlane) {
+    U_PROFILE_FUNCTION();
+    queue.packets.clear();
+    queue.view = view;
+    queue.farPlane = farPlane;
+}
+
+// Function to fill in a draw packet for the render queue. The packet's sort key packs, from the most
+// significant bits down, the pass, program, texture, VAO and view depth. Transparent packets put
+// the inverted depth right after the pass so they sort back-to-front before any state is considered.
+// Only reads the queue, so worker threads can build packets into lists of their own.
+void UMakeDrawPacket(const GLRenderQueue& queue, const GLMesh& mesh, int lod, const GLProgram& program, GLuint texture, const glm::mat4& model, const glm::vec4& tint, int object, GLDrawPacket& packet) {
+    U_PROFILE_FUNCTION();
+    packet.object = object;
+    packet.program = program.id;
+    packet.texture = texture;
+    packet.mesh = &mesh;
+    packet.lod = lod;
+    packet.meshlet = -1;
+    packet.instance.model = model;
+    packet.instance.tint = tint;
+
+    // Quantize the view-space distance of the object's origin to 24 bits
+    glm::vec4 viewPosition = queue.view * model[3];
+    float depth = glm::clamp(-viewPosition.z / queue.farPlane, 0.0f, 1.0f);
+    uint64_t depthBits = static_cast<uint64_t>(depth * SORT_DEPTH_MAX);
+
+    uint64_t programBits = program.id & SORT_STATE_MASK;
+    uint64_t textureBits = texture & SORT_STATE_MASK;
+    uint64_t vaoBits = mesh.vao & SORT_STATE_MASK;
+
+    if (tint.w < 1.0f) {
+        packet.key = (static_cast<uint64_t>(PASS_TRANSPARENT) << 62) | ((SORT_DEPTH_MAX - depthBits) << 38) |
+            (programBits << 28) | (textureBits << 18) | (vaoBits << 8);
+    }
+    else {
+        packet.key = (static_cast<uint64_t>(PASS_OPAQUE) << 62) | (programBits << 52) | (textureBits << 42) |
+            (vaoBits << 32) | (depthBits << 8);
+    }
+}
+
+// Function to sort the queue's packets by key with an LSD radix sort over 8-bit digits. Digits every
+// key agrees on are skipped, so a frame with few distinct states only pays for the passes it needs.
+void USortRenderQueue(GLRenderQueue& queue) {
+    U_PROFILE_FUNCTION();
+    size_t count = queue.packets.size();
+    queue.sorted.resize(count);
+    queue.scratch.resize(count);
+    for (size_t i = 0; i < count; ++i) {
+        queue.sorted[i].key = queue.packets[i].key;
+        queue.sorted[i].index = static_cast<uint32_t>(i);
+    }
+
+    for (int shift = 0; shift < 64; shift += 8) {
+        size_t histogram[256] = {};
+        for (size_t i = 0; i < count; ++i)
+            histogram[(queue.sorted[i].key >> shift) & 0xFF]++;
+
+        // Every key has the same digit here, so this pass would not move anything
+        if (count == 0 || histogram[(queue.sorted[0].key >> shift) & 0xFF] == count)
+            continue;
+
+        size_t offset = 0;
+        for (int digit = 0; digit < 256; ++digit) {
+            size_t bucketSize = histogram[digit];
+            histogram[digit] = offset;
+            offset += bucketSize;
+        }
+        for (size_t i = 0; i < count; ++i)
+            queue.scratch[histogram[(queue.sorted[i].key >> shift) & 0xFF]++] = queue.sorted[i];
+        queue.sorted.swap(queue.scratch);
+    }
+}
+
+// Function to sort the queue and submit it. The whole frame's commands are built and uploaded first,
+// so occlusion culling can run once over all of them; runs of packets sharing program, texture and
+// VAO then become one multi-draw call, and GL state is only touched when it differs from what is bound.
+void UFlushRenderQueue(GLRenderQueue& queue) {
+    U_PROFILE_FUNCTION();
+    USortRenderQueue(queue);
+
+    GLDrawList& list = gDrawList;
+    UClearDrawList(list);
+    queue.batches.clear();
+    gOcclusion.proxies.clear();
+    gCullStats.objectsOccluded = 0;
+
+    bool queries = gOcclusionMode == OCCLUSION_QUERIES;
+    for (size_t i = 0; i < queue.sorted.size(); ++i) {
+        const GLDrawPacket& packet = queue.packets[queue.sorted[i].index];
+        RenderPass pass = static_cast<RenderPass>(packet.key >> 62);
+
+        // Objects the last available query found hidden only draw their bounding box, to find out when they reappear
+        if (queries && packet.object >= 0) {
+            SceneObject& object = gSceneObjects[packet.object];
+            UResolveOcclusionQuery(object);
+            if (object.occluded) {
+                gOcclusion.proxies.push_back(packet.object);
+                gCullStats.objectsOccluded++;
+                continue;
+            }
+        }
+
+        // One multi-draw call reads one index type
+        GLenum indexType = packet.mesh->lods[packet.lod].indexType;
+        if (queue.batches.empty() || queue.batches.back().program != packet.program || queue.batches.back().texture != packet.texture ||
+            queue.batches.back().vao != packet.mesh->vao || queue.batches.back().pass != pass || queue.batches.back().indexType != indexType) {
+            GLDrawBatch batch;
+            batch.program = packet.program;
+            batch.texture = packet.texture;
+            batch.vao = packet.mesh->vao;
+            batch.pass = pass;
+            batch.indexType = indexType;
+            batch.firstCommand = static_cast<int>(list.commands.size());
+            batch.commandCount = 0;
+            queue.batches.push_back(batch);
+        }
+
+        queue.batches.back().commandCount += UDrawListAdd(list, *packet.mesh, packet.lod, packet.meshlet, &packet.instance.model, &packet.instance.tint, 1, packet.object);
+    }
+
+    // Proxy boxes go after the real commands so they are not part of any batch
+    int firstProxy = static_cast<int>(list.commands.size());
+    for (size_t i = 0; i < gOcclusion.proxies.size(); ++i) {
+        const BvhNode& leaf = gSceneBvh.nodes[gSceneObjects[gOcclusion.proxies[i]].bvhLeaf];
+        glm::mat4 proxyModel = glm::translate(glm::mat4(1.0f), (leaf.boundsMin + leaf.boundsMax) * 0.5f);
+        proxyModel = glm::scale(proxyModel, leaf.boundsMax - leaf.boundsMin);
+        UDrawListAdd(list, gBoundsProxyMesh, 0, -1, &proxyModel, nullptr, 1, gOcclusion.proxies[i]);
+    }
+
+    UUploadDrawList(list);
+    if (gOcclusionMode == OCCLUSION_HIZ) {
+        UBeginGpuScope(gGpuProfiler, "occlusion cull");
+        UOcclusionCullDrawList(gOcclusion, list, firstProxy);
+        UEndGpuScope(gGpuProfiler);
+    }
+
+    GLuint boundProgram = 0;
+    GLuint boundTexture = 0;
+    GLuint boundVao = 0;
+    RenderPass boundPass = PASS_OPAQUE;
+
+    glActiveTexture(GL_TEXTURE0);
+    UBeginGpuScope(gGpuProfiler, "opaque");
+    for (size_t i = 0; i < queue.batches.size(); ++i) {
+        const GLDrawBatch& batch = queue.batches[i];
+
+        if (batch.pass != boundPass) {
+            UEndGpuScope(gGpuProfiler);
+            UBeginGpuScope(gGpuProfiler, "transparent");
+
+            // Transparent draws blend over the opaque ones and do not write depth
+            glEnable(GL_BLEND);
+            glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
+            glDepthMask(GL_FALSE);
+            boundPass = batch.pass;
+        }
+        if (batch.program != boundProgram) {
+            glUseProgram(batch.program);
+            boundProgram = batch.program;
+            gFrameStats.stateChanges++;
+        }
+        if (batch.texture != boundTexture) {
+            glBindTexture(GL_TEXTURE_2D, batch.texture);
+            boundTexture = batch.texture;
+            gFrameStats.stateChanges++;
+        }
+        if (batch.vao != boundVao) {
+            glBindVertexArray(batch.vao);
+            boundVao = batch.vao;
+            gFrameStats.stateChanges++;
+        }
+
+        if (queries)
+            UDrawListWithQueries(list, batch.firstCommand, batch.commandCount, batch.indexType);
+        else
+            UDrawListRange(list, batch.firstCommand, batch.commandCount, batch.indexType);
+    }
+    UEndGpuScope(gGpuProfiler);
+
+    if (boundPass == PASS_TRANSPARENT) {
+        glDisable(GL_BLEND);
+        glDepthMask(GL_TRUE);
+    }
+
+    // Proxies only feed their queries, so they write neither color nor depth and need no shading
+    const GLProgram& proxyProgram = UShaderVariant(SHADER_INSTANCING);
+    if (firstProxy < static_cast<int>(list.commands.size()) && proxyProgram.id) {
+        UBeginGpuScope(gGpuProfiler, "occlusion proxies");
+        glColorMask(GL_FALSE, GL_FALSE, GL_FALSE, GL_FALSE);
+        glDepthMask(GL_FALSE);
+        glUseProgram(proxyProgram.id);
+        glBindVertexArray(gGeometryPool.vao);
+        UDrawListWithQueries(list, firstProxy, static_cast<int>(list.commands.size()) - firstProxy, gBoundsProxyMesh.lods[0].indexType);
+        glColorMask(GL_TRUE, GL_TRUE, GL_TRUE, GL_TRUE);
+        glDepthMask(GL_TRUE);
+        UEndGpuScope(gGpuProfiler);
+    }
+}
+
+// Function to create the offscreen target the scene is rendered into; its depth is sampled to build the Hi-Z pyramid
+void UCreateFramebuffer(GLFramebuffer& framebuffer, int width, int height) {
+    U_PROFILE_FUNCTION();
+    framebuffer.width = width;
+    framebuffer.height = height;
+
+    glGenTextures(1, &framebuffer.colorTexture);
+    glBindTexture(GL_TEXTURE_2D, framebuffer.colorTexture);
+    glTexStorage2D(GL_TEXTURE_2D, 1, GL_RGBA8, width, height);
+
+    glGenTextures(1, &framebuffer.depthTexture);
+    glBindTexture(GL_TEXTURE_2D, framebuffer.depthTexture);
+    glTexStorage2D(GL_TEXTURE_2D, 1, GL_DEPTH_COMPONENT32F, width, height);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+    glBindTexture(GL_TEXTURE_2D, 0);
+
+    glGenFramebuffers(1, &framebuffer.fbo);
+    glBindFramebuffer(GL_FRAMEBUFFER, framebuffer.fbo);
+    glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, framebuffer.colorTexture, 0);
+    glFramebufferTexture2D(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_TEXTURE_2D, framebuffer.depthTexture, 0);
+    if (glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE)
+        cout << "ERROR::FRAMEBUFFER::INCOMPLETE" << endl;
+    glBindFramebuffer(GL_FRAMEBUFFER, 0);
+}
+
+void UDestroyFramebuffer(GLFramebuffer& framebuffer) {
+    U_PROFILE_FUNCTION();
+    glDeleteFramebuffers(1, &framebuffer.fbo);
+    glDeleteTextures(1, &framebuffer.colorTexture);
+    glDeleteTextures(1, &framebuffer.depthTexture);
+}
+
+// Function to submit a compute shader program; ready is called with it once it is linked
+void UCreateComputeProgram(const char* computeShaderSource, function<void(GLuint)> ready) {
+    U_PROFILE_FUNCTION();
+    const GLenum stage = GL_COMPUTE_SHADER;
+    USubmitProgram(gShaderCompiler, gProgramCache, &stage, &computeShaderSource, 1, move(ready));
+}
+
+// Function to set up the occlusion culling stage: the Hi-Z pyramid sized to the scene framebuffer,
+// its build and test programs, and the box mesh drawn for hidden objects in query mode. Occlusion
+// culling stays off until its programs are linked.
+void UCreateOcclusionCuller(GLOcclusionCuller& culler, const GLFramebuffer& framebuffer) {
+    U_PROFILE_FUNCTION();
+    culler.copyProgram = 0;
+    culler.downsampleProgram = 0;
+    culler.cullProgram = 0;
+    UCreateComputeProgram(hiZCopyShaderSource, [&culler](GLuint programId) {
+        glUseProgram(programId);
+        glUniform1i(glGetUniformLocation(programId, "depthTexture"), HIZ_TEXTURE_UNIT);
+        glUseProgram(0);
+        culler.copyProgram = programId;
+    });
+    UCreateComputeProgram(hiZDownsampleShaderSource, [&culler](GLuint programId) {
+        culler.downsampleProgram = programId;
+    });
+    UCreateComputeProgram(occlusionCullShaderSource, [&culler](GLuint programId) {
+        culler.viewProjectionLoc = glGetUniformLocation(programId, "previousViewProjection");
+        culler.commandCountLoc = glGetUniformLocation(programId, "commandCount");
+        glUseProgram(programId);
+        glUniform1i(glGetUniformLocation(programId, "hiZ"), HIZ_TEXTURE_UNIT);
+        glUseProgram(0);
+        culler.cullProgram = programId;
+    });
+
+    culler.width = framebuffer.width;
+    culler.height = framebuffer.height;
+    culler.levels = 1;
+    while ((max(culler.width, culler.height) >> culler.levels) > 0)
+        culler.levels++;
+
+    glGenTextures(1, &culler.hiZTexture);
+    glBindTexture(GL_TEXTURE_2D, culler.hiZTexture);
+    glTexStorage2D(GL_TEXTURE_2D, culler.levels, GL_R32F, culler.width, culler.height);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST_MIPMAP_NEAREST);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+    glBindTexture(GL_TEXTURE_2D, 0);
+
+    UCreateStreamBuffer(culler.boundsStream, 64 * sizeof(GLDrawBounds));
+    culler.hiZValid = false;
+
+    UBoundsProxyMesh(gBoundsProxyMesh);
+}
+
+void UDestroyOcclusionCuller(GLOcclusionCuller& culler) {
+    U_PROFILE_FUNCTION();
+    glDeleteProgram(culler.copyProgram);
+    glDeleteProgram(culler.downsampleProgram);
+    glDeleteProgram(culler.cullProgram);
+    glDeleteTextures(1, &culler.hiZTexture);
+    UDestroyStreamBuffer(culler.boundsStream);
+
+    for (size_t i = 0; i < gSceneObjects.size(); ++i) {
+        if (gSceneObjects[i].occlusionQueries[0])
+            glDeleteQueries(2, gSceneObjects[i].occlusionQueries);
+    }
+}
+
+// Function to build the Hi-Z pyramid from the depth buffer of the frame just rendered. Level 0 copies
+// the depth, and every further level keeps the farthest depth of the texels it covers, so the next
+// frame can reject an object whose nearest point lies behind everything in its screen rectangle.
+void UBuildHiZ(GLOcclusionCuller& culler, const GLFramebuffer& framebuffer, const glm::mat4& viewProjection) {
+    U_PROFILE_FUNCTION();
+    if (!culler.copyProgram || !culler.downsampleProgram)
+        return;
+
+    glActiveTexture(GL_TEXTURE0 + HIZ_TEXTURE_UNIT);
+    glBindTexture(GL_TEXTURE_2D, framebuffer.depthTexture);
+
+    glUseProgram(culler.copyProgram);
+    glBindImageTexture(0, culler.hiZTexture, 0, GL_FALSE, 0, GL_WRITE_ONLY, GL_R32F);
+    glDispatchCompute((culler.width + 7) / 8, (culler.height + 7) / 8, 1);
+
+    glUseProgram(culler.downsampleProgram);
+    for (int level = 1; level < culler.levels; ++level) {
+        glMemoryBarrier(GL_SHADER_IMAGE_ACCESS_BARRIER_BIT);
+        int levelWidth = max(culler.width >> level, 1);
+        int levelHeight = max(culler.height >> level, 1);
+        glBindImageTexture(0, culler.hiZTexture, level - 1, GL_FALSE, 0, GL_READ_ONLY, GL_R32F);
+        glBindImageTexture(1, culler.hiZTexture, level, GL_FALSE, 0, GL_WRITE_ONLY, GL_R32F);
+        glDispatchCompute((levelWidth + 7) / 8, (levelHeight + 7) / 8, 1);
+    }
+    glMemoryBarrier(GL_TEXTURE_FETCH_BARRIER_BIT);
+
+    glBindTexture(GL_TEXTURE_2D, 0);
+    glActiveTexture(GL_TEXTURE0);
+
+    culler.previousViewProjection = viewProjection;
+    culler.hiZValid = true;
+}
+
+// Function to test every uploaded command against last frame's Hi-Z pyramid on the GPU. Commands found
+// hidden get an instance count of zero in the indirect buffer itself, so the multi-draw skips them with
+// no readback. Commands keep their slots, which keeps transparent draws in back-to-front order.
+void UOcclusionCullDrawList(GLOcclusionCuller& culler, const GLDrawList& list, int commandCount) {
+    U_PROFILE_FUNCTION();
+    if (!culler.hiZValid || !culler.cullProgram || commandCount <= 0)
+        return;
+
+    GLintptr boundsOffset;
+    GLbyte* bounds = UStreamAllocate(culler.boundsStream, commandCount * sizeof(GLDrawBounds), gStorageBufferAlignment, boundsOffset);
+    memcpy(bounds, list.bounds.data(), commandCount * sizeof(GLDrawBounds));
+
+    glBindBufferRange(GL_SHADER_STORAGE_BUFFER, 0, gIndirectStream.buffer, list.commandOffset, commandCount * sizeof(GLDrawCommand));
+    glBindBufferRange(GL_SHADER_STORAGE_BUFFER, 1, culler.boundsStream.buffer, boundsOffset, commandCount * sizeof(GLDrawBounds));
+    glActiveTexture(GL_TEXTURE0 + HIZ_TEXTURE_UNIT);
+    glBindTexture(GL_TEXTURE_2D, culler.hiZTexture);
+
+    glUseProgram(culler.cullProgram);
+    glUniformMatrix4fv(culler.viewProjectionLoc, 1, GL_FALSE, glm::value_ptr(culler.previousViewProjection));
+    glUniform1ui(culler.commandCountLoc, commandCount);
+    glDispatchCompute((commandCount + 63) / 64, 1, 1);
+    glMemoryBarrier(GL_COMMAND_BARRIER_BIT);
+
+    glBindTexture(GL_TEXTURE_2D, 0);
+    glActiveTexture(GL_TEXTURE0);
+}
+
+// Function to read the result of the query an object issued last frame, if it is ready. Nothing ever
+// waits: an unfinished query leaves the previous answer in place, and an object that issued no query
+// last frame (it was outside the frustum) is assumed visible.
+void UResolveOcclusionQuery(SceneObject& object) {
+    U_PROFILE_FUNCTION();
+    int previous = (gFrameIndex - 1) & 1;
+    if (!object.occlusionQueryIssued[previous]) {
+        if (!object.occlusionQueryIssued[gFrameIndex & 1])
+            object.occluded = false;
+        return;
+    }
+
+    GLuint available = 0;
+    glGetQueryObjectuiv(object.occlusionQueries[previous], GL_QUERY_RESULT_AVAILABLE, &available);
+    if (!available)
+        return;
+
+    GLuint samplesPassed = 0;
+    glGetQueryObjectuiv(object.occlusionQueries[previous], GL_QUERY_RESULT, &samplesPassed);
+    object.occluded = samplesPassed == 0;
+    object.occlusionQueryIssued[previous] = false;
+}
+
+// Function to draw a range of an uploaded draw list one command at a time, each object's run of
+// meshlet commands wrapped in its GL_ANY_SAMPLES_PASSED query for this frame
+void UDrawListWithQueries(const GLDrawList& list, int firstCommand, int commandCount, GLenum indexType) {
+    U_PROFILE_FUNCTION();
+    int current = gFrameIndex & 1;
+    int endCommand = firstCommand + commandCount;
+
+    for (int i = firstCommand; i < endCommand; ++i) {
+        const GLDrawCommand& command = list.commands[i];
+        SceneObject* object = list.objects[i] >= 0 ? &gSceneObjects[list.objects[i]] : nullptr;
+        bool firstOfObject = i == firstCommand || list.objects[i - 1] != list.objects[i];
+        bool lastOfObject = i + 1 == endCommand || list.objects[i + 1] != list.objects[i];
+
+        if (object && firstOfObject) {
+            if (!object->occlusionQueries[0])
+                glGenQueries(2, object->occlusionQueries);
+            glBeginQuery(GL_ANY_SAMPLES_PASSED, object->occlusionQueries[current]);
+        }
+
+        glDrawElementsInstancedBaseVertexBaseInstance(GL_TRIANGLES, command.count, indexType, (void*)(command.firstIndex * UIndexSize(indexType)),
+            command.instanceCount, command.baseVertex, command.baseInstance);
+        gFrameStats.drawCalls++;
+        if (firstOfObject)
+            gFrameStats.objects += command.instanceCount;
+        gFrameStats.triangles += command.count / 3 * command.instanceCount;
+
+        if (object && lastOfObject) {
+            glEndQuery(GL_ANY_SAMPLES_PASSED);
+            object->occlusionQueryIssued[current] = true;
+        }
+    }
+}
+
+// Function to transform a mesh-space box into a world-space box that encloses it
+void UTransformBounds(const glm::mat4& model, const glm::vec3& localMin, const glm::vec3& localMax, glm::vec3& worldMin, glm::vec3& worldMax) {
+    U_PROFILE_FUNCTION();
+    glm::vec3 center = (localMin + localMax) * 0.5f;
+    glm::vec3 extent = (localMax - localMin) * 0.5f;
+
+    glm::vec4 worldCenter = model * glm::vec4(center, 1.0f);
+    glm::vec3 worldExtent;
+    for (int axis = 0; axis < 3; ++axis) {
+        worldExtent[axis] = fabs(model[0][axis]) * extent.x + fabs(model[1][axis]) * extent.y + fabs(model[2][axis]) * extent.z;
+    }
+
+    worldMin = glm::vec3(worldCenter.x, worldCenter.y, worldCenter.z) - worldExtent;
+    worldMax = glm::vec3(worldCenter.x, worldCenter.y, worldCenter.z) + worldExtent;
+}
+
+static float UBoundsArea(const glm::vec3& boundsMin, const glm::vec3& boundsMax) {
+    U_PROFILE_FUNCTION();
+    glm::vec3 size = boundsMax - boundsMin;
+    return 2.0f * (size.x * size.y + size.y * size.z + size.z * size.x);
+}
+
+static int UBvhAllocateNode(SceneBvh& bvh) {
+    U_PROFILE_FUNCTION();
+    if (bvh.freeList >= 0) {
+        int node = bvh.freeList;
+        bvh.freeList = bvh.nodes[node].parent;
+        return node;
+    }
+    bvh.nodes.push_back(BvhNode());
+    return static_cast<int>(bvh.nodes.size()) - 1;
+}
+
+// Function to recompute the bounds of every ancestor of a node, from the node's parent up to the root
+static void UBvhRefitAncestors(SceneBvh& bvh, int node) {
+    U_PROFILE_FUNCTION();
+    for (int index = bvh.nodes[node].parent; index >= 0; index = bvh.nodes[index].parent) {
+        BvhNode& parent = bvh.nodes[index];
+        parent.boundsMin = glm::min(bvh.nodes[parent.left].boundsMin, bvh.nodes[parent.right].boundsMin);
+        parent.boundsMax = glm::max(bvh.nodes[parent.left].boundsMax, bvh.nodes[parent.right].boundsMax);
+    }
+}
+
+// Function to insert a leaf for an object. The sibling is found by walking down toward the child whose
+// surface area grows least, which keeps the tree reasonably balanced without a full rebuild.
+int UBvhInsert(SceneBvh& bvh, int object, const glm::vec3& boundsMin, const glm::vec3& boundsMax) {
+    U_PROFILE_FUNCTION();
+    int leaf = UBvhAllocateNode(bvh);
+    BvhNode& leafNode = bvh.nodes[leaf];
+    leafNode.boundsMin = boundsMin;
+    leafNode.boundsMax = boundsMax;
+    leafNode.parent = -1;
+    leafNode.left = -1;
+    leafNode.right = -1;
+    leafNode.object = object;
+
+    if (bvh.root < 0) {
+        bvh.root = leaf;
+        return leaf;
+    }
+
+    int sibling = bvh.root;
+    while (bvh.nodes[sibling].left >= 0) {
+        const BvhNode& node = bvh.nodes[sibling];
+        const BvhNode& left = bvh.nodes[node.left];
+        const BvhNode& right = bvh.nodes[node.right];
+        float leftCost = UBoundsArea(glm::min(left.boundsMin, boundsMin), glm::max(left.boundsMax, boundsMax)) - UBoundsArea(left.boundsMin, left.boundsMax);
+        float rightCost = UBoundsArea(glm::min(right.boundsMin, boundsMin), glm::max(right.boundsMax, boundsMax)) - UBoundsArea(right.boundsMin, right.boundsMax);
+        sibling = leftCost <= rightCost ? node.left : node.right;
+    }
+
+    int oldParent = bvh.nodes[sibling].parent;
+    int newParent = UBvhAllocateNode(bvh);
+    BvhNode& parentNode = bvh.nodes[newParent];
+    parentNode.parent = oldParent;
+    parentNode.left = sibling;
+    parentNode.right = leaf;
+    parentNode.object = -1;
+    parentNode.boundsMin = glm::min(bvh.nodes[sibling].boundsMin, boundsMin);
+    parentNode.boundsMax = glm::max(bvh.nodes[sibling].boundsMax, boundsMax);
+
+    if (oldParent < 0)
+        bvh.root = newParent;
+    else if (bvh.nodes[oldParent].left == sibling)
+        bvh.nodes[oldParent].left = newParent;
+    else
+        bvh.nodes[oldParent].right = newParent;
+
+    bvh.nodes[sibling].parent = newParent;
+    bvh.nodes[leaf].parent = newParent;
+    UBvhRefitAncestors(bvh, newParent);
+    return leaf;
+}
+
+// Function to give a leaf new bounds and refit the path to the root. The topology is left alone, so
+// small per-frame motion stays cheap.
+void UBvhRefit(SceneBvh& bvh, int leaf, const glm::vec3& boundsMin, const glm::vec3& boundsMax) {
+    U_PROFILE_FUNCTION();
+    bvh.nodes[leaf].boundsMin = boundsMin;
+    bvh.nodes[leaf].boundsMax = boundsMax;
+    UBvhRefitAncestors(bvh, leaf);
+}
+
+// Function to add an object to the scene and the BVH; returns the object's index. Scene objects are
+// drawn instanced through the render queue, with the cheapest variant that covers their material.
+int UAddSceneObject(const GLMesh& mesh, const Material& material, const glm::mat4& model, bool stressGrid) {
+    U_PROFILE_FUNCTION();
+    SceneObject object;
+    object.mesh = &mesh;
+    object.program = &UShaderVariant(UMaterialFeatures(material, mesh) | SHADER_INSTANCING);
+    object.texture = material.texture;
+    object.model = model;
+    object.tint = mesh.vertexColors ? material.tint : material.tint * mesh.color;
+    object.lod = 0;
+    object.stressGrid = stressGrid;
+    object.occlusionQueries[0] = 0;
+    object.occlusionQueries[1] = 0;
+    object.occlusionQueryIssued[0] = false;
+    object.occlusionQueryIssued[1] = false;
+    object.occluded = false;
+
+    int index = static_cast<int>(gSceneObjects.size());
+    glm::vec3 worldMin, worldMax;
+    UTransformBounds(model, mesh.boundsMin, mesh.boundsMax, worldMin, worldMax);
+    object.bvhLeaf = UBvhInsert(gSceneBvh, index, worldMin, worldMax);
+    gSceneObjects.push_back(object);
+    return index;
+}
+
+// Function to move a scene object; its BVH leaf is refit to the new world bounds
+void USetSceneObjectTransform(int index, const glm::mat4& model) {
+    U_PROFILE_FUNCTION();
+    SceneObject& object = gSceneObjects[index];
+    object.model = model;
+
+    glm::vec3 worldMin, worldMax;
+    UTransformBounds(model, object.mesh->boundsMin, object.mesh->boundsMax, worldMin, worldMax);
+    UBvhRefit(gSceneBvh, object.bvhLeaf, worldMin, worldMax);
+}
+
+// Function to extract the six frustum planes from a projection * view matrix (Gribb/Hartmann).
+// Planes are stored structure-of-arrays and padded to eight by repeating the first plane, so the
+// SIMD tests can evaluate all of them without a remainder loop.
+void UExtractFrustum(const glm::mat4& viewProjection, GLFrustum& frustum) {
+    U_PROFILE_FUNCTION();
+    glm::vec4 rows[4];
+    for (int row = 0; row < 4; ++row)
+        rows[row] = glm::vec4(viewProjection[0][row], viewProjection[1][row], viewProjection[2][row], viewProjection[3][row]);
+
+    glm::vec4 planes[8];
+    planes[0] = rows[3] + rows[0]; // left
+    planes[1] = rows[3] - rows[0]; // right
+    planes[2] = rows[3] + rows[1]; // bottom
+    planes[3] = rows[3] - rows[1]; // top
+    planes[4] = rows[3] + rows[2]; // near
+    planes[5] = rows[3] - rows[2]; // far
+    planes[6] = planes[0];
+    planes[7] = planes[0];
+
+    for (int i = 0; i < 8; ++i) {
+        float length = sqrt(planes[i].x * planes[i].x + planes[i].y * planes[i].y + planes[i].z * planes[i].z);
+        frustum.nx[i] = planes[i].x / length;
+        frustum.ny[i] = planes[i].y / length;
+        frustum.nz[i] = planes[i].z / length;
+        frustum.d[i] = planes[i].w / length;
+    }
+}
+
+// Function to classify a box against the frustum. For each plane, the box is outside if its center lies
+// further behind the plane than the box's projected radius, and straddles it if within that radius.
+CullResult UFrustumTestBounds(const GLFrustum& frustum, const glm::vec3& boundsMin, const glm::vec3& boundsMax) {
+    U_PROFILE_FUNCTION();
+    glm::vec3 center = (boundsMin + boundsMax) * 0.5f;
+    glm::vec3 extent = (boundsMax - boundsMin) * 0.5f;
+
+#if defined(U_SIMD_AVX2)
+    const __m256 signMask = _mm256_set1_ps(-0.0f);
+    __m256 nx = _mm256_load_ps(frustum.nx);
+    __m256 ny = _mm256_load_ps(frustum.ny);
+    __m256 nz = _mm256_load_ps(frustum.nz);
+
+    // Multiplies and adds rather than FMA, which AVX2 alone does not guarantee
+    __m256 distance = _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(nx, _mm256_set1_ps(center.x)), _mm256_mul_ps(ny, _mm256_set1_ps(center.y))),
+        _mm256_add_ps(_mm256_mul_ps(nz, _mm256_set1_ps(center.z)), _mm256_load_ps(frustum.d)));
+    __m256 radius = _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(_mm256_andnot_ps(signMask, nx), _mm256_set1_ps(extent.x)),
+        _mm256_mul_ps(_mm256_andnot_ps(signMask, ny), _mm256_set1_ps(extent.y))),
+        _mm256_mul_ps(_mm256_andnot_ps(signMask, nz), _mm256_set1_ps(extent.z)));
+
+    if (_mm256_movemask_ps(_mm256_cmp_ps(_mm256_add_ps(distance, radius), _mm256_setzero_ps(), _CMP_LT_OQ)))
+        return CULL_OUTSIDE;
+    if (_mm256_movemask_ps(_mm256_cmp_ps(_mm256_sub_ps(distance, radius), _mm256_setzero_ps(), _CMP_LT_OQ)))
+        return CULL_INTERSECT;
+    return CULL_INSIDE;
+#elif defined(U_SIMD_SSE2)
+    const __m128 signMask = _mm_set1_ps(-0.0f);
+    const __m128 cx = _mm_set1_ps(center.x), cy = _mm_set1_ps(center.y), cz = _mm_set1_ps(center.z);
+    const __m128 ex = _mm_set1_ps(extent.x), ey = _mm_set1_ps(extent.y), ez = _mm_set1_ps(extent.z);
+    int outside = 0;
+    int intersect = 0;
+
+    for (int i = 0; i < 8; i += 4) {
+        __m128 nx = _mm_load_ps(frustum.nx + i);
+        __m128 ny = _mm_load_ps(frustum.ny + i);
+        __m128 nz = _mm_load_ps(frustum.nz + i);
+
+        __m128 distance = _mm_add_ps(_mm_add_ps(_mm_mul_ps(nx, cx), _mm_mul_ps(ny, cy)), _mm_add_ps(_mm_mul_ps(nz, cz), _mm_load_ps(frustum.d + i)));
+        __m128 radius = _mm_add_ps(_mm_add_ps(_mm_mul_ps(_mm_andnot_ps(signMask, nx), ex), _mm_mul_ps(_mm_andnot_ps(signMask, ny), ey)),
+            _mm_mul_ps(_mm_andnot_ps(signMask, nz), ez));
+
+        outside |= _mm_movemask_ps(_mm_cmplt_ps(_mm_add_ps(distance, radius), _mm_setzero_ps()));
+        intersect |= _mm_movemask_ps(_mm_cmplt_ps(_mm_sub_ps(distance, radius), _mm_setzero_ps()));
+    }
+
+    if (outside)
+        return CULL_OUTSIDE;
+    return intersect ? CULL_INTERSECT : CULL_INSIDE;
+#else
+    CullResult result = CULL_INSIDE;
+    for (int i = 0; i < 6; ++i) {
+        float distance = frustum.nx[i] * center.x + frustum.ny[i] * center.y + frustum.nz[i] * center.z + frustum.d[i];
+        float radius = fabs(frustum.nx[i]) * extent.x + fabs(frustum.ny[i]) * extent.y + fabs(frustum.nz[i]) * extent.z;
+        if (distance + radius < 0.0f)
+            return CULL_OUTSIDE;
+        if (distance - radius < 0.0f)
+            result = CULL_INTERSECT;
+    }
+    return result;
+#endif
+}
+
+// Function to pick the level of detail for a scene object from the on-screen size of each level's error.
+// Starting from last frame's level, it refines while the current level is over the pixel budget and
+// coarsens only while the next level is under the budget scaled by LOD_HYSTERESIS.
+static int USelectLod(const SceneObject& object) {
+    U_PROFILE_FUNCTION();
+    const GLMesh& mesh = *object.mesh;
+    if (mesh.lodCount <= 1)
+        return 0;
+
+    // Errors are in mesh units, so scale them by the largest axis scale of the model matrix
+    float scale = max(glm::length(glm::vec3(object.model[0])), max(glm::length(glm::vec3(object.model[1])), glm::length(glm::vec3(object.model[2]))));
+    float pixelsPerUnit = gLodPixelScale * scale;
+    if (gLodPerspective) {
+        // Use the nearest point of the bounding sphere; inside the sphere always draws full detail
+        glm::vec3 center(object.model * glm::vec4(mesh.sphereCenter, 1.0f));
+        float distance = glm::length(center - cameraPosition) - mesh.sphereRadius * scale;
+        if (distance <= 0.0f)
+            return 0;
+        pixelsPerUnit /= distance;
+    }
+
+    int lod = min(object.lod, mesh.lodCount - 1);
+    while (lod > 0 && mesh.lods[lod].error * pixelsPerUnit > gLodErrorPixels)
+        --lod;
+    while (lod + 1 < mesh.lodCount && mesh.lods[lod + 1].error * pixelsPerUnit < gLodErrorPixels * LOD_HYSTERESIS)
+        ++lod;
+    return lod;
+}
+
+// Function to pick the level of detail of a visible scene object and add its draw packets to a task's
+// list. Every object is reached by exactly one task, so writing its LOD back is safe from any worker.
+// Objects split into meshlets that straddle the frustum only submit the meshlets reaching into it; the
+// occlusion query fallback needs each object drawn in one piece, so it always gets all of them.
+static void USubmitSceneObject(const GLFrustum& frustum, CullTask& task, int index, bool inside) {
+    U_PROFILE_FUNCTION();
+    SceneObject& object = gSceneObjects[index];
+    task.stats.objectsDrawn++;
+
+    // Stress grid objects are drawn by the comparison paths unless the render queue mode is active
+    if (object.stressGrid && gStressMode != STRESS_MULTI_DRAW)
+        return;
+    // Its program is still compiling
+    if (!object.program->id)
+        return;
+
+    object.lod = USelectLod(object);
+    GLDrawPacket packet;
+    UMakeDrawPacket(gRenderQueue, *object.mesh, object.lod, *object.program, object.texture, object.model, object.tint, index, packet);
+
+    const GLMeshLod& level = object.mesh->lods[object.lod];
+    if (inside || level.meshletCount <= 1 || gOcclusionMode == OCCLUSION_QUERIES) {
+        task.packets.push_back(packet);
+        return;
+    }
+
+    for (int m = 0; m < level.meshletCount; ++m) {
+        const GLMeshlet& meshlet = gGeometryPool.meshlets[level.firstMeshlet + m];
+        glm::vec3 worldMin, worldMax;
+        UTransformBounds(object.model, meshlet.boundsMin, meshlet.boundsMax, worldMin, worldMax);
+        if (UFrustumTestBounds(frustum, worldMin, worldMax) == CULL_OUTSIDE) {
+            task.stats.meshletsCulled++;
+            continue;
+        }
+        packet.meshlet = m;
+        task.packets.push_back(packet);
+    }
+}
+
+// Function to walk one subtree of the BVH against the frustum. Subtrees fully inside the frustum are
+// submitted without testing their leaves; subtrees fully outside are skipped whole.
+static void UCullSubtree(const GLFrustum& frustum, CullTask& task) {
+    U_PROFILE_FUNCTION();
+
+    // Entries are node indices; a negative entry marks a subtree already known to be inside
+    vector<int>& stack = task.stack;
+    stack.clear();
+    stack.push_back(task.entry);
+
+    while (!stack.empty()) {
+        int entry = stack.back();
+        stack.pop_back();
+
+        bool inside = entry < 0;
+        const BvhNode& node = gSceneBvh.nodes[inside ? -entry - 1 : entry];
+        bool leaf = node.left < 0;
+
+        if (!inside) {
+            task.stats.nodesTested++;
+            if (leaf)
+                task.stats.objectsTested++;
+
+            CullResult result = UFrustumTestBounds(frustum, node.boundsMin, node.boundsMax);
+            if (result == CULL_OUTSIDE)
+                continue;
+            inside = result == CULL_INSIDE;
+        }
+
+        if (leaf) {
+            USubmitSceneObject(frustum, task, node.object, inside);
+            continue;
+        }
+
+        stack.push_back(inside ? -node.left - 1 : node.left);
+        stack.push_back(inside ? -node.right - 1 : node.right);
+    }
+}
+
+// Function to cull the scene and fill the render queue with the visible objects' packets. The top of
+// the BVH is split on this thread until there are a few subtrees per worker; the workers then cull
+// their subtrees, pick LODs and build packets into per-task lists, which are merged in task order.
+void UCullScene(const GLFrustum& frustum) {
+    U_PROFILE_FUNCTION();
+    gCullStats.nodesTested = 0;
+    gCullStats.objectsTested = 0;
+    gCullStats.objectsCulled = 0;
+    gCullStats.objectsDrawn = 0;
+    gCullStats.meshletsCulled = 0;
+
+    if (gSceneBvh.root < 0)
+        return;
+
+    // Expand the frontier one level at a time, testing the interior nodes it passes through
+    const size_t targetTasks = (gWorkerPool.threads.size() + 1) * 4;
+    vector<int>& frontier = gCullFrontier;
+    vector<int>& next = gCullStack;
+    frontier.assign(1, gSceneBvh.root);
+    while (frontier.size() < targetTasks) {
+        bool expanded = false;
+        next.clear();
+        for (size_t i = 0; i < frontier.size(); ++i) {
+            int entry = frontier[i];
+            bool inside = entry < 0;
+            const BvhNode& node = gSceneBvh.nodes[inside ? -entry - 1 : entry];
+            if (node.left < 0) {
+                next.push_back(entry);
+                continue;
+            }
+
+            if (!inside) {
+                gCullStats.nodesTested++;
+                CullResult result = UFrustumTestBounds(frustum, node.boundsMin, node.boundsMax);
+                if (result == CULL_OUTSIDE)
+                    continue;
+                inside = result == CULL_INSIDE;
+            }
+            next.push_back(inside ? -node.left - 1 : node.left);
+            next.push_back(inside ? -node.right - 1 : node.right);
+            expanded = true;
+        }
+        frontier.swap(next);
+        if (!expanded)
+            break;
+    }
+
+    int taskCount = static_cast<int>(frontier.size());
+    if (static_cast<int>(gCullTasks.size()) < taskCount)
+        gCullTasks.resize(taskCount);
+    for (int i = 0; i < taskCount; ++i) {
+        CullTask& task = gCullTasks[i];
+        task.entry = frontier[i];
+        task.packets.clear();
+        memset(&task.stats, 0, sizeof(task.stats));
+    }
+
+    URunParallel(gWorkerPool, taskCount, [&frustum](int taskIndex, int) {
+        UCullSubtree(frustum, gCullTasks[taskIndex]);
+    });
+
+    // Merge on this thread, in task order
+    {
+        U_PROFILE_SCOPE("merge packets");
+        for (int i = 0; i < taskCount; ++i) {
+            const CullTask& task = gCullTasks[i];
+            gRenderQueue.packets.insert(gRenderQueue.packets.end(), task.packets.begin(), task.packets.end());
+            gCullStats.nodesTested += task.stats.nodesTested;
+            gCullStats.objectsTested += task.stats.objectsTested;
+            gCullStats.objectsDrawn += task.stats.objectsDrawn;
+            gCullStats.meshletsCulled += task.stats.meshletsCulled;
+        }
+    }
+
+    gCullStats.objectsCulled = static_cast<int>(gSceneObjects.size()) - gCullStats.objectsDrawn;
+}
+
+// Function to claim and run tasks of the pool's current job until none are left
+static void URunWorkerTasks(WorkerPool& pool, int worker) {
+    for (int task = pool.nextTask.fetch_add(1); task < pool.taskCount; task = pool.nextTask.fetch_add(1))
+        pool.job(task, worker);
+}
+
+// Function run by each worker thread: sleeps until a new job is posted, helps finish it, then reports back
+static void UWorkerMain(WorkerPool* pool, int worker) {
+    unsigned seenGeneration = 0;
+    for (;;) {
+        {
+            unique_lock<mutex> lock(pool->lock);
+            pool->wake.wait(lock, [pool, seenGeneration] { return pool->quit || pool->generation != seenGeneration; });
+            if (pool->quit)
+                return;
+            seenGeneration = pool->generation;
+        }
+
+        URunWorkerTasks(*pool, worker);
+
+        lock_guard<mutex> lock(pool->lock);
+        if (--pool->busyWorkers == 0)
+            pool->done.notify_one();
+    }
+}
+
+// Function to start workerCount threads; with none, parallel jobs simply run on the calling thread
+void UCreateWorkerPool(WorkerPool& pool, int workerCount) {
+    U_PROFILE_FUNCTION();
+    pool.taskCount = 0;
+    pool.nextTask = 0;
+    pool.busyWorkers = 0;
+    pool.generation = 0;
+    pool.quit = false;
+    for (int i = 0; i < workerCount; ++i)
+        pool.threads.push_back(thread(UWorkerMain, &pool, i + 1));
+}
+
+void UDestroyWorkerPool(WorkerPool& pool) {
+    U_PROFILE_FUNCTION();
+    {
+        lock_guard<mutex> lock(pool.lock);
+        pool.quit = true;
+    }
+    pool.wake.notify_all();
+    for (size_t i = 0; i < pool.threads.size(); ++i)
+        pool.threads[i].join();
+    pool.threads.clear();
+}
+
+// Function to run job(task, worker) for every task in [0, taskCount) across the pool and the calling
+// thread, returning when all have finished. Jobs must not issue GL calls: only the calling thread
+// has the context.
+void URunParallel(WorkerPool& pool, int taskCount, const function<void(int, int)>& job) {
+    U_PROFILE_FUNCTION();
+    if (pool.threads.empty() || taskCount <= 1) {
+        for (int task = 0; task < taskCount; ++task)
+            job(task, 0);
+        return;
+    }
+
+    {
+        lock_guard<mutex> lock(pool.lock);
+        pool.job = job;
+        pool.taskCount = taskCount;
+        pool.nextTask = 0;
+        pool.busyWorkers = static_cast<int>(pool.threads.size());
+        pool.generation++;
+    }
+    pool.wake.notify_all();
+
+    URunWorkerTasks(pool, 0);
+
+    unique_lock<mutex> lock(pool.lock);
+    pool.done.wait(lock, [&pool] { return pool.busyWorkers == 0; });
+}
+
+// Function to give the light cluster shaders the grid dimensions
+string UClusterDefines() {
+    ostringstream defines;
+    defines << "#define CLUSTER_X " << CLUSTER_X << "\n#define CLUSTER_Y " << CLUSTER_Y << "\n#define CLUSTER_Z " << CLUSTER_Z
+        << "\n#define CLUSTER_COUNT " << CLUSTER_COUNT << "\n#define CLUSTER_STRIDE " << CLUSTER_STRIDE << "\n";
+    return defines.str();
+}
+
+// Function to set up light clustering: the cluster lists, zeroed so every cluster starts out empty,
+// the light stream and the assignment program. Clusters stay empty until the program is linked.
+void UCreateClusterGrid(GLClusterGrid& grid) {
+    U_PROFILE_FUNCTION();
+    vector<GLuint> empty(static_cast<size_t>(CLUSTER_COUNT) * CLUSTER_STRIDE, 0);
+    glGenBuffers(1, &grid.clusterBuffer);
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, grid.clusterBuffer);
+    glBufferStorage(GL_SHADER_STORAGE_BUFFER, empty.size() * sizeof(GLuint), empty.data(), 0);
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, CLUSTER_BINDING, grid.clusterBuffer);
+
+    UCreateStreamBuffer(grid.lightStream, 64 * sizeof(GLLight));
+
+    grid.program = 0;
+    UCreateComputeProgram(UInjectDefines(clusterLightShaderSource, UClusterDefines()).c_str(), [&grid](GLuint programId) {
+        grid.inverseProjectionLoc = glGetUniformLocation(programId, "inverseProjection");
+        grid.lightCountLoc = glGetUniformLocation(programId, "lightCount");
+        GLuint frameDataIndex = glGetUniformBlockIndex(programId, "FrameData");
+        if (frameDataIndex != GL_INVALID_INDEX)
+            glUniformBlockBinding(programId, frameDataIndex, FRAME_DATA_BINDING);
+        grid.program = programId;
+    });
+}
+
+void UDestroyClusterGrid(GLClusterGrid& grid) {
+    U_PROFILE_FUNCTION();
+    glDeleteProgram(grid.program);
+    glDeleteBuffers(1, &grid.clusterBuffer);
+    UDestroyStreamBuffer(grid.lightStream);
+}
+
+// Function to scatter count lights over the scene: a spiral of colored lights around the broth box,
+// every fourth one a spot light shining down, the rest point lights
+void UCreateLights(int count) {
+    U_PROFILE_FUNCTION();
+    const float goldenAngle = 2.39996323f;
+    for (int i = 0; i < count; ++i) {
+        float distance = 1.0f + 5.0f * sqrt((i + 0.5f) / count);
+        float angle = i * goldenAngle;
+        float hue = (i % 6) / 6.0f * 2.0f * static_cast<float>(M_PI);
+
+        GLLight light;
+        light.positionRadius = glm::vec4(distance * cos(angle), -0.4f + 0.3f * (i % 5), distance * sin(angle), 1.2f);
+        light.color = glm::vec4(0.5f + 0.5f * cos(hue), 0.5f + 0.5f * cos(hue - 2.0944f), 0.5f + 0.5f * cos(hue + 2.0944f), -1.0f);
+        light.direction = glm::vec4(0.0f, -1.0f, 0.0f, -2.0f);
+        if (i % 4 == 3) {
+            light.positionRadius.y = 0.6f;
+            light.positionRadius.w = 2.0f;
+            light.color.w = cos(glm::radians(20.0f));
+            light.direction.w = cos(glm::radians(30.0f));
+        }
+        gLights.push_back(light);
+    }
+
+    cout << "INFO: " << count << " lights in " << CLUSTER_X << "x" << CLUSTER_Y << "x" << CLUSTER_Z << " clusters, at most "
+        << CLUSTER_STRIDE - 1 << " per cluster" << endl;
+}
+
+// Function to stream this frame's lights, each turned about the vertical axis by its own speed, and
+// assign them to clusters on the GPU. Fragments read the lists through CLUSTER_BINDING and LIGHT_BINDING.
+void UAssignLights(GLClusterGrid& grid, const glm::mat4& projection, float time) {
+    U_PROFILE_FUNCTION();
+    if (gLights.empty() || !grid.program)
+        return;
+
+    GLuint lightCount = static_cast<GLuint>(gLights.size());
+    GLintptr offset;
+    GLLight* lights = reinterpret_cast<GLLight*>(UStreamAllocate(grid.lightStream, lightCount * sizeof(GLLight), gStorageBufferAlignment, offset));
+    for (GLuint i = 0; i < lightCount; ++i) {
+        float angle = time * (0.2f + 0.1f * (i % 5));
+        float c = cos(angle);
+        float s = sin(angle);
+        lights[i] = gLights[i];
+        lights[i].positionRadius.x = c * gLights[i].positionRadius.x - s * gLights[i].positionRadius.z;
+        lights[i].positionRadius.z = s * gLights[i].positionRadius.x + c * gLights[i].positionRadius.z;
+    }
+    glBindBufferRange(GL_SHADER_STORAGE_BUFFER, LIGHT_BINDING, grid.lightStream.buffer, offset, lightCount * sizeof(GLLight));
+
+    glUseProgram(grid.program);
+    glUniformMatrix4fv(grid.inverseProjectionLoc, 1, GL_FALSE, glm::value_ptr(glm::inverse(projection)));
+    glUniform1ui(grid.lightCountLoc, lightCount);
+    glDispatchCompute((CLUSTER_COUNT + 63) / 64, 1, 1);
+    glMemoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT);
+}
+
+// Function to place the chicken broth box scene's objects
+void UCreateScene() {
+    U_PROFILE_FUNCTION();
+    Material broth = { gTextureId, glm::vec4(1.0f), true };
+
+    UAddSceneObject(gCubeMesh, broth, glm::mat4(1.0f), false);
+    UAddSceneObject(gCylinderMesh, broth, glm::mat4(1.0f), false);
+    UAddSceneObject(gPlaneMesh, broth, glm::mat4(1.0f), false);
+
+    // Position the sphere next to the cube
+    UAddSceneObject(gSphereMesh, broth, glm::translate(glm::mat4(1.0f), glm::vec3(1.5f, 0.0f, 0.0f)), false);
+
+    // Move pyramid to the left of the cube
+    UAddSceneObject(gPyramidMesh, broth, glm::translate(glm::mat4(1.0f), glm::vec3(-1.5f, 0.0f, 0.0f)), false);
+}
+
+// Function to lay out a grid of spheres and pyramids around the broth box for draw-call stress testing
+void UCreateStressScene(int countPerMesh) {
+    U_PROFILE_FUNCTION();
+    if (countPerMesh <= 0)
+        return;
+
+    gStressScene = true;
+    int side = static_cast<int>(ceil(sqrt(static_cast<float>(countPerMesh))));
+    float spacing = 1.2f;
+
+    for (int i = 0; i < countPerMesh; ++i) {
+        float x = (i % side - side / 2) * spacing;
+        float z = -(i / side) * spacing - 3.0f;
+        gStressSphereTransforms.push_back(glm::translate(glm::mat4(1.0f), glm::vec3(x, 0.0f, z)));
+        gStressPyramidTransforms.push_back(glm::translate(glm::mat4(1.0f), glm::vec3(x, 1.2f, z)));
+        // Every seventh object is translucent so the transparent pass has work to sort
+        float alpha = (i % 7 == 0) ? 0.5f : 1.0f;
+        gStressTints.push_back(glm::vec4(0.5f + 0.5f * (i % 3) / 2.0f, 0.5f + 0.5f * (i % 5) / 4.0f, 1.0f, alpha));
+
+        Material tinted = { gTextureId, gStressTints[i], true };
+        UAddSceneObject(gSphereMesh, tinted, gStressSphereTransforms[i], true);
+        UAddSceneObject(gPyramidMesh, tinted, gStressPyramidTransforms[i], true);
+    }
+
+    cout << "INFO: stress scene with " << countPerMesh << " spheres and " << countPerMesh << " pyramids (press I to toggle instancing)" << endl;
+}
+
+// Function to draw the stress grid one object at a time or with one instanced draw per mesh, for
+// comparison with the render queue path
+void URenderStressScene() {
+    U_PROFILE_FUNCTION();
+    int count = static_cast<int>(gStressSphereTransforms.size());
+
+    // In render queue mode the grid is part of the scene and goes through culling like everything else
+    if (gStressMode == STRESS_MULTI_DRAW)
+        return;
 
-    // bind textures on corresponding texture units
     glActiveTexture(GL_TEXTURE0);
     glBindTexture(GL_TEXTURE_2D, gTextureId);
-    glDrawElements(GL_TRIANGLES, gCubeMesh.nIndices, GL_UNSIGNED_SHORT, nullptr);
 
+    // Both paths draw every object tinted and blended, in grid order, so they render the same image
+    glEnable(GL_BLEND);
+    glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
 
-    // Draw the cylinder
-    glm::mat4 modelCylinder = glm::mat4(1.0f);
-    glUseProgram(gProgramId);
-    modelLoc = glGetUniformLocation(gProgramId, "model");
-    viewLoc = glGetUniformLocation(gProgramId, "view");
-    projLoc = glGetUniformLocation(gProgramId, "projection");
+    if (gStressMode == STRESS_INSTANCED) {
+        UDrawMeshInstanced(gSphereMesh, gStressSphereTransforms.data(), gStressTints.data(), count);
+        UDrawMeshInstanced(gPyramidMesh, gStressPyramidTransforms.data(), gStressTints.data(), count);
+    }
+    else {
+        const GLProgram& program = UShaderVariant(SHADER_FULL);
+        if (program.id) {
+            glUseProgram(program.id);
+            for (int i = 0; i < count; ++i) {
+                glUniformMatrix4fv(program.modelLoc, 1, GL_FALSE, glm::value_ptr(gStressSphereTransforms[i] * gSphereMesh.dequantize));
+                glUniform4fv(program.tintLoc, 1, glm::value_ptr(gStressTints[i]));
+                UDrawMesh(gSphereMesh);
+            }
+            for (int i = 0; i < count; ++i) {
+                glUniformMatrix4fv(program.modelLoc, 1, GL_FALSE, glm::value_ptr(gStressPyramidTransforms[i] * gPyramidMesh.dequantize));
+                glUniform4fv(program.tintLoc, 1, glm::value_ptr(gStressTints[i]));
+                UDrawMesh(gPyramidMesh);
+            }
+        }
+    }
 
-    glUniformMatrix4fv(modelLoc, 1, GL_FALSE, glm::value_ptr(modelCylinder));
-    glUniformMatrix4fv(viewLoc, 1, GL_FALSE, glm::value_ptr(view));
-    glUniformMatrix4fv(projLoc, 1, GL_FALSE, glm::value_ptr(projection));
+    glDisable(GL_BLEND);
+}
 
-    glBindVertexArray(gCylinderMesh.vao);
-    glDrawElements(GL_TRIANGLES, gCylinderMesh.nIndices, GL_UNSIGNED_SHORT, nullptr);
+void URender() {
+    U_PROFILE_FUNCTION();
+    gFrameStats.drawCalls = 0;
+    gFrameStats.objects = 0;
+    gFrameStats.stateChanges = 0;
+    gFrameStats.triangles = 0;
+    gFrameIndex++;
+
+    chrono::steady_clock::time_point renderStart = chrono::steady_clock::now();
+
+    // Waits, if needed, until the GPU is done with the stream regions this frame is about to overwrite
+    UBeginStreamFrame(gStreamFences);
+    UBeginGpuFrame(gGpuProfiler);
+    UBeginGpuScope(gGpuProfiler, "frame");
+
+    UBeginGpuScope(gGpuProfiler, "texture upload");
+    UUpdateTextureLoader(gTextureLoader);
+    UEndGpuScope(gGpuProfiler);
+
+    UBeginGpuScope(gGpuProfiler, "clear");
+    glBindFramebuffer(GL_FRAMEBUFFER, gSceneFramebuffer.fbo);
+    glViewport(0, 0, gSceneFramebuffer.width, gSceneFramebuffer.height);
+    glEnable(GL_DEPTH_TEST);
+    glClearColor(0.0f, 0.0f, 0.0f, 1.0f);
+    glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+    UEndGpuScope(gGpuProfiler);
 
-    glBindVertexArray(gPlaneMesh.vao);
-    glDrawElements(GL_TRIANGLES, gPlaneMesh.nIndices, GL_UNSIGNED_SHORT, nullptr);
+    glm::mat4 projection;
+    if (usePerspective) {
+        // Perspective projection
+        projection = glm::perspective(glm::radians(zoom), (float)WINDOW_WIDTH / (float)WINDOW_HEIGHT, NEAR_PLANE, FAR_PLANE);
+        gLodPixelScale = gSceneFramebuffer.height / (2.0f * tan(glm::radians(zoom) * 0.5f));
+    }
+    else {
+        // Orthographic projection
+        float orthoSize = 3.0f;  // Adjust the size as needed
+        projection = glm::ortho(-orthoSize, orthoSize, -orthoSize, orthoSize, NEAR_PLANE, FAR_PLANE);
+        gLodPixelScale = gSceneFramebuffer.height / (2.0f * orthoSize);
+    }
+    gLodPerspective = usePerspective;
 
-    // Draw the sphere
-    glm::mat4 modelSphere = glm::translate(glm::mat4(1.0f), glm::vec3(1.5f, 0.0f, 0.0f)); // Position the sphere next to the cube
-    glUseProgram(gProgramId); // Use the same shader program as the cube
-    modelLoc = glGetUniformLocation(gProgramId, "model");
-    viewLoc = glGetUniformLocation(gProgramId, "view");
-    projLoc = glGetUniformLocation(gProgramId, "projection");
+    //glm::mat4 projection = glm::perspective(glm::radians(zoom), (float)WINDOW_WIDTH / (float)WINDOW_HEIGHT, 0.1f, 100.0f);
+    glm::mat4 view = glm::lookAt(cameraPosition, cameraPosition + cameraFront, cameraUp); // Updated view matrix
 
-    glUniformMatrix4fv(modelLoc, 1, GL_FALSE, glm::value_ptr(modelSphere));
-    glUniformMatrix4fv(viewLoc, 1, GL_FALSE, glm::value_ptr(view));
-    glUniformMatrix4fv(projLoc, 1, GL_FALSE, glm::value_ptr(projection));
+    // Camera and light source properties are shared by every draw, so they are written once per frame
+    GLFrameData frameData;
+    frameData.view = view;
+    frameData.projection = projection;
+    frameData.lightDirection = glm::vec4(-0.5f, -0.5f, -0.5f, 0.0f); // light direction
+    frameData.lightColor = glm::vec4(1.0f, 1.0f, 0.0f, 0.3f);      // yellow light color, ambient strength in alpha
+    frameData.clusterDepth = glm::vec4(NEAR_PLANE, CLUSTER_Z / log(FAR_PLANE / NEAR_PLANE), gSceneFramebuffer.width, gSceneFramebuffer.height);
+    UUpdateFrameDataBuffer(gFrameDataStream, frameData);
+
+    // Lights move with scene time, one sixtieth of a second per frame, so benchmark runs repeat exactly
+    UBeginGpuScope(gGpuProfiler, "light clusters");
+    UAssignLights(gClusterGrid, projection, gFrameIndex / 60.0f);
+    UEndGpuScope(gGpuProfiler);
+
+    // Visible scene objects are submitted to the render queue, which sorts them and skips redundant state changes
+    UBeginRenderQueue(gRenderQueue, view, FAR_PLANE);
+
+    GLFrustum frustum;
+    UExtractFrustum(projection * view, frustum);
+    UCullScene(frustum);
+
+    if (gStressScene) {
+        UBeginGpuScope(gGpuProfiler, "stress");
+        URenderStressScene();
+        UEndGpuScope(gGpuProfiler);
+    }
 
-    glBindVertexArray(gSphereMesh.vao);
+    UFlushRenderQueue(gRenderQueue);
 
-    glDrawElements(GL_TRIANGLES, gSphereMesh.nIndices, GL_UNSIGNED_SHORT, nullptr);
+    // This frame's depth becomes the occluder set for the next frame
+    if (gOcclusionMode == OCCLUSION_HIZ) {
+        UBeginGpuScope(gGpuProfiler, "hi-z build");
+        UBuildHiZ(gOcclusion, gSceneFramebuffer, projection * view);
+        UEndGpuScope(gGpuProfiler);
+    }
 
-    // Draw the pyramid
-    glm::mat4 modelPyramid = glm::mat4(1.0f);
-    modelPyramid = glm::translate(modelPyramid, glm::vec3(-1.5f, 0.0f, 0.0f)); // Move pyramid to the left of the cube
-    modelLoc = glGetUniformLocation(gProgramId, "model");
-    viewLoc = glGetUniformLocation(gProgramId, "view");
-    projLoc = glGetUniformLocation(gProgramId, "projection");
+    if (gStressScene) {
+        // Report the draw-call count and frame time once per second
+        static double lastReport = UProfileNow() / 1.0e9;
+        static int framesSinceReport = 0;
+        ++framesSinceReport;
+        double now = UProfileNow() / 1.0e9;
+        if (now - lastReport >= 1.0) {
+            cout << "INFO: " << STRESS_MODE_NAMES[gStressMode] << ": " << gFrameStats.drawCalls << " draw calls, "
+                << gFrameStats.stateChanges << " state changes for " << gFrameStats.objects << " objects ("
+                << gFrameStats.triangles << " triangles), " << gStreamFences.frameWaitMs << " ms fence wait, "
+                << (now - lastReport) * 1000.0 / framesSinceReport << " ms/frame" << endl;
+            cout << "INFO: culling: " << gCullStats.objectsTested << " objects tested (" << gCullStats.nodesTested << " nodes), "
+                << gCullStats.objectsCulled << " culled, " << gCullStats.objectsDrawn << " drawn (" << gCullStats.meshletsCulled
+                << " meshlets culled), occlusion "
+                << OCCLUSION_MODE_NAMES[gOcclusionMode];
+            if (gOcclusionMode == OCCLUSION_QUERIES)
+                cout << " (" << gCullStats.objectsOccluded << " occluded)";
+            cout << endl;
+
+            // The "frame" scope is opened first, so it is always the first GPU timing
+            float minMs, avgMs, p99Ms;
+            if (!gGpuProfiler.scopes.empty()) {
+                USummarizeTiming(gGpuProfiler.scopes[0], minMs, avgMs, p99Ms);
+                cout << "INFO: gpu frame: min " << minMs << " avg " << avgMs << " p99 " << p99Ms << " ms" << endl;
+            }
+            lastReport = now;
+            framesSinceReport = 0;
+        }
+    }
 
-    glUniformMatrix4fv(modelLoc, 1, GL_FALSE, glm::value_ptr(modelPyramid));
-    glUniformMatrix4fv(viewLoc, 1, GL_FALSE, glm::value_ptr(view));
-    glUniformMatrix4fv(projLoc, 1, GL_FALSE, glm::value_ptr(projection));
+    // Present the offscreen scene; headless runs have no window, so the frame stays in the framebuffer
+    if (!gHeadless) {
+        UBeginGpuScope(gGpuProfiler, "present");
+        glBindFramebuffer(GL_READ_FRAMEBUFFER, gSceneFramebuffer.fbo);
+        glBindFramebuffer(GL_DRAW_FRAMEBUFFER, 0);
+        glBlitFramebuffer(0, 0, gSceneFramebuffer.width, gSceneFramebuffer.height, 0, 0, gWindowFramebufferWidth, gWindowFramebufferHeight,
+            GL_COLOR_BUFFER_BIT, GL_LINEAR);
+        glBindFramebuffer(GL_FRAMEBUFFER, 0);
+        UEndGpuScope(gGpuProfiler);
+    }
+    UEndGpuScope(gGpuProfiler); // frame
 
-    glBindVertexArray(gPyramidMesh.vao);
-    glDrawElements(GL_TRIANGLES, gPyramidMesh.nIndices, GL_UNSIGNED_SHORT, nullptr);
+    UEndStreamFrame(gStreamFences);
+    URecordTiming(gCpuRenderTiming, chrono::duration<float, milli>(chrono::steady_clock::now() - renderStart).count());
 
-    glfwSwapBuffers(gWindow);
+    if (gHeadless)
+        glFlush();
+    else
+        glfwSwapBuffers(gWindow);
 }
 